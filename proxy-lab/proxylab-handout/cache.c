@@ -0,0 +1,245 @@
+/*
+ * cache.c - Sharded LRU web object cache
+ *
+ * Each shard owns MAX_CACHE_SIZE / nshards bytes. There are at most
+ * MAX_CACHE_SIZE / MAX_OBJECT_SIZE shards, so that every shard can
+ * hold any object the unsharded cache could; more cores share them.
+ * Objects larger than MAX_OBJECT_SIZE are never cached. A lookup moves the object
+ * to the front of its shard's list; an insert evicts from the back
+ * until the new object fits.
+ */
+#include "cache.h"
+
+typedef struct cache_obj {
+	char *key;                  /* request URI */
+	char *data;                 /* full response, headers included */
+	size_t size;                /* bytes in data */
+	struct cache_obj *prev;     /* towards most recently used */
+	struct cache_obj *next;     /* towards least recently used */
+} cache_obj_t;
+
+typedef struct {
+	sem_t mutex;                /* protects everything below */
+	cache_obj_t *head;          /* most recently used */
+	cache_obj_t *tail;          /* least recently used */
+	size_t used;                /* bytes of object data held */
+	size_t capacity;            /* byte budget for this shard */
+} __attribute__((aligned(64))) cache_shard_t;
+
+static cache_shard_t *shards;
+static int num_shards;
+
+static void unlink_obj(cache_shard_t *sp, cache_obj_t *obj);
+static void push_front(cache_shard_t *sp, cache_obj_t *obj);
+
+/*
+ * cache_init - Create nshards empty shards sharing MAX_CACHE_SIZE,
+ *              or as many as still fit MAX_OBJECT_SIZE each
+ */
+void cache_init(int nshards)
+{
+	int i;
+
+	if (nshards < 1)
+		nshards = 1;
+	if (nshards > MAX_CACHE_SIZE / MAX_OBJECT_SIZE)
+		nshards = MAX_CACHE_SIZE / MAX_OBJECT_SIZE;
+	num_shards = nshards;
+	shards = Calloc(nshards, sizeof(cache_shard_t));
+	for (i = 0; i < nshards; i++) {
+		Sem_init(&shards[i].mutex, 0, 1);
+		shards[i].capacity = MAX_CACHE_SIZE / nshards;
+	}
+}
+
+/*
+ * cache_shard_of - Map a key to its owning shard (FNV-1a hash)
+ */
+int cache_shard_of(const char *key)
+{
+	unsigned int h = 2166136261u;
+
+	while (*key) {
+		h ^= (unsigned char)*key++;
+		h *= 16777619u;
+	}
+	return h % num_shards;
+}
+
+/*
+ * cache_contains - Returns 1 if key is cached, without touching
+ *                  its LRU position
+ */
+int cache_contains(const char *key)
+{
+	cache_shard_t *sp = &shards[cache_shard_of(key)];
+	cache_obj_t *obj;
+	int hit = 0;
+
+	P(&sp->mutex);
+	for (obj = sp->head; obj != NULL; obj = obj->next) {
+		if (!strcmp(obj->key, key)) {
+			hit = 1;
+			break;
+		}
+	}
+	V(&sp->mutex);
+	return hit;
+}
+
+/*
+ * cache_get - Copy the object for key into buf (at least
+ *             MAX_OBJECT_SIZE bytes) and store its length in *size.
+ *             Returns 1 on a hit, 0 on a miss.
+ */
+int cache_get(const char *key, char *buf, size_t *size)
+{
+	cache_shard_t *sp = &shards[cache_shard_of(key)];
+	cache_obj_t *obj;
+	int hit = 0;
+
+	P(&sp->mutex);
+	for (obj = sp->head; obj != NULL; obj = obj->next) {
+		if (!strcmp(obj->key, key)) {
+			memcpy(buf, obj->data, obj->size);
+			*size = obj->size;
+			unlink_obj(sp, obj);
+			push_front(sp, obj);
+			hit = 1;
+			break;
+		}
+	}
+	V(&sp->mutex);
+	return hit;
+}
+
+/*
+ * cache_put - Insert a copy of data under key, evicting least
+ *             recently used objects from the shard as needed.
+ */
+void cache_put(const char *key, const char *data, size_t size)
+{
+	cache_shard_t *sp = &shards[cache_shard_of(key)];
+	cache_obj_t *obj, *victim;
+
+	if (size > MAX_OBJECT_SIZE || size > sp->capacity)
+		return;
+
+	obj = Malloc(sizeof(cache_obj_t));
+	obj->key = Malloc(strlen(key) + 1);
+	strcpy(obj->key, key);
+	obj->data = Malloc(size);
+	memcpy(obj->data, data, size);
+	obj->size = size;
+
+	P(&sp->mutex);
+	/* Drop a stale copy of the same object, if any */
+	for (victim = sp->head; victim != NULL; victim = victim->next) {
+		if (!strcmp(victim->key, key)) {
+			unlink_obj(sp, victim);
+			sp->used -= victim->size;
+			Free(victim->key);
+			Free(victim->data);
+			Free(victim);
+			break;
+		}
+	}
+	while (sp->used + size > sp->capacity && sp->tail != NULL) {
+		victim = sp->tail;
+		unlink_obj(sp, victim);
+		sp->used -= victim->size;
+		Free(victim->key);
+		Free(victim->data);
+		Free(victim);
+	}
+	push_front(sp, obj);
+	sp->used += size;
+	V(&sp->mutex);
+}
+
+/*
+ * cache_dump - Write every cached object to fd, least recently used
+ *              first, followed by an end marker. Each object is a
+ *              header giving the key and data lengths, then the key,
+ *              then the data. Returns 0 on success, -1 on error.
+ */
+int cache_dump(int fd)
+{
+	cache_shard_t *sp;
+	cache_obj_t *obj;
+	unsigned int hdr[2];
+	int i, rc = 0;
+
+	for (i = 0; i < num_shards && rc == 0; i++) {
+		sp = &shards[i];
+		P(&sp->mutex);
+		for (obj = sp->tail; obj != NULL && rc == 0; obj = obj->prev) {
+			hdr[0] = strlen(obj->key);
+			hdr[1] = obj->size;
+			if (rio_writen(fd, hdr, sizeof(hdr)) < 0 ||
+					rio_writen(fd, obj->key, hdr[0]) < 0 ||
+					rio_writen(fd, obj->data, obj->size) < 0)
+				rc = -1;
+		}
+		V(&sp->mutex);
+	}
+	hdr[0] = hdr[1] = 0;
+	if (rc == 0 && rio_writen(fd, hdr, sizeof(hdr)) < 0)
+		rc = -1;
+	return rc;
+}
+
+/*
+ * cache_load - Insert the objects written by cache_dump() on fd.
+ *              Returns the number of objects loaded, or -1 if the
+ *              stream ended early or was malformed.
+ */
+int cache_load(int fd)
+{
+	unsigned int hdr[2];
+	char key[MAXLINE];
+	char *data = Malloc(MAX_OBJECT_SIZE);
+	int n = 0;
+
+	while (rio_readn(fd, hdr, sizeof(hdr)) == sizeof(hdr)) {
+		if (hdr[0] == 0) {
+			Free(data);
+			return n;
+		}
+		if (hdr[0] >= MAXLINE || hdr[1] > MAX_OBJECT_SIZE ||
+				rio_readn(fd, key, hdr[0]) != hdr[0] ||
+				rio_readn(fd, data, hdr[1]) != hdr[1])
+			break;
+		key[hdr[0]] = '\0';
+		cache_put(key, data, hdr[1]);
+		n++;
+	}
+	Free(data);
+	return -1;
+}
+
+/* unlink_obj - Remove obj from the shard's LRU list (mutex held) */
+static void unlink_obj(cache_shard_t *sp, cache_obj_t *obj)
+{
+	if (obj->prev)
+		obj->prev->next = obj->next;
+	else
+		sp->head = obj->next;
+	if (obj->next)
+		obj->next->prev = obj->prev;
+	else
+		sp->tail = obj->prev;
+	obj->prev = obj->next = NULL;
+}
+
+/* push_front - Make obj the shard's most recently used (mutex held) */
+static void push_front(cache_shard_t *sp, cache_obj_t *obj)
+{
+	obj->prev = NULL;
+	obj->next = sp->head;
+	if (sp->head)
+		sp->head->prev = obj;
+	sp->head = obj;
+	if (sp->tail == NULL)
+		sp->tail = obj;
+}
@@ -0,0 +1,25 @@
+/*
+ * cache.h - Web object cache for the proxy
+ *
+ * Objects are keyed by request URI and kept in LRU order. The cache
+ * is split into shards selected by a hash of the key; each shard has
+ * its own lock, byte budget and LRU list so that workers running on
+ * different cores only contend when they touch the same shard.
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "csapp.h"
+
+#define MAX_CACHE_SIZE 1049000
+#define MAX_OBJECT_SIZE 102400
+
+void cache_init(int nshards);
+int cache_shard_of(const char *key);
+int cache_contains(const char *key);
+int cache_get(const char *key, char *buf, size_t *size);
+void cache_put(const char *key, const char *data, size_t size);
+int cache_dump(int fd);
+int cache_load(int fd);
+
+#endif /* __CACHE_H__ */
@@ -0,0 +1,168 @@
+/*
+ * handover.c - Passing listening sockets and the cache to a new proxy
+ *
+ * The descriptors travel as SCM_RIGHTS ancillary data on a one-byte
+ * message holding their count. The cache follows on the same stream
+ * in the format written by cache_dump().
+ */
+#define _GNU_SOURCE
+#include <sys/un.h>
+#include "handover.h"
+#include "cache.h"
+
+static int unix_addr(const char *path, struct sockaddr_un *addr);
+
+/*
+ * handover_listen - Create the control socket at path, replacing any
+ *                   stale one. Only our own user may connect to it,
+ *                   as a successor gets our sockets and cache. Returns
+ *                   the listening descriptor, or -1 and sets errno on
+ *                   error. Call before starting threads: it sets the
+ *                   process umask for a moment.
+ */
+int handover_listen(const char *path)
+{
+	int ctlfd, rc;
+	struct sockaddr_un addr;
+	mode_t old;
+
+	if (unix_addr(path, &addr) < 0)
+		return -1;
+	if ((ctlfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	unlink(path);
+	old = umask(077);
+	rc = bind(ctlfd, (SA *)&addr, sizeof(addr));
+	umask(old);
+	if (rc < 0 || listen(ctlfd, 1) < 0) {
+		close(ctlfd);
+		return -1;
+	}
+	return ctlfd;
+}
+
+/*
+ * handover_accept - Wait for a successor on the control socket and
+ *                   read its request. Connections from processes of
+ *                   other users are closed. Returns the connection,
+ *                   or -1 on error.
+ */
+int handover_accept(int ctlfd, int *want_cache)
+{
+	struct ucred cred;
+	socklen_t len;
+	int connfd;
+	char req;
+
+	while ((connfd = accept(ctlfd, NULL, NULL)) >= 0) {
+		len = sizeof(cred);
+		if (getsockopt(connfd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+				cred.uid == getuid() &&
+				rio_readn(connfd, &req, 1) == 1 &&
+				(req == HANDOVER_SOCKETS || req == HANDOVER_CACHE)) {
+			*want_cache = (req == HANDOVER_CACHE);
+			return connfd;
+		}
+		close(connfd);   /* not one of our proxies; keep waiting */
+	}
+	return -1;
+}
+
+/*
+ * handover_send_fds - Pass nfds descriptors over connfd.
+ *                     Returns 0 on success, -1 on error.
+ */
+int handover_send_fds(int connfd, int *fds, int nfds)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char count = nfds;
+	char control[CMSG_SPACE(sizeof(int) * HANDOVER_MAXFDS)];
+
+	if (nfds < 1 || nfds > HANDOVER_MAXFDS)
+		return -1;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	iov.iov_base = &count;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+
+	return sendmsg(connfd, &msg, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+/*
+ * handover_takeover - Connect to the running proxy's control socket
+ *     at path and take over its listening sockets (and its cache if
+ *     want_cache). Returns the number of descriptors stored in fds,
+ *     or -1 and sets errno on error.
+ */
+int handover_takeover(const char *path, int *fds, int maxfds, int want_cache)
+{
+	int sock, nfds;
+	char req = want_cache ? HANDOVER_CACHE : HANDOVER_SOCKETS;
+	char count;
+	struct sockaddr_un addr;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char control[CMSG_SPACE(sizeof(int) * HANDOVER_MAXFDS)];
+
+	if (unix_addr(path, &addr) < 0)
+		return -1;
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if (connect(sock, (SA *)&addr, sizeof(addr)) < 0 ||
+			rio_writen(sock, &req, 1) < 0) {
+		close(sock);
+		return -1;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &count;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if (recvmsg(sock, &msg, 0) != 1 ||
+			(cmsg = CMSG_FIRSTHDR(&msg)) == NULL ||
+			cmsg->cmsg_level != SOL_SOCKET ||
+			cmsg->cmsg_type != SCM_RIGHTS) {
+		close(sock);
+		errno = EPROTO;
+		return -1;
+	}
+	nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	if (nfds > maxfds)
+		nfds = maxfds;
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * nfds);
+
+	if (want_cache && cache_load(sock) < 0)
+		fprintf(stderr, "handover: cache transfer incomplete\n");
+	close(sock);
+	return nfds;
+}
+
+/* unix_addr - Fill in a UNIX domain address for path */
+static int unix_addr(const char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * handover.h - Zero-downtime restart of the proxy
+ *
+ * A proxy started with a control socket path waits on that UNIX
+ * socket for its successor. The successor connects, receives the
+ * listening sockets over SCM_RIGHTS and, if it asks for it, a copy of
+ * the cache. The old process then stops accepting, finishes the
+ * connections it is serving and exits. Connections that arrive in
+ * between wait in the shared listen queue, so none are refused. If
+ * the sockets cannot be passed, the old process goes on accepting and
+ * waits for another successor. Only processes of the proxy's own user
+ * may connect to the control socket.
+ */
+#ifndef __HANDOVER_H__
+#define __HANDOVER_H__
+
+#include "csapp.h"
+
+#define HANDOVER_MAXFDS 64     /* most listening sockets handed over */
+
+#define HANDOVER_SOCKETS 'L'   /* successor wants the listeners only */
+#define HANDOVER_CACHE   'C'   /* successor wants listeners and cache */
+
+int handover_listen(const char *path);
+int handover_accept(int ctlfd, int *want_cache);
+int handover_send_fds(int connfd, int *fds, int nfds);
+int handover_takeover(const char *path, int *fds, int maxfds, int want_cache);
+
+#endif /* __HANDOVER_H__ */
@@ -0,0 +1,292 @@
+/*
+ * httpparse.c - Delimiter scanning parsers for HTTP requests and URIs
+ *
+ * Every parser is a sequence of "skip to the first byte in this set
+ * of character ranges" steps. The set is kept in the layout that the
+ * SSE4.2 PCMPESTRI instruction takes for its range mode, so the
+ * vector scanner compares 16 input bytes against all ranges at once.
+ * The scalar scanner tests the same ranges a byte at a time; it
+ * handles CPUs without SSE4.2 and the last few bytes of a buffer.
+ */
+#include <string.h>
+#include <strings.h>
+#include "httpparse.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HAVE_SSE42_SCANNER
+#endif
+
+/* Up to 8 inclusive [lo, hi] byte ranges, padded for a 16-byte load */
+struct char_ranges {
+	char ranges[16] __attribute__((aligned(16)));
+	int n;                      /* bytes of ranges in use (2 per range) */
+};
+
+/* A request line token ends at a space or control character */
+static const struct char_ranges token_end = { "\x00\x20\x7f\x7f", 4 };
+/* A header name ends at ':' (or an invalid space/control character) */
+static const struct char_ranges name_end = { "\x00\x20::\x7f\x7f", 6 };
+/* A header value ends at CR or LF; other controls but tab are invalid */
+static const struct char_ranges value_end = { "\x00\x08\x0a\x1f\x7f\x7f", 6 };
+/* URI components */
+static const struct char_ranges host_end = { "\x00\x20::\x2f\x2f??##\x7f\x7f", 12 };
+static const struct char_ranges path_end = { "\x00\x20??##\x7f\x7f", 8 };
+static const struct char_ranges query_end = { "\x00\x20##\x7f\x7f", 6 };
+
+static const char *scan_scalar(const char *p, const char *end,
+		const struct char_ranges *cr);
+#ifdef HAVE_SSE42_SCANNER
+static const char *scan_sse42(const char *p, const char *end,
+		const struct char_ranges *cr);
+#endif
+
+int http_use_simd = 0;
+
+/*
+ * scan - Return the first byte in [p, end) that falls in one of the
+ *        ranges of cr, or end if there is none.
+ */
+static inline const char *scan(const char *p, const char *end,
+		const struct char_ranges *cr)
+{
+#ifdef HAVE_SSE42_SCANNER
+	if (http_use_simd)
+		return scan_sse42(p, end, cr);
+#endif
+	return scan_scalar(p, end, cr);
+}
+
+/*
+ * http_parse_init - Use the vector scanner if the CPU supports it
+ */
+void http_parse_init(void)
+{
+#ifdef HAVE_SSE42_SCANNER
+	__builtin_cpu_init();
+	http_use_simd = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+/*
+ * http_parse_request_line - Parse "METHOD URI VERSION\r\n" at buf.
+ *     Returns the number of bytes consumed, HTTP_PARSE_INCOMPLETE if
+ *     the line is not complete yet, or HTTP_PARSE_ERROR.
+ */
+ssize_t http_parse_request_line(const char *buf, size_t len,
+		struct http_request_line *rl)
+{
+	const char *p = buf, *end = buf + len, *tok;
+
+	/* Method and URI each end at exactly one space */
+	tok = p;
+	if ((p = scan(p, end, &token_end)) == end)
+		return HTTP_PARSE_INCOMPLETE;
+	if (*p != ' ' || p == tok)
+		return HTTP_PARSE_ERROR;
+	rl->method.base = tok;
+	rl->method.len = p++ - tok;
+
+	tok = p;
+	if ((p = scan(p, end, &token_end)) == end)
+		return HTTP_PARSE_INCOMPLETE;
+	if (*p != ' ' || p == tok)
+		return HTTP_PARSE_ERROR;
+	rl->uri.base = tok;
+	rl->uri.len = p++ - tok;
+
+	/* Version ends the line; accept a bare LF as well as CRLF */
+	tok = p;
+	if ((p = scan(p, end, &token_end)) == end)
+		return HTTP_PARSE_INCOMPLETE;
+	if (p == tok)
+		return HTTP_PARSE_ERROR;
+	rl->version.base = tok;
+	rl->version.len = p - tok;
+	if (*p == '\r' && ++p == end)
+		return HTTP_PARSE_INCOMPLETE;
+	if (*p != '\n')
+		return HTTP_PARSE_ERROR;
+	return p + 1 - buf;
+}
+
+/*
+ * http_parse_headers - Parse header lines up to and including the
+ *     blank line that ends them. On entry *nhdrs is the capacity of
+ *     hdrs; on success it is the number of headers found. Returns the
+ *     number of bytes consumed, HTTP_PARSE_INCOMPLETE, or
+ *     HTTP_PARSE_ERROR (also when there are more than *nhdrs headers).
+ */
+ssize_t http_parse_headers(const char *buf, size_t len,
+		struct http_header *hdrs, int *nhdrs)
+{
+	const char *p = buf, *end = buf + len, *tok, *vend;
+	int n = 0;
+
+	while (1) {
+		if (p == end)
+			return HTTP_PARSE_INCOMPLETE;
+		if (*p == '\r') {
+			if (p + 1 == end)
+				return HTTP_PARSE_INCOMPLETE;
+			if (p[1] != '\n')
+				return HTTP_PARSE_ERROR;
+			*nhdrs = n;
+			return p + 2 - buf;
+		}
+		if (*p == '\n') {
+			*nhdrs = n;
+			return p + 1 - buf;
+		}
+		if (n == *nhdrs)
+			return HTTP_PARSE_ERROR;
+
+		/* Field name up to the colon */
+		tok = p;
+		if ((p = scan(p, end, &name_end)) == end)
+			return HTTP_PARSE_INCOMPLETE;
+		if (*p != ':' || p == tok)
+			return HTTP_PARSE_ERROR;
+		hdrs[n].name.base = tok;
+		hdrs[n].name.len = p++ - tok;
+
+		/* Field value, without surrounding white space */
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+		tok = p;
+		if ((p = scan(p, end, &value_end)) == end)
+			return HTTP_PARSE_INCOMPLETE;
+		vend = p;
+		if (*p == '\r' && ++p == end)
+			return HTTP_PARSE_INCOMPLETE;
+		if (*p != '\n')
+			return HTTP_PARSE_ERROR;
+		p++;
+		while (vend > tok && (vend[-1] == ' ' || vend[-1] == '\t'))
+			vend--;
+		hdrs[n].value.base = tok;
+		hdrs[n].value.len = vend - tok;
+		n++;
+	}
+}
+
+/*
+ * http_parse_uri - Split an absolute ("http://host[:port][/path][?query]")
+ *     or origin-form ("/path[?query]") URI into its parts. A missing
+ *     path is reported as "/". Returns 0 on success or HTTP_PARSE_ERROR.
+ */
+int http_parse_uri(const char *uri, size_t len, struct http_uri *u)
+{
+	const char *p = uri, *end = uri + len, *tok;
+
+	u->host.base = uri;
+	u->host.len = 0;
+	u->port = 80;
+	u->query.base = end;
+	u->query.len = 0;
+
+	if (len >= 7 && !strncasecmp(uri, "http://", 7)) {
+		p += 7;
+		tok = p;
+		p = scan(p, end, &host_end);
+		if (p == tok)
+			return HTTP_PARSE_ERROR;
+		u->host.base = tok;
+		u->host.len = p - tok;
+
+		if (p < end && *p == ':') {
+			tok = ++p;
+			u->port = 0;
+			while (p < end && *p >= '0' && *p <= '9') {
+				u->port = u->port * 10 + (*p++ - '0');
+				if (u->port > 65535)
+					return HTTP_PARSE_ERROR;
+			}
+			if (p == tok || u->port == 0)
+				return HTTP_PARSE_ERROR;
+		}
+	} else if (p == end || *p != '/') {
+		return HTTP_PARSE_ERROR;
+	}
+
+	if (p == end || *p == '?' || *p == '#') {
+		u->path.base = "/";
+		u->path.len = 1;
+	} else if (*p == '/') {
+		tok = p;
+		p = scan(p, end, &path_end);
+		u->path.base = tok;
+		u->path.len = p - tok;
+	} else {
+		return HTTP_PARSE_ERROR;
+	}
+
+	if (p < end && *p == '?') {
+		tok = ++p;
+		p = scan(p, end, &query_end);
+		u->query.base = tok;
+		u->query.len = p - tok;
+	}
+
+	/* Only a fragment may follow */
+	if (p < end && *p != '#')
+		return HTTP_PARSE_ERROR;
+	return 0;
+}
+
+/*
+ * http_find_header - Return the first header called name (compared
+ *                    case-insensitively), or NULL
+ */
+const struct http_header *http_find_header(const struct http_header *hdrs,
+		int nhdrs, const char *name)
+{
+	size_t len = strlen(name);
+	int i;
+
+	for (i = 0; i < nhdrs; i++)
+		if (hdrs[i].name.len == len &&
+				!strncasecmp(hdrs[i].name.base, name, len))
+			return &hdrs[i];
+	return NULL;
+}
+
+/* scan_scalar - Byte-at-a-time version of scan() */
+static const char *scan_scalar(const char *p, const char *end,
+		const struct char_ranges *cr)
+{
+	unsigned char c;
+	int i;
+
+	for (; p < end; p++) {
+		c = (unsigned char)*p;
+		for (i = 0; i < cr->n; i += 2)
+			if (c >= (unsigned char)cr->ranges[i] &&
+					c <= (unsigned char)cr->ranges[i + 1])
+				return p;
+	}
+	return end;
+}
+
+#ifdef HAVE_SSE42_SCANNER
+/* scan_sse42 - 16 bytes per PCMPESTRI, scalar for the tail */
+__attribute__((target("sse4.2")))
+static const char *scan_sse42(const char *p, const char *end,
+		const struct char_ranges *cr)
+{
+	__m128i ranges = _mm_load_si128((const __m128i *)cr->ranges);
+	__m128i b;
+	int i;
+
+	while (end - p >= 16) {
+		b = _mm_loadu_si128((const __m128i *)p);
+		i = _mm_cmpestri(ranges, cr->n, b, 16,
+				_SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+				_SIDD_LEAST_SIGNIFICANT);
+		if (i != 16)
+			return p + i;
+		p += 16;
+	}
+	return scan_scalar(p, end, cr);
+}
+#endif
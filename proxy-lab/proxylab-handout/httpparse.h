@@ -0,0 +1,53 @@
+/*
+ * httpparse.h - HTTP request line, header and URI parsing
+ *
+ * The parsers never copy: every field is returned as a pointer into
+ * the caller's buffer plus a length. Delimiters are found with a
+ * character-range scanner that tests 16 bytes per instruction with
+ * SSE4.2 when the CPU has it (as picohttpparser does) and falls back
+ * to a byte loop otherwise.
+ */
+#ifndef __HTTPPARSE_H__
+#define __HTTPPARSE_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define HTTP_PARSE_ERROR      -1   /* malformed input */
+#define HTTP_PARSE_INCOMPLETE -2   /* need more bytes */
+
+struct http_token {
+	const char *base;
+	size_t len;
+};
+
+struct http_request_line {
+	struct http_token method;
+	struct http_token uri;
+	struct http_token version;
+};
+
+struct http_header {
+	struct http_token name;
+	struct http_token value;
+};
+
+struct http_uri {
+	struct http_token host;     /* empty for origin-form URIs ("/path") */
+	int port;                   /* 80 unless the URI names one */
+	struct http_token path;     /* "/" when the URI has no path */
+	struct http_token query;    /* after '?', empty if none */
+};
+
+extern int http_use_simd;       /* set by http_parse_init() if supported */
+
+void http_parse_init(void);
+ssize_t http_parse_request_line(const char *buf, size_t len,
+		struct http_request_line *rl);
+ssize_t http_parse_headers(const char *buf, size_t len,
+		struct http_header *hdrs, int *nhdrs);
+int http_parse_uri(const char *uri, size_t len, struct http_uri *u);
+const struct http_header *http_find_header(const struct http_header *hdrs,
+		int nhdrs, const char *name);
+
+#endif /* __HTTPPARSE_H__ */
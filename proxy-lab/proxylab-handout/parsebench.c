@@ -0,0 +1,276 @@
+/*
+ * parsebench.c - Throughput benchmark and fuzz test for httpparse.c
+ *
+ * Without -f, times the request line, header and URI parsers on a
+ * typical browser request with the scalar and (if the CPU has it)
+ * the SSE4.2 scanner. With -f, checks a table of tricky URIs against
+ * their expected parse, then runs random mutations of sample inputs
+ * through both scanners and reports any disagreement. Each input is
+ * copied to the very end of its own allocation, so building with
+ * -fsanitize=address also catches reads past the end of the input.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "httpparse.h"
+
+#define MAXHDRS 64
+
+static const char *sample_request =
+	"GET http://www.cs.cmu.edu:8080/~213/labs/proxylab.html?term=f14&x=1 HTTP/1.1\r\n"
+	"Host: www.cs.cmu.edu:8080\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate\r\n"
+	"Referer: http://www.cs.cmu.edu/~213/schedule.html\r\n"
+	"Cookie: session=6c1a0f3e9b7d4a2e8f5c; prefs=compact; theme=light\r\n"
+	"Connection: keep-alive\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"\r\n";
+
+static const char *fuzz_seeds[] = {
+	"GET http://www.cmu.edu/ HTTP/1.0\r\nHost: www.cmu.edu\r\n\r\n",
+	"GET http://localhost:15213 HTTP/1.0\n\n",
+	"GET http://a.b.c:80/d/e/f?g=h#i HTTP/1.1\r\nX:  y \r\n\r\n",
+	"GET /cgi-bin/adder?1&2 HTTP/1.0\r\nA: b\r\nC:\r\n\r\n",
+	"HEAD http://[::1]:8080/x HTTP/1.0\r\n\r\n",
+};
+
+/* Expected results for URIs the old parse_uri got wrong */
+static struct {
+	const char *uri;
+	int rc;
+	const char *host, *path, *query;
+	int port;
+} uri_cases[] = {
+	{ "http://www.cmu.edu", 0, "www.cmu.edu", "/", "", 80 },
+	{ "http://www.cmu.edu/", 0, "www.cmu.edu", "/", "", 80 },
+	{ "http://www.cmu.edu:8080", 0, "www.cmu.edu", "/", "", 8080 },
+	{ "http://www.cmu.edu:8080/a/b.html", 0, "www.cmu.edu", "/a/b.html", "", 8080 },
+	{ "http://www.cmu.edu?q=1", 0, "www.cmu.edu", "/", "q=1", 80 },
+	{ "http://www.cmu.edu:81?q=1#f", 0, "www.cmu.edu", "/", "q=1", 81 },
+	{ "HTTP://Host/x?", 0, "Host", "/x", "", 80 },
+	{ "/index.html", 0, "", "/index.html", "", 80 },
+	{ "http://", -1, NULL, NULL, NULL, 0 },
+	{ "http://host:", -1, NULL, NULL, NULL, 0 },
+	{ "http://host:99999/", -1, NULL, NULL, NULL, 0 },
+	{ "http://host:80x/", -1, NULL, NULL, NULL, 0 },
+	{ "http://host/a b", -1, NULL, NULL, NULL, 0 },
+	{ "www.cmu.edu/", -1, NULL, NULL, NULL, 0 },
+	{ "", -1, NULL, NULL, NULL, 0 },
+};
+
+struct parse_result {
+	ssize_t line_rc, hdr_rc;
+	int uri_rc, nhdrs;
+	struct http_request_line rl;
+	struct http_uri u;
+	struct http_header hdrs[MAXHDRS];
+};
+
+static void parse_all(const char *buf, size_t len, struct parse_result *r);
+static int check_uri_cases(void);
+static int fuzz(long cases, unsigned int seed);
+static double bench(const char *req, long iters);
+static double now(void);
+static int token_is(const struct http_token *tok, const char *s);
+
+int main(int argc, char **argv)
+{
+	long iters = 1000000, cases = 0;
+	unsigned int seed = 1;
+	double scalar, simd;
+	int c, fails;
+
+	while ((c = getopt(argc, argv, "n:f:s:")) != -1) {
+		switch (c) {
+		case 'n':
+			iters = atol(optarg);
+			break;
+		case 'f':
+			cases = atol(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n <iters>] [-f <cases> [-s <seed>]]\n",
+					argv[0]);
+			exit(1);
+		}
+	}
+
+	http_parse_init();
+
+	if (cases > 0) {
+		fails = check_uri_cases() + fuzz(cases, seed);
+		printf("%s: %d failures\n", fails ? "FAIL" : "PASS", fails);
+		exit(fails ? 1 : 0);
+	}
+
+	if (!http_use_simd) {
+		printf("SSE4.2 not available; timing the scalar scanner only\n");
+		printf("scalar: %8.1f ns/request\n", bench(sample_request, iters));
+		exit(0);
+	}
+	http_use_simd = 0;
+	scalar = bench(sample_request, iters);
+	http_use_simd = 1;
+	simd = bench(sample_request, iters);
+	printf("request of %zu bytes, %ld iterations\n",
+			strlen(sample_request), iters);
+	printf("scalar: %8.1f ns/request %8.1f MB/s\n", scalar,
+			strlen(sample_request) / scalar * 1e3);
+	printf("sse4.2: %8.1f ns/request %8.1f MB/s\n", simd,
+			strlen(sample_request) / simd * 1e3);
+	exit(0);
+}
+
+/*
+ * bench - Parse req iters times; returns the mean ns per request
+ */
+static double bench(const char *req, long iters)
+{
+	struct parse_result r;
+	size_t len = strlen(req);
+	double start;
+	long i, sink = 0;
+
+	start = now();
+	for (i = 0; i < iters; i++) {
+		parse_all(req, len, &r);
+		sink += r.nhdrs + r.u.port;
+	}
+	if (sink == 42)    /* keep the loop from being optimized away */
+		printf(" ");
+	return (now() - start) * 1e9 / iters;
+}
+
+/*
+ * parse_all - Run every parser over one request
+ */
+static void parse_all(const char *buf, size_t len, struct parse_result *r)
+{
+	r->nhdrs = MAXHDRS;
+	r->hdr_rc = HTTP_PARSE_ERROR;
+	r->uri_rc = HTTP_PARSE_ERROR;
+	r->line_rc = http_parse_request_line(buf, len, &r->rl);
+	if (r->line_rc < 0)
+		return;
+	r->uri_rc = http_parse_uri(r->rl.uri.base, r->rl.uri.len, &r->u);
+	r->hdr_rc = http_parse_headers(buf + r->line_rc, len - r->line_rc,
+			r->hdrs, &r->nhdrs);
+}
+
+/*
+ * check_uri_cases - Compare http_parse_uri against uri_cases with
+ *                   both scanners. Returns the number of failures.
+ */
+static int check_uri_cases(void)
+{
+	struct http_uri u;
+	int i, simd, rc, fails = 0;
+	int have_simd = http_use_simd;
+
+	for (simd = 0; simd <= have_simd; simd++) {
+		http_use_simd = simd;
+		for (i = 0; i < sizeof(uri_cases) / sizeof(uri_cases[0]); i++) {
+			rc = http_parse_uri(uri_cases[i].uri, strlen(uri_cases[i].uri), &u);
+			if (rc != uri_cases[i].rc || (rc == 0 &&
+						(!token_is(&u.host, uri_cases[i].host) ||
+						 !token_is(&u.path, uri_cases[i].path) ||
+						 !token_is(&u.query, uri_cases[i].query) ||
+						 u.port != uri_cases[i].port))) {
+				printf("uri case \"%s\" (%s): unexpected result\n",
+						uri_cases[i].uri, simd ? "sse4.2" : "scalar");
+				fails++;
+			}
+		}
+	}
+	http_use_simd = have_simd;
+	return fails;
+}
+
+/*
+ * fuzz - Parse mutated seed inputs with both scanners and compare.
+ *        Returns the number of inputs where they disagree.
+ */
+static int fuzz(long cases, unsigned int seed)
+{
+	static const char special[] = " :/?#\r\n\t\x7f\0%[]";
+	struct parse_result *scalar = malloc(sizeof(struct parse_result));
+	struct parse_result *simd = malloc(sizeof(struct parse_result));
+	char work[1024];
+	char *input;
+	size_t len;
+	long i;
+	int j, nmut, pos, fails = 0;
+
+	srand(seed);
+	for (i = 0; i < cases; i++) {
+		const char *s = fuzz_seeds[rand() % (sizeof(fuzz_seeds) / sizeof(char *))];
+
+		len = strlen(s);
+		memcpy(work, s, len);
+		nmut = 1 + rand() % 4;
+		for (j = 0; j < nmut; j++) {
+			pos = len ? rand() % len : 0;
+			switch (rand() % 4) {
+			case 0:    /* overwrite with a delimiter */
+				work[pos] = special[rand() % (sizeof(special) - 1)];
+				break;
+			case 1:    /* overwrite with any byte */
+				work[pos] = rand() & 0xff;
+				break;
+			case 2:    /* truncate */
+				len = pos;
+				break;
+			case 3:    /* duplicate a run, stretching tokens past 16 bytes */
+				if (len + 40 < sizeof(work)) {
+					memmove(work + pos + 20, work + pos, len - pos);
+					memset(work + pos, work[pos] ? work[pos] : 'a', 20);
+					len += 20;
+				}
+				break;
+			}
+		}
+
+		/* Input ends exactly at the end of its allocation */
+		input = malloc(len ? len : 1);
+		memcpy(input, work, len);
+
+		memset(scalar, 0, sizeof(*scalar));
+		memset(simd, 0, sizeof(*simd));
+		http_use_simd = 0;
+		parse_all(input, len, scalar);
+		http_parse_init();
+		parse_all(input, len, simd);
+		if (memcmp(scalar, simd, sizeof(*scalar))) {
+			printf("fuzz case %ld: scanners disagree on \"%.*s\"\n",
+					i, (int)len, input);
+			fails++;
+		}
+		free(input);
+	}
+	free(scalar);
+	free(simd);
+	return fails;
+}
+
+/* token_is - Returns 1 if tok holds exactly the string s */
+static int token_is(const struct http_token *tok, const char *s)
+{
+	return tok->len == strlen(s) && !memcmp(tok->base, s, tok->len);
+}
+
+/* now - Wall clock time in seconds */
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
@@ -0,0 +1,279 @@
+/*
+ * prefetch.c - Streaming HTML link extractor and prefetch workers
+ *
+ * The scanner is fed the relayed bytes chunk by chunk, so it keeps
+ * the text of a partially received tag in its state. Prefetch
+ * requests go through a bounded producer-consumer queue (the sbuf
+ * package from the text); when the queue is full new links are
+ * dropped rather than blocking the relay. Workers stop fetching once
+ * PREFETCH_BYTES_PER_SEC has been spent in the current second.
+ */
+#define _GNU_SOURCE
+#include "prefetch.h"
+#include "cache.h"
+
+static char queue[PREFETCH_QUEUE][MAXLINE];
+static int front, rear;
+static sem_t mutex;          /* protects queue, front and rear */
+static sem_t slots;          /* free queue slots */
+static sem_t items;          /* queued URIs */
+
+static sem_t budget_mutex;   /* protects the two below */
+static time_t budget_window; /* second the budget applies to */
+static long budget_left;     /* bytes left to prefetch in that second */
+
+static void *prefetch_thread(void *vargp);
+static void prefetch_enqueue(const char *uri);
+static void scan_tag(link_scanner_t *sp);
+static int resolve_link(link_scanner_t *sp, char *link, char *out);
+static int budget_take(void);
+static void budget_charge(size_t n);
+
+/*
+ * prefetch_init - Create the queue and start the prefetch workers
+ */
+void prefetch_init(void)
+{
+	pthread_t tid;
+	int i;
+
+	front = rear = 0;
+	Sem_init(&mutex, 0, 1);
+	Sem_init(&slots, 0, PREFETCH_QUEUE);
+	Sem_init(&items, 0, 0);
+	Sem_init(&budget_mutex, 0, 1);
+	budget_window = 0;
+	budget_left = 0;
+
+	for (i = 0; i < PREFETCH_WORKERS; i++)
+		Pthread_create(&tid, NULL, prefetch_thread, NULL);
+}
+
+/*
+ * link_scanner_init - Prepare sp for scanning the page at uri.
+ *                     Returns 1 if uri is an http:// URI we can
+ *                     resolve links against, 0 otherwise.
+ */
+int link_scanner_init(link_scanner_t *sp, const char *uri)
+{
+	const char *path, *end;
+
+	sp->in_tag = 0;
+	sp->taglen = 0;
+	sp->nlinks = 0;
+	if (strncasecmp(uri, "http://", 7) || strlen(uri) >= MAXLINE - 1)
+		return 0;
+
+	/* Origin is everything up to the first '/' after the scheme */
+	if ((path = strchr(uri + 7, '/')) == NULL)
+		path = uri + strlen(uri);
+	memcpy(sp->origin, uri, path - uri);
+	sp->origin[path - uri] = '\0';
+
+	/* Base is the path up to its last '/', ignoring any query */
+	end = path + strcspn(path, "?#");
+	while (end > path && end[-1] != '/')
+		end--;
+	if (end == path) {
+		memcpy(sp->base, uri, path - uri);
+		strcpy(sp->base + (path - uri), "/");
+	} else {
+		memcpy(sp->base, uri, end - uri);
+		sp->base[end - uri] = '\0';
+	}
+	return 1;
+}
+
+/*
+ * link_scanner_feed - Scan the next n bytes of the page
+ */
+void link_scanner_feed(link_scanner_t *sp, const char *buf, size_t n)
+{
+	const char *p = buf, *end = buf + n;
+	char c;
+
+	while (p < end) {
+		if (!sp->in_tag) {
+			/* Skip text up to the next tag */
+			if ((p = memchr(p, '<', end - p)) == NULL)
+				return;
+			p++;
+			sp->in_tag = 1;
+			sp->taglen = 0;
+			continue;
+		}
+		c = *p++;
+		if (c == '>') {
+			sp->in_tag = 0;
+			if (sp->taglen > 0) {
+				sp->tag[sp->taglen] = '\0';
+				scan_tag(sp);
+			}
+		} else if (sp->taglen >= 0) {
+			if (sp->taglen < LINK_TAGMAX - 1)
+				sp->tag[sp->taglen++] = c;
+			else
+				sp->taglen = -1;
+		}
+	}
+}
+
+/*
+ * scan_tag - Queue the subresource named by a complete <img>,
+ *            <script> or <link> tag
+ */
+static void scan_tag(link_scanner_t *sp)
+{
+	char *tag = sp->tag, *attr, *p, *value;
+	char uri[MAXLINE];
+	char quote;
+
+	if (!strncasecmp(tag, "img", 3) && isspace((unsigned char)tag[3]))
+		attr = "src=";
+	else if (!strncasecmp(tag, "script", 6) && isspace((unsigned char)tag[6]))
+		attr = "src=";
+	else if (!strncasecmp(tag, "link", 4) && isspace((unsigned char)tag[4]))
+		attr = "href=";
+	else
+		return;
+
+	/* Find the attribute as a whole word */
+	for (p = tag; (p = strcasestr(p, attr)) != NULL; p++)
+		if (isspace((unsigned char)p[-1]))
+			break;
+	if (p == NULL)
+		return;
+	p += strlen(attr);
+
+	if (*p == '"' || *p == '\'') {
+		quote = *p++;
+		value = p;
+		if ((p = strchr(p, quote)) == NULL)
+			return;
+	} else {
+		value = p;
+		p += strcspn(p, " \t\r\n");
+	}
+	*p = '\0';
+
+	if (sp->nlinks < PREFETCH_PAGE_LINKS && resolve_link(sp, value, uri)) {
+		sp->nlinks++;
+		prefetch_enqueue(uri);
+	}
+}
+
+/*
+ * resolve_link - Turn link into an absolute URI in out. Returns 1 if
+ *                the result has the same origin as the page, else 0.
+ */
+static int resolve_link(link_scanner_t *sp, char *link, char *out)
+{
+	size_t olen = strlen(sp->origin);
+	size_t n;
+
+	link[strcspn(link, "#")] = '\0';
+	if (*link == '\0')
+		return 0;
+
+	if (!strncasecmp(link, "http://", 7)) {
+		n = snprintf(out, MAXLINE, "%s", link);
+	} else if (link[0] == '/' && link[1] == '/') {
+		n = snprintf(out, MAXLINE, "http:%s", link);
+	} else if (link[0] == '/') {
+		n = snprintf(out, MAXLINE, "%s%s", sp->origin, link);
+	} else if (link[strcspn(link, ":/?")] == ':') {
+		return 0;    /* some other scheme, e.g. https: or data: */
+	} else {
+		n = snprintf(out, MAXLINE, "%s%s", sp->base, link);
+	}
+	if (n >= MAXLINE)
+		return 0;
+
+	return !strncasecmp(out, sp->origin, olen) &&
+		(out[olen] == '/' || out[olen] == '\0');
+}
+
+/*
+ * prefetch_enqueue - Add uri to the queue, or drop it if the queue
+ *                    is full
+ */
+static void prefetch_enqueue(const char *uri)
+{
+	if (sem_trywait(&slots) < 0)
+		return;
+	P(&mutex);
+	strcpy(queue[rear], uri);
+	rear = (rear + 1) % PREFETCH_QUEUE;
+	V(&mutex);
+	V(&items);
+}
+
+/*
+ * prefetch_thread - Fetch queued URIs from their origin into the cache
+ */
+static void *prefetch_thread(void *vargp)
+{
+	char uri[MAXLINE];
+	char *object = Malloc(MAX_OBJECT_SIZE);
+	size_t total;
+	ssize_t n = 0;
+	int fd;
+	rio_t rio;
+
+	Pthread_detach(pthread_self());
+	while (1) {
+		P(&items);
+		P(&mutex);
+		strcpy(uri, queue[front]);
+		front = (front + 1) % PREFETCH_QUEUE;
+		V(&mutex);
+		V(&slots);
+
+		if (cache_contains(uri) || !budget_take())
+			continue;
+		if ((fd = connect_origin(uri)) < 0)
+			continue;
+
+		/* Objects that fill the whole buffer are too big to cache */
+		rio_readinitb(&rio, fd);
+		total = 0;
+		while (total < MAX_OBJECT_SIZE &&
+				(n = rio_readnb(&rio, object + total,
+						MAX_OBJECT_SIZE - total)) > 0)
+			total += n;
+		Close(fd);
+
+		budget_charge(total);
+		if (n >= 0 && total < MAX_OBJECT_SIZE)
+			cache_put(uri, object, total);
+	}
+	return NULL;
+}
+
+/*
+ * budget_take - Returns 1 if prefetch budget is left this second
+ */
+static int budget_take(void)
+{
+	time_t now = time(NULL);
+	int ok;
+
+	P(&budget_mutex);
+	if (now != budget_window) {
+		budget_window = now;
+		budget_left = PREFETCH_BYTES_PER_SEC;
+	}
+	ok = budget_left > 0;
+	V(&budget_mutex);
+	return ok;
+}
+
+/*
+ * budget_charge - Account n prefetched bytes against the budget
+ */
+static void budget_charge(size_t n)
+{
+	P(&budget_mutex);
+	budget_left -= n;
+	V(&budget_mutex);
+}
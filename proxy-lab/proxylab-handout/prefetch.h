@@ -0,0 +1,37 @@
+/*
+ * prefetch.h - Background prefetching of objects linked from HTML
+ *
+ * While the proxy relays an HTML page it feeds the bytes through a
+ * link_scanner_t, which picks the src/href of <img>, <script> and
+ * <link> tags out of the stream. Same-origin links are queued for a
+ * small pool of prefetch threads that pull them into the cache before
+ * the browser asks for them.
+ */
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include "csapp.h"
+
+#define PREFETCH_WORKERS 4            /* concurrent prefetches */
+#define PREFETCH_QUEUE 64             /* pending prefetches; extra are dropped */
+#define PREFETCH_PAGE_LINKS 32        /* links queued per page at most */
+#define PREFETCH_BYTES_PER_SEC 4194304 /* prefetch bandwidth budget */
+#define LINK_TAGMAX 1024              /* longer tags are skipped */
+
+typedef struct {
+	char origin[MAXLINE];     /* "http://host[:port]" of the page */
+	char base[MAXLINE];       /* page URI up to and including the last '/' */
+	char tag[LINK_TAGMAX];    /* text of the tag being scanned */
+	int taglen;               /* bytes in tag, -1 if the tag overflowed */
+	int in_tag;               /* between '<' and '>' */
+	int nlinks;               /* links queued for this page */
+} link_scanner_t;
+
+void prefetch_init(void);
+int link_scanner_init(link_scanner_t *sp, const char *uri);
+void link_scanner_feed(link_scanner_t *sp, const char *buf, size_t n);
+
+/* Provided by proxy.c */
+int connect_origin(char *uri);
+
+#endif /* __PREFETCH_H__ */
@@ -1,9 +1,16 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include "csapp.h"
+#include "cache.h"
+#include "prefetch.h"
+#include "handover.h"
+#include "httpparse.h"
+#include "relay.h"
 #include <string.h>
+#include <sched.h>
+#include <poll.h>
 
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
+#define STATS_INTERVAL 5   /* seconds between per-core throughput reports */
 
 #define DEBUG
 #ifdef DEBUG
@@ -22,216 +29,543 @@ static const char *get = "GET";
 static const char *http = "HTTP/1.0";
 static const char *host = "Host:";
 
-
-void read_requesthdrs(rio_t *rp);
-void forward_request(int fd);
-int parse_uri(char *uri, char *filename, char *cgiargs);
+/*
+ * Per-core worker state for the shared-nothing mode. Each worker owns
+ * its listener, its relay scheduler and its counters; the struct is
+ * cache-line aligned so that counter updates on one core never
+ * invalidate another core's line.
+ */
+struct core_t {
+	int id;                     /* worker index, also the CPU it is pinned to */
+	int listenfd;               /* this core's SO_REUSEPORT listener */
+	pthread_t tid;
+	unsigned long requests;     /* requests served, written by owner only */
+	relay_sched_t sched;        /* responses in flight; counts bytes sent */
+} __attribute__((aligned(64)));
+
+int prefetching = 0;    /* prefetch subresources of relayed HTML (-p) */
+
+/* Hot restart state */
+int pause_pipe[2];      /* readable while a successor is taking over */
+int resume_pipe[2];     /* readable once a takeover has failed */
+int drain_pipe[2];      /* becomes readable once a successor takes over */
+sem_t accept_stopped;   /* posted by each accept loop as it pauses,
+                           and again as it resumes */
+
+struct handover_t {     /* arguments of the handover thread */
+	int ctlfd;          /* control socket successors connect to */
+	int *listenfds;     /* our listening sockets */
+	int nlisteners;
+	int nloops;         /* accept loops that must stop first */
+};
+
+
+int parse_uri(char *uri, char *hostname, int *port, char *path);
+void token_copy(char *dst, const struct http_token *tok);
 void serve_static(int fd, char *filename, int filesize);
 void get_filetype(char *filename, char *filetype);
 void serve_dynamic(int fd, char *filename, char *cgiargs);
-void clienterror(int fd, char *cause, char *errnum, 
-		char *shortmsg, char *longmsg);
+void clienterror(relay_sched_t *rs, relay_stream_t *sp, char *cause,
+		char *errnum, char *shortmsg, char *longmsg);
+int open_reuseport_listenfd(int port);
+int connect_origin(char *uri);
+int open_origin(const char *hostname, int port);
+int next_connection(int listenfd, relay_sched_t *rs);
+void *core_thread(void *vargp);
+void *handover_thread(void *vargp);
+void report_core_stats(struct core_t *cores, int ncores);
+void usage(char *prog);
 
 
 
 int main(int argc,char **argv)
 {
 
-	int listenfd, connfd, port, clientlen;
-	struct sockaddr_in clientaddr;
+	int connfd, port;
+	int i, c, ncores = 0;
+	int listenfds[HANDOVER_MAXFDS], nlisteners;
+	int takeover = 0, want_cache = 0;
+	char *ctlpath = NULL;
+	struct core_t *cores;
+	struct handover_t handover;
+	pthread_t handover_tid;
+	relay_sched_t sched;
 
 	/* Check command line args */
-	if (argc != 2) {
-		fprintf(stderr, "usage: %s <port>\n", argv[0]);
-		exit(1);
+	while ((c = getopt(argc, argv, "n:ps:rc")) != -1) {
+		switch (c) {
+		case 'p':             /* prefetch links found in HTML */
+			prefetching = 1;
+			break;
+		case 'n':             /* shared-nothing mode with n cores */
+			ncores = atoi(optarg);
+			if (ncores < 1 || ncores > HANDOVER_MAXFDS)
+				usage(argv[0]);
+			break;
+		case 's':             /* control socket for hot restarts */
+			ctlpath = optarg;
+			break;
+		case 'r':             /* take over from the proxy on the socket */
+			takeover = 1;
+			break;
+		case 'c':             /* ... and copy its cache */
+			want_cache = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || (takeover && ctlpath == NULL))
+		usage(argv[0]);
+	port = atoi(argv[optind]);
+
+	http_parse_init();
+	cache_init(ncores > 0 ? ncores : 1);
+
+	/* Get listening sockets, from our predecessor if restarting */
+	if (takeover) {
+		nlisteners = handover_takeover(ctlpath, listenfds,
+				HANDOVER_MAXFDS, want_cache);
+		if (nlisteners < 1)
+			unix_error("handover_takeover error");
+		if (nlisteners > 1 || ncores > 0)
+			ncores = nlisteners;
+	} else if (ncores > 0) {
+		/* Shared-nothing mode: one listener per core */
+		for (i = 0; i < ncores; i++)
+			if ((listenfds[i] = open_reuseport_listenfd(port)) < 0)
+				unix_error("open_reuseport_listenfd error");
+		nlisteners = ncores;
+	} else {
+		listenfds[0] = Open_listenfd(port);
+		nlisteners = 1;
 	}
-	port = atoi(argv[1]);
 
-	listenfd = Open_listenfd(port);
-	while (1) {
+	if (pipe(pause_pipe) < 0 || pipe(resume_pipe) < 0 || pipe(drain_pipe) < 0)
+		unix_error("pipe error");
+	Sem_init(&accept_stopped, 0, 0);
+	if (ctlpath) {
+		if ((handover.ctlfd = handover_listen(ctlpath)) < 0)
+			unix_error("handover_listen error");
+		handover.listenfds = listenfds;
+		handover.nlisteners = nlisteners;
+		handover.nloops = ncores > 0 ? ncores : 1;
+		Pthread_create(&handover_tid, NULL, handover_thread, &handover);
+	}
+
+	if (prefetching)
+		prefetch_init();
+
+	if (ncores > 0) {
+		/* One pinned worker per core, each on its own listener */
+		cores = Calloc(ncores, sizeof(struct core_t));
+		for (i = 0; i < ncores; i++) {
+			cores[i].id = i;
+			cores[i].listenfd = listenfds[i];
+			Pthread_create(&cores[i].tid, NULL, core_thread, &cores[i]);
+		}
+		report_core_stats(cores, ncores);
+		for (i = 0; i < ncores; i++)
+			Pthread_join(cores[i].tid, NULL);
+	} else {
 		dbg_printf("Boy thats a connection!\n");
-		clientlen = sizeof(clientaddr);
-		connfd = Accept(listenfd, (SA *)&clientaddr, (SL *)&clientlen);
-		dbg_printf("Accepted it!\n");
-		forward_request(connfd);
-		Close(connfd);
+		relay_init(&sched, prefetching);
+		while ((connfd = next_connection(listenfds[0], &sched)) >= 0) {
+			dbg_printf("Accepted it!\n");
+			relay_accept(&sched, connfd);
+		}
 	}
 
+	/* Only reached once a successor has taken over and we drained */
+	if (ctlpath)
+		Pthread_join(handover_tid, NULL);
 	return 0;
 }
 
+/*
+ * next_connection - Relay the responses in flight on rs until a new
+ *                   client arrives on listenfd, and accept it. While
+ *                   a successor is taking over, keeps relaying but
+ *                   stops accepting; once it has the listeners,
+ *                   finishes the responses in flight and returns -1
+ *                   instead. If the takeover fails, goes on accepting.
+ */
+int next_connection(int listenfd, relay_sched_t *rs)
+{
+	struct pollfd fds[2];
+	struct sockaddr_in clientaddr;
+	socklen_t clientlen = sizeof(clientaddr);
+	int paused = 0;
+
+	while (1) {
+		fds[0].fd = paused ? drain_pipe[0] : pause_pipe[0];
+		fds[0].events = POLLIN;
+		fds[1].fd = paused ? resume_pipe[0] : listenfd;
+		fds[1].events = POLLIN;
+		if (relay_wait(rs, fds, 2) < 0) {
+			if (errno == EINTR)
+				continue;
+			unix_error("poll error");
+		}
+		if (paused && fds[0].revents) {
+			relay_drain(rs);
+			return -1;
+		}
+		if (fds[0].revents || (paused && fds[1].revents)) {
+			paused = !paused;
+			V(&accept_stopped);
+		} else if (fds[1].revents) {
+			return Accept(listenfd, (SA *)&clientaddr, &clientlen);
+		}
+	}
+}
+
+/*
+ * handover_thread - Wait for a successor on the control socket, stop
+ *     accepting, and pass it our listening sockets and optionally our
+ *     cache. The accept loops must be out of accept() before the
+ *     sockets leave, or a loop could block forever on a connection
+ *     the successor took. If they cannot be passed, the loops go back
+ *     to accepting and we wait for another successor, so the port is
+ *     never left without a process.
+ */
+void *handover_thread(void *vargp)
+{
+	struct handover_t *hp = (struct handover_t *)vargp;
+	int connfd, want_cache, i;
+	char c;
+
+	while (1) {
+		if ((connfd = handover_accept(hp->ctlfd, &want_cache)) < 0)
+			unix_error("handover_accept error");
+
+		Rio_writen(pause_pipe[1], "p", 1);
+		for (i = 0; i < hp->nloops; i++)
+			P(&accept_stopped);
+
+		if (handover_send_fds(connfd, hp->listenfds, hp->nlisteners) == 0)
+			break;
+		fprintf(stderr, "handover: could not pass listening sockets: %s\n",
+				strerror(errno));
+		Close(connfd);
+
+		/* Withdraw the pause before the loops can see it again */
+		Rio_readn(pause_pipe[0], &c, 1);
+		Rio_writen(resume_pipe[1], "r", 1);
+		for (i = 0; i < hp->nloops; i++)
+			P(&accept_stopped);
+		Rio_readn(resume_pipe[0], &c, 1);
+	}
+
+	/* The successor has the listeners; ours can go */
+	Rio_writen(drain_pipe[1], "d", 1);
+	if (want_cache && cache_dump(connfd) < 0)
+		fprintf(stderr, "handover: cache transfer failed\n");
+	for (i = 0; i < hp->nlisteners; i++)
+		Close(hp->listenfds[i]);
+	Close(connfd);
+	Close(hp->ctlfd);
+	return NULL;
+}
+
+/*
+ * core_thread - Event loop of one shared-nothing worker. Pins itself
+ *               to its CPU and serves connections from its own
+ *               listener; the kernel spreads new connections across
+ *               the SO_REUSEPORT group.
+ */
+void *core_thread(void *vargp)
+{
+	struct core_t *core = (struct core_t *)vargp;
+	cpu_set_t cpus;
+	int connfd;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	CPU_ZERO(&cpus);
+	CPU_SET(core->id % (ncpus > 0 ? ncpus : 1), &cpus);
+	if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+		fprintf(stderr, "core %d: sched_setaffinity: %s\n",
+				core->id, strerror(errno));
+
+	relay_init(&core->sched, prefetching);
+	while ((connfd = next_connection(core->listenfd, &core->sched)) >= 0) {
+		relay_accept(&core->sched, connfd);
+		core->requests++;
+	}
+	return NULL;
+}
+
+/*
+ * report_core_stats - Print per-core and total throughput every
+ *                     STATS_INTERVAL seconds until we start draining.
+ */
+void report_core_stats(struct core_t *cores, int ncores)
+{
+	unsigned long *last_req = Calloc(ncores, sizeof(unsigned long));
+	unsigned long *last_bytes = Calloc(ncores, sizeof(unsigned long));
+	unsigned long req, bytes, total_req, total_bytes;
+	struct pollfd drain = { drain_pipe[0], POLLIN, 0 };
+	int i, rc;
+
+	while (1) {
+		if ((rc = poll(&drain, 1, STATS_INTERVAL * 1000)) > 0)
+			break;
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			unix_error("poll error");
+		}
+		total_req = total_bytes = 0;
+		for (i = 0; i < ncores; i++) {
+			req = cores[i].requests;
+			bytes = cores[i].sched.bytes;
+			printf("core %2d: %8.1f req/s %10.1f KB/s\n", i,
+					(double)(req - last_req[i]) / STATS_INTERVAL,
+					(double)(bytes - last_bytes[i]) / 1024 / STATS_INTERVAL);
+			total_req += req - last_req[i];
+			total_bytes += bytes - last_bytes[i];
+			last_req[i] = req;
+			last_bytes[i] = bytes;
+		}
+		printf("total  : %8.1f req/s %10.1f KB/s\n",
+				(double)total_req / STATS_INTERVAL,
+				(double)total_bytes / 1024 / STATS_INTERVAL);
+		fflush(stdout);
+	}
+	Free(last_req);
+	Free(last_bytes);
+}
+
+/*
+ * open_reuseport_listenfd - Like open_listenfd, but joins the port's
+ *     SO_REUSEPORT group so that every core can bind its own listener.
+ *     Returns -1 and sets errno on Unix error.
+ */
+int open_reuseport_listenfd(int port)
+{
+	int listenfd, optval = 1;
+	struct sockaddr_in serveraddr;
+
+	if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,
+				(const void *)&optval, sizeof(int)) < 0)
+		return -1;
+	if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+				(const void *)&optval, sizeof(int)) < 0)
+		return -1;
+
+	bzero((char *) &serveraddr, sizeof(serveraddr));
+	serveraddr.sin_family = AF_INET;
+	serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	serveraddr.sin_port = htons((unsigned short)port);
+	if (bind(listenfd, (SA *)&serveraddr, sizeof(serveraddr)) < 0)
+		return -1;
+	if (listen(listenfd, LISTENQ) < 0)
+		return -1;
+	return listenfd;
+}
+
+/*
+ * usage - Print the command line syntax and exit
+ */
+void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [-p] [-n <cores>] [-s <ctlsock> [-r [-c]]] <port>\n", prog);
+	fprintf(stderr, "   -p          prefetch same-origin images, scripts and\n");
+	fprintf(stderr, "               stylesheets linked from relayed HTML\n");
+	fprintf(stderr, "   -s <path>   accept hot-restart requests on this UNIX socket\n");
+	fprintf(stderr, "   -r          take over the listening sockets of the proxy\n");
+	fprintf(stderr, "               serving <path> instead of binding <port>\n");
+	fprintf(stderr, "   -c          with -r, also copy that proxy's cache\n");
+	fprintf(stderr, "   -n <cores>  shared-nothing mode: one pinned worker,\n");
+	fprintf(stderr, "               listener and cache shard per core\n");
+	exit(1);
+}
+
 /*
  * forward_request - Forwards all GET requests to the intended
- *                   server.
+ *                   server, or answers them from the cache. Called
+ *                   by the relay scheduler with the len bytes of
+ *                   sp's request once they are in; the response is
+ *                   then relayed to the client by rs.
  */
 /* $begin doit */
-void forward_request(int fd) 
+void forward_request(relay_sched_t *rs, relay_stream_t *sp,
+		char *request, size_t len)
 {
-	int is_correct;
-	int clientfd;
-	char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-	char filename[MAXLINE], request[MAXLINE];
-	char hostname[MAXLINE];
-	rio_t rio;
-
-	/* Read request line and headers */
-	Rio_readinitb(&rio, fd);
-	Rio_readlineb(&rio, buf, MAXLINE);
-	sscanf(buf, "%s %s %s", method, uri, version);
+	char method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+	char *object, *nl;
+	size_t object_size;
+	ssize_t n;
+	struct http_request_line rl;
+
+	/* Parse the request line; the headers are only shown */
+	n = (nl = memchr(request, '\n', len)) ? nl + 1 - request : len;
+	dbg_printf("%.*s", (int)(len - n), request + n);
+	if ((n = http_parse_request_line(request, n, &rl)) < 0) {
+		if (n == HTTP_PARSE_ERROR)
+			clienterror(rs, sp, "request line", "400", "Bad Request",
+					"Proxy could not parse the");
+		else
+			relay_abort(rs, sp);
+		return;
+	}
+	token_copy(method, &rl.method);
+	token_copy(uri, &rl.uri);
+	token_copy(version, &rl.version);
 	if (strcasecmp(method, "GET")) { 
-		clienterror(fd, method, "501", "Not Implemented",
+		clienterror(rs, sp, method, "501", "Not Implemented",
 				"Tiny does not implement this method");
 		return;
 	}
-	read_requesthdrs(&rio);
 
-	/* Parse URI from GET request */
-	is_correct = parse_uri(uri,filename,hostname);
-	if (is_correct < 0) {
+	/* Serve straight from the cache on a hit */
+	object = Malloc(MAX_OBJECT_SIZE);
+	if (cache_get(uri, object, &object_size)) {
+		dbg_printf("Cache hit: %s\n", uri);
+		relay_respond(rs, sp, object, object_size);
 		return;
 	}
 
-	/* Once request is parsed we forward 
-	 * it to the parsed hostname */ 
-	if ((clientfd = open_clientfd(hostname, HTTP_PORT)) < 0 ) {
-		return; 
-	}
+	/* A connector thread sends the request on to the 
+	 * origin, after which the response is sent back to 
+	 * the client, and kept for the cache while it still 
+	 * fits, by the relay scheduler alongside the other 
+	 * responses in flight. HTML bodies are also fed to 
+	 * the link scanner for prefetching. */
+	relay_connect(rs, sp, uri, object);
+}
+/*
+ * connect_origin - Open a connection to the origin server named in
+ *                  uri and send it the GET request for the object.
+ *                  Returns the connected descriptor, or -1 on error.
+ *                  Blocks, so it is only called from the connector
+ *                  and prefetch threads, several at a time.
+ */
+int connect_origin(char *uri)
+{
+	int clientfd, port;
+	char path[MAXLINE], request[MAXLINE];
+	char hostname[MAXLINE];
 
-	printf("bing\n");
+	/* Parse URI from GET request */
+	if (parse_uri(uri, hostname, &port, path) < 0)
+		return -1;
+
+	if ((clientfd = open_origin(hostname, port)) < 0)
+		return -1;
 
-	Rio_readinitb(&rio,clientfd);
 	dbg_printf("This is the URI: %s\n", uri);
-	sprintf(request,"%s %s %s\r\n",get, uri,http);
+	if (snprintf(request, MAXLINE, "%s %s %s\r\n%s %s\r\n%s%s%s%s%s\r\n",
+				get, path, http, host, hostname, user_agent,
+				accept_string, accept_encoding, connection,
+				proxy_connection) >= MAXLINE) {
+		Close(clientfd);
+		return -1;
+	}
 	dbg_printf("This is the request: %s\n", request);
-	Rio_writen(clientfd,(void *)request,strlen(request));
-	sprintf(request,"%s %s\r\n",host,hostname);
-	Rio_writen(clientfd,(void *)request,strlen(request));
-	Rio_writen(clientfd,(void *)user_agent,strlen(user_agent));
-	Rio_writen(clientfd,(void *)accept_string,strlen(accept_string));
-	Rio_writen(clientfd,(void *)accept_encoding,strlen(accept_encoding));
-	Rio_writen(clientfd,(void *)connection,strlen(connection));
-	Rio_writen(clientfd,(void *)proxy_connection,strlen(proxy_connection));
-	Rio_writen(clientfd,"\r\n\r\n",4);
-
-	/* Receive response from server and forward it
-	 * back to client. Once done close 'clientfd'  */
-
-	/* <ANSHUMAN IMPLEMENT THIS>*/
-
-	size_t n2;
-	char buf2[MAXLINE];
-	rio_t rio2;
-
-	dbg_printf("Server response starts here:\n");
-	Rio_readinitb(&rio2, clientfd);
-	while((n2 = Rio_readlineb(&rio2, buf2, MAXLINE)) != 0 ) {
-		dbg_printf("%s\n", buf2);
-		Rio_writen(fd, buf2, n2);
+	if (rio_writen(clientfd, request, strlen(request)) < 0) {
+		Close(clientfd);
+		return -1;
+	}
+	return clientfd;
+}
+
+/*
+ * open_origin - Like open_clientfd, but with getaddrinfo, so that
+ *               threads can look up names at the same time. Tries
+ *               each address in turn. Returns -1 on error.
+ */
+int open_origin(const char *hostname, int port)
+{
+	struct addrinfo hints, *list, *ai;
+	char service[16];
+	int fd = -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+	snprintf(service, sizeof(service), "%d", port);
+	if (getaddrinfo(hostname, service, &hints, &list) != 0)
+		return -1;
+	for (ai = list; ai != NULL; ai = ai->ai_next) {
+		if ((fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+						ai->ai_protocol)) < 0)
+			continue;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		Close(fd);
+		fd = -1;
 	}
-	Close(clientfd);
-	dbg_printf("It is closing the conn!\n");
+	freeaddrinfo(list);
+	return fd;
 }
+
 /*
- * parse_uri - parse URI to retrieve hostname
+ * parse_uri - parse URI to retrieve hostname, port and path
  *
- * Example : http://www.google.com/index.html should return
- *           /index.html in filename
- *           www.google.com in hostname.
+ * Example : http://www.google.com:8080/index.html?q=1 should return
+ *           www.google.com in hostname, 8080 in port and
+ *           /index.html?q=1 in path. A URI without a path
+ *           (http://www.google.com) gets "/" as its path.
  *
  * Returns 1 if format OK , -1 if inscrutable format
  */
 /* $begin parse_uri */
-int parse_uri(char *uri, char *filename, char *hostname) 
+int parse_uri(char *uri, char *hostname, int *port, char *path) 
 {
+	struct http_uri u;
 
-
-	char *start_ptr;
-	char *end_ptr;
-	int name_len;
-	int flag = 1;
-
-	/* Looks for first '/' from starting of uri */
-	if ((start_ptr = strchr(uri,'/')) == NULL) {
+	if (http_parse_uri(uri, strlen(uri), &u) < 0 || u.host.len == 0)
 		return -1;
-	}
 
-	/* Move ptr by 2 bytes to point to starting of
-	 * hostname */
-	start_ptr = start_ptr + 2;
-
-	/* This snippet looks for end of host name.
-	 * Since, hostname can be followd by a :port.
-	 * we need to first search for that. If unavailable
-	 * we need to search for the last '/' in hostname
-	 * and point end_ptr to one byte before it */
-	if ((end_ptr = strchr(start_ptr,':')) == NULL) {
-
-		/* flag = 0 is used to handle clause when
-		 * default file is given e.g. http://www.google.com/
-		 * we want file as "/" */
-		if ((end_ptr = strchr(start_ptr,'/')) == NULL) {
-			flag = 0;
-			strcpy(filename,end_ptr);
-		}
+	token_copy(hostname, &u.host);
+	*port = u.port;
 
-	}
-	end_ptr --;
-
-	/* Copy final name into hostname */
-	name_len = (end_ptr - start_ptr) + 1;
-	strncpy(hostname,start_ptr,name_len);
-	hostname[name_len] = '\0';
-
-	/* Copy file name into filename */
-	if (flag) {
-		end_ptr ++;
-		strcpy(filename,end_ptr);
+	/* The query goes to the origin along with the path */
+	token_copy(path, &u.path);
+	if (u.query.len > 0) {
+		path[u.path.len] = '?';
+		memcpy(path + u.path.len + 1, u.query.base, u.query.len);
+		path[u.path.len + 1 + u.query.len] = '\0';
 	}
 	return 1;
-
 }
 
 /*
- * read_requesthdrs - read and parse HTTP request headers
+ * token_copy - Copy a parsed token into a NUL-terminated buffer. The
+ *              token always comes from a buffer no longer than dst.
  */
-/* $begin read_requesthdrs */
-void read_requesthdrs(rio_t *rp) 
+void token_copy(char *dst, const struct http_token *tok)
 {
-	char buf[MAXLINE];
-
-	Rio_readlineb(rp, buf, MAXLINE);
-	printf("%s", buf);
-	while(strcmp(buf, "\r\n")) {
-		Rio_readlineb(rp, buf, MAXLINE);
-		printf("%s", buf);
-	}
-	return;
+	memcpy(dst, tok->base, tok->len);
+	dst[tok->len] = '\0';
 }
 
 /*
- * clienterror - returns an error message to the client
+ * clienterror - returns an error message to the client, through the
+ *               relay scheduler like any other response
  */
 /* $begin clienterror */
-void clienterror(int fd, char *cause, char *errnum, 
-		char *shortmsg, char *longmsg) 
+void clienterror(relay_sched_t *rs, relay_stream_t *sp, char *cause,
+		char *errnum, char *shortmsg, char *longmsg) 
 {
-	char buf[MAXLINE], body[MAXBUF];
+	char body[MAXBUF], *buf = Malloc(MAXLINE + MAXBUF);
+	int n;
 
 	/* Build the HTTP response body */
-	sprintf(body, "<html><title>Tiny Error</title>");
-	sprintf(body, "%s<body bgcolor=""ffffff"">\r\n", body);
-	sprintf(body, "%s%s: %s\r\n", body, errnum, shortmsg);
-	sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
-	sprintf(body, "%s<hr><em>The Tiny Web server</em>\r\n", body);
-
-	/* Print the HTTP response */
-	sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-	Rio_writen(fd, buf, strlen(buf));
-	sprintf(buf, "Content-type: text/html\r\n");
-	Rio_writen(fd, buf, strlen(buf));
-	sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-	Rio_writen(fd, buf, strlen(buf));
-	Rio_writen(fd, body, strlen(body));
+	n = snprintf(body, MAXBUF, "<html><title>Tiny Error</title>"
+			"<body bgcolor=""ffffff"">\r\n%s: %s\r\n<p>%s: %.*s\r\n"
+			"<hr><em>The Tiny Web server</em>\r\n", errnum, shortmsg,
+			longmsg, MAXBUF / 2, cause);
+
+	/* Headers and body make up the response */
+	n = snprintf(buf, MAXLINE + MAXBUF, "HTTP/1.0 %s %s\r\n"
+			"Content-type: text/html\r\nContent-length: %d\r\n\r\n%s",
+			errnum, shortmsg, n, body);
+	relay_respond(rs, sp, buf, n);
 }
 
 
@@ -0,0 +1,511 @@
+/*
+ * relay.c - Deficit round robin relay of responses to clients
+ *
+ * Client and origin sockets are non-blocking. A stream holds at most
+ * one chunk read from its origin; it only reads the next chunk once
+ * the client has taken the last one, so a slow client throttles its
+ * own origin instead of filling proxy memory. In each round a ready
+ * stream's deficit grows by RELAY_QUANTUM and it may write that many
+ * bytes. A stream that runs out of data to send loses its leftover
+ * deficit, as in classic DRR; one blocked on its client keeps up to a
+ * quantum of it for the next round.
+ *
+ * A stream starts out reading its client's request, and may then wait
+ * for a connector before it relays anything. Connect jobs go through
+ * an unbounded queue, as the loop must never wait for a free slot;
+ * each of the scheduler's connectors blocks in connect_origin() and
+ * writes the stream and the new descriptor to its notify pipe. A loop
+ * whose connectors are all stuck on dead origins can still relay and
+ * serve cache hits, but other misses wait for a connector.
+ */
+#include "relay.h"
+#include "cache.h"
+#include "prefetch.h"
+#include "httpparse.h"
+
+#define MAXHDRS 64                  /* response headers we look at */
+
+enum { READING, CONNECTING, RELAYING };
+
+struct relay_stream {
+	int state;                  /* READING, CONNECTING or RELAYING */
+	char *req;                  /* request bytes read, while READING */
+	size_t nreq;
+	int clientfd;
+	int originfd;               /* -1 when serving a cached object */
+	char *uri;                  /* cache key, NULL for a cache hit */
+	char *object;               /* copy of the response for the cache */
+	size_t total;               /* response bytes received so far */
+	size_t sent;                /* response bytes written to the client */
+	size_t expected;            /* full response size, 0 if unknown */
+	char *pend;                 /* received bytes not yet written */
+	size_t npend;
+	size_t deficit;             /* bytes it may still send this round */
+	int eof;                    /* nothing more will be received */
+	int failed;                 /* either side reported an error */
+	int pfd;                    /* its entry in the poll set, or -1 */
+	link_scanner_t *scanner;    /* for HTML when prefetching */
+	char buf[MAXLINE];          /* last chunk read from the origin */
+	struct relay_stream *next;
+};
+
+struct connect_job {             /* a stream waiting for its origin */
+	relay_stream_t *sp;
+	struct connect_job *next;
+};
+
+struct connect_msg {             /* a connector's answer, on rs->notify */
+	relay_stream_t *sp;
+	int fd;                      /* -1 if the connect failed */
+};
+
+static void *connector_thread(void *vargp);
+static void connected(relay_sched_t *rs);
+static void read_request(relay_sched_t *rs, relay_stream_t *sp);
+static relay_stream_t *new_stream(relay_sched_t *rs, int clientfd);
+static void pump(relay_sched_t *rs, relay_stream_t *sp);
+static void received(relay_sched_t *rs, relay_stream_t *sp, size_t n);
+static void inspect_headers(relay_sched_t *rs, relay_stream_t *sp,
+		const char *buf, size_t n);
+static void finish(relay_stream_t *sp);
+static int by_remaining(const void *a, const void *b);
+static size_t remaining(const relay_stream_t *sp);
+static void set_nonblocking(int fd);
+
+/*
+ * relay_init - Start with no streams in flight, and start the
+ *              scheduler's connector threads
+ */
+void relay_init(relay_sched_t *rs, int prefetch)
+{
+	pthread_t tid;
+	int i;
+
+	rs->streams = NULL;
+	rs->nstreams = 0;
+	rs->prefetch = prefetch;
+	rs->maxfds = 16;
+	rs->fds = Malloc(rs->maxfds * sizeof(struct pollfd));
+	rs->order = Malloc(rs->maxfds * sizeof(relay_stream_t *));
+	rs->bytes = 0;
+	if (pipe(rs->notify) < 0)
+		unix_error("pipe error");
+	set_nonblocking(rs->notify[0]);
+
+	rs->jobs = NULL;
+	rs->jobs_tail = &rs->jobs;
+	Sem_init(&rs->jobs_mutex, 0, 1);
+	Sem_init(&rs->jobs_items, 0, 0);
+	for (i = 0; i < RELAY_CONNECTORS; i++)
+		Pthread_create(&tid, NULL, connector_thread, rs);
+}
+
+/*
+ * relay_accept - Serve the new connection clientfd, starting with its
+ *                request, which goes to forward_request() once the
+ *                header block (or RELAY_MAXREQUEST bytes of it) is in
+ */
+void relay_accept(relay_sched_t *rs, int clientfd)
+{
+	relay_stream_t *sp = new_stream(rs, clientfd);
+
+	sp->req = Malloc(RELAY_MAXREQUEST);
+}
+
+/*
+ * relay_connect - Have a connector send sp's request for uri to its
+ *                 origin, then relay the response to the client.
+ *                 Takes over object, a MAX_OBJECT_SIZE buffer in which
+ *                 the response is collected for the cache under uri.
+ */
+void relay_connect(relay_sched_t *rs, relay_stream_t *sp,
+		const char *uri, char *object)
+{
+	struct connect_job *job = Malloc(sizeof(struct connect_job));
+
+	sp->state = CONNECTING;
+	sp->uri = Malloc(strlen(uri) + 1);
+	strcpy(sp->uri, uri);
+	sp->object = object;
+
+	job->sp = sp;
+	job->next = NULL;
+	P(&rs->jobs_mutex);
+	*rs->jobs_tail = job;
+	rs->jobs_tail = &job->next;
+	V(&rs->jobs_mutex);
+	V(&rs->jobs_items);
+}
+
+/*
+ * relay_respond - Send sp's client the size bytes at object, a cached
+ *                 object or an error page, and close. Takes over object.
+ */
+void relay_respond(relay_sched_t *rs, relay_stream_t *sp,
+		char *object, size_t size)
+{
+	sp->state = RELAYING;
+	sp->object = object;
+	sp->total = sp->expected = sp->npend = size;
+	sp->pend = object;
+	sp->eof = 1;
+}
+
+/*
+ * relay_abort - Close sp's client without a response
+ */
+void relay_abort(relay_sched_t *rs, relay_stream_t *sp)
+{
+	sp->failed = 1;
+}
+
+/*
+ * relay_wait - Poll the nextra caller descriptors in extra together
+ *     with every stream, then run one round over the ready streams.
+ *     The revents of extra are filled in as by poll(). Returns the
+ *     result of poll(); streams are only serviced if it succeeded.
+ */
+int relay_wait(relay_sched_t *rs, struct pollfd *extra, int nextra)
+{
+	relay_stream_t *sp, **pp;
+	int i, n, nready, rc;
+
+	if (nextra + 1 + rs->nstreams > rs->maxfds) {
+		while (nextra + 1 + rs->nstreams > rs->maxfds)
+			rs->maxfds *= 2;
+		rs->fds = Realloc(rs->fds, rs->maxfds * sizeof(struct pollfd));
+		rs->order = Realloc(rs->order,
+				rs->maxfds * sizeof(relay_stream_t *));
+	}
+
+	/* Wait for the client if we hold data for it or its request is
+	 * still coming, else the origin, once a connector has found it */
+	if (nextra > 0)
+		memcpy(rs->fds, extra, nextra * sizeof(struct pollfd));
+	rs->fds[nextra].fd = rs->notify[0];
+	rs->fds[nextra].events = POLLIN;
+	rs->fds[nextra].revents = 0;
+	n = nextra + 1;
+	for (sp = rs->streams; sp != NULL; sp = sp->next) {
+		if (sp->state == CONNECTING) {
+			sp->pfd = -1;
+			continue;
+		}
+		sp->pfd = n;
+		if (sp->state == READING) {
+			rs->fds[n].fd = sp->clientfd;
+			rs->fds[n].events = POLLIN;
+		} else if (sp->npend > 0 || sp->eof) {
+			rs->fds[n].fd = sp->clientfd;
+			rs->fds[n].events = POLLOUT;
+		} else {
+			rs->fds[n].fd = sp->originfd;
+			rs->fds[n].events = POLLIN;
+		}
+		rs->fds[n++].revents = 0;
+	}
+
+	if ((rc = poll(rs->fds, n, -1)) < 0)
+		return rc;
+	for (i = 0; i < nextra; i++)
+		extra[i].revents = rs->fds[i].revents;
+	if (rs->fds[nextra].revents)
+		connected(rs);
+
+	/* One round, streams with the least left to send first */
+	nready = 0;
+	for (sp = rs->streams; sp != NULL; sp = sp->next)
+		if (sp->pfd >= 0 && rs->fds[sp->pfd].revents)
+			rs->order[nready++] = sp;
+	qsort(rs->order, nready, sizeof(relay_stream_t *), by_remaining);
+	for (i = 0; i < nready; i++) {
+		if (rs->order[i]->state == READING)
+			read_request(rs, rs->order[i]);
+		else
+			pump(rs, rs->order[i]);
+	}
+
+	/* Retire streams that are done */
+	pp = &rs->streams;
+	while ((sp = *pp) != NULL) {
+		if (sp->failed || (sp->eof && sp->npend == 0)) {
+			*pp = sp->next;
+			rs->nstreams--;
+			finish(sp);
+		} else {
+			pp = &sp->next;
+		}
+	}
+	return rc;
+}
+
+/*
+ * relay_drain - Finish every stream in flight
+ */
+void relay_drain(relay_sched_t *rs)
+{
+	while (rs->nstreams > 0)
+		if (relay_wait(rs, NULL, 0) < 0 && errno != EINTR)
+			unix_error("poll error");
+}
+
+/*
+ * connector_thread - Connect the streams queued on scheduler vargp to
+ *                    their origins and pass the descriptors back to it
+ */
+static void *connector_thread(void *vargp)
+{
+	relay_sched_t *rs = (relay_sched_t *)vargp;
+	struct connect_job *job;
+	struct connect_msg msg;
+
+	Pthread_detach(pthread_self());
+	while (1) {
+		P(&rs->jobs_items);
+		P(&rs->jobs_mutex);
+		job = rs->jobs;
+		if ((rs->jobs = job->next) == NULL)
+			rs->jobs_tail = &rs->jobs;
+		V(&rs->jobs_mutex);
+
+		/* The loop leaves a CONNECTING stream alone, uri included */
+		msg.sp = job->sp;
+		msg.fd = connect_origin(job->sp->uri);
+		if (write(rs->notify[1], &msg, sizeof(msg)) != sizeof(msg))
+			unix_error("notify write error");
+		Free(job);
+	}
+	return NULL;
+}
+
+/*
+ * connected - Take the origin connections that connectors have made
+ *             for rs's streams; a stream whose connect failed is
+ *             closed without a response.
+ */
+static void connected(relay_sched_t *rs)
+{
+	struct connect_msg msg;
+	ssize_t n;
+
+	while ((n = read(rs->notify[0], &msg, sizeof(msg))) == sizeof(msg)) {
+		if (msg.fd < 0) {
+			msg.sp->failed = 1;
+			continue;
+		}
+		set_nonblocking(msg.fd);
+		msg.sp->originfd = msg.fd;
+		msg.sp->state = RELAYING;
+	}
+	if (n < 0 && errno != EAGAIN && errno != EINTR)
+		unix_error("notify read error");
+}
+
+/*
+ * read_request - Read what has arrived of sp's request, and hand it to
+ *     forward_request() once it ends with a blank line. A request too
+ *     long for the buffer is handed over as it is; the request line
+ *     is all that forward_request() needs.
+ */
+static void read_request(relay_sched_t *rs, relay_stream_t *sp)
+{
+	size_t i;
+	ssize_t n;
+	int done;
+
+	if ((n = read(sp->clientfd, sp->req + sp->nreq,
+					RELAY_MAXREQUEST - sp->nreq)) <= 0) {
+		if (n == 0 || (errno != EAGAIN && errno != EINTR))
+			sp->failed = 1;
+		return;
+	}
+
+	/* Look for the end from just before the new bytes */
+	i = sp->nreq > 3 ? sp->nreq - 3 : 0;
+	sp->nreq += n;
+	for (done = sp->nreq == RELAY_MAXREQUEST; !done && i < sp->nreq; i++)
+		done = sp->req[i] == '\n' && ((i >= 1 && sp->req[i-1] == '\n') ||
+				(i >= 2 && sp->req[i-1] == '\r' && sp->req[i-2] == '\n'));
+	if (!done)
+		return;
+
+	sp->state = RELAYING;
+	forward_request(rs, sp, sp->req, sp->nreq);
+	Free(sp->req);
+	sp->req = NULL;
+}
+
+/*
+ * new_stream - Add a stream for clientfd to the scheduler
+ */
+static relay_stream_t *new_stream(relay_sched_t *rs, int clientfd)
+{
+	relay_stream_t *sp = Calloc(1, sizeof(relay_stream_t));
+
+	set_nonblocking(clientfd);
+	sp->state = READING;
+	sp->clientfd = clientfd;
+	sp->originfd = -1;
+	sp->pfd = -1;
+	sp->next = rs->streams;
+	rs->streams = sp;
+	rs->nstreams++;
+	return sp;
+}
+
+/*
+ * pump - Give sp one quantum: alternately read a chunk from its
+ *        origin and write it to its client until the deficit is
+ *        spent or either side would block.
+ */
+static void pump(relay_sched_t *rs, relay_stream_t *sp)
+{
+	ssize_t n;
+	size_t len;
+
+	sp->deficit += RELAY_QUANTUM;
+	while (sp->deficit > 0) {
+		if (sp->npend == 0) {
+			if (sp->eof)
+				break;
+			if ((n = read(sp->originfd, sp->buf, MAXLINE)) < 0) {
+				if (errno != EAGAIN && errno != EINTR)
+					sp->failed = 1;
+				break;
+			}
+			if (n == 0) {
+				sp->eof = 1;
+				break;
+			}
+			received(rs, sp, n);
+		}
+
+		len = sp->npend < sp->deficit ? sp->npend : sp->deficit;
+		if ((n = send(sp->clientfd, sp->pend, len, MSG_NOSIGNAL)) < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				sp->failed = 1;
+			break;
+		}
+		sp->pend += n;
+		sp->npend -= n;
+		sp->sent += n;
+		sp->deficit -= n;
+		rs->bytes += n;
+	}
+
+	if (sp->npend == 0)
+		sp->deficit = 0;
+	else if (sp->deficit > RELAY_QUANTUM)
+		sp->deficit = RELAY_QUANTUM;
+}
+
+/*
+ * received - Account for n new bytes from the origin in sp->buf
+ */
+static void received(relay_sched_t *rs, relay_stream_t *sp, size_t n)
+{
+	if (sp->total == 0)
+		inspect_headers(rs, sp, sp->buf, n);
+	if (sp->scanner)
+		link_scanner_feed(sp->scanner, sp->buf, n);
+	if (sp->total + n <= MAX_OBJECT_SIZE)
+		memcpy(sp->object + sp->total, sp->buf, n);
+	sp->total += n;
+	sp->pend = sp->buf;
+	sp->npend = n;
+}
+
+/*
+ * inspect_headers - Look at the first chunk of a response for its
+ *     Content-Length, which gives the stream its priority, and for
+ *     an HTML Content-Type if we are prefetching. Both are ignored
+ *     unless the whole header block is in this chunk.
+ */
+static void inspect_headers(relay_sched_t *rs, relay_stream_t *sp,
+		const char *buf, size_t n)
+{
+	struct http_header hdrs[MAXHDRS];
+	const struct http_header *h;
+	const char *p;
+	ssize_t hlen;
+	size_t i, len;
+	int nhdrs = MAXHDRS;
+
+	/* Skip the status line */
+	if ((p = memchr(buf, '\n', n)) == NULL)
+		return;
+	p++;
+	if ((hlen = http_parse_headers(p, n - (p - buf), hdrs, &nhdrs)) < 0)
+		return;
+
+	if ((h = http_find_header(hdrs, nhdrs, "Content-Length")) != NULL &&
+			h->value.len > 0 && h->value.len < 16) {
+		for (i = 0, len = 0; i < h->value.len; i++) {
+			if (h->value.base[i] < '0' || h->value.base[i] > '9')
+				break;
+			len = len * 10 + (h->value.base[i] - '0');
+		}
+		if (i == h->value.len)
+			sp->expected = (p - buf) + hlen + len;
+	}
+
+	h = http_find_header(hdrs, nhdrs, "Content-Type");
+	if (rs->prefetch && h != NULL && h->value.len >= 9 &&
+			!strncasecmp(h->value.base, "text/html", 9)) {
+		sp->scanner = Malloc(sizeof(link_scanner_t));
+		if (!link_scanner_init(sp->scanner, sp->uri)) {
+			Free(sp->scanner);
+			sp->scanner = NULL;
+		}
+	}
+}
+
+/*
+ * finish - Cache a complete response that fits, then free the stream
+ */
+static void finish(relay_stream_t *sp)
+{
+	if (sp->originfd >= 0) {
+		if (!sp->failed && sp->total <= MAX_OBJECT_SIZE)
+			cache_put(sp->uri, sp->object, sp->total);
+		Close(sp->originfd);
+	}
+	if (sp->scanner)
+		Free(sp->scanner);
+	Close(sp->clientfd);
+	Free(sp->uri);
+	Free(sp->object);
+	Free(sp->req);
+	Free(sp);
+}
+
+/*
+ * by_remaining - qsort order: fewest bytes left to send first, and
+ *                streams of unknown length last
+ */
+static int by_remaining(const void *a, const void *b)
+{
+	const relay_stream_t *x = *(relay_stream_t * const *)a;
+	const relay_stream_t *y = *(relay_stream_t * const *)b;
+	size_t rx = remaining(x), ry = remaining(y);
+
+	return rx < ry ? -1 : rx > ry;
+}
+
+/* remaining - Bytes sp has left to send, or SIZE_MAX if unknown */
+static size_t remaining(const relay_stream_t *sp)
+{
+	if (sp->expected == 0)
+		return (size_t)-1;
+	return sp->expected > sp->sent ? sp->expected - sp->sent : 0;
+}
+
+/* set_nonblocking - Make I/O on fd return EAGAIN instead of waiting */
+static void set_nonblocking(int fd)
+{
+	int flags;
+
+	if ((flags = fcntl(fd, F_GETFL, 0)) < 0 ||
+			fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		unix_error("fcntl error");
+}
@@ -0,0 +1,62 @@
+/*
+ * relay.h - Relays responses to clients, many at a time
+ *
+ * Each accept loop owns a relay_sched_t with the connections it is
+ * currently serving. Rather than copying one response from start to
+ * finish, the loop polls all of them together with its listener and
+ * gives every ready response a byte quantum per round (deficit round
+ * robin). Responses with the fewest bytes left, by Content-Length,
+ * are served first in each round, so small objects finish in their
+ * first turn while large downloads share what remains.
+ *
+ * Nothing the loop does may block, or every response in flight would
+ * wait: a connection's request is read as it arrives and then handed
+ * to forward_request(), and the origin is looked up and connected to
+ * by the loop's own pool of connector threads, which pass the
+ * connection back to the loop through a pipe in its poll set. As with
+ * the rest of a relay_sched_t, no loop shares its pool, so origins
+ * that are slow to resolve or connect only hold up their own loop.
+ */
+#ifndef __RELAY_H__
+#define __RELAY_H__
+
+#include <poll.h>
+#include "csapp.h"
+
+#define RELAY_QUANTUM 16384         /* bytes per response per round */
+#define RELAY_MAXREQUEST MAXBUF     /* request line and headers */
+#define RELAY_CONNECTORS 8          /* origin connects at once, per loop */
+
+typedef struct relay_stream relay_stream_t;
+struct connect_job;
+
+typedef struct {
+	relay_stream_t *streams;    /* connections being served */
+	int nstreams;
+	int prefetch;               /* feed HTML to the link scanner */
+	int notify[2];              /* origin connections from connectors */
+	struct connect_job *jobs;   /* streams waiting for a connector */
+	struct connect_job **jobs_tail;
+	sem_t jobs_mutex;           /* protects jobs and jobs_tail */
+	sem_t jobs_items;           /* queued connect jobs */
+	struct pollfd *fds;         /* poll set, caller's entries first */
+	relay_stream_t **order;     /* ready streams, shortest first */
+	int maxfds;                 /* capacity of fds and order */
+	unsigned long bytes;        /* bytes written to clients, owner only */
+} relay_sched_t;
+
+void relay_init(relay_sched_t *rs, int prefetch);
+void relay_accept(relay_sched_t *rs, int clientfd);
+void relay_connect(relay_sched_t *rs, relay_stream_t *sp,
+		const char *uri, char *object);
+void relay_respond(relay_sched_t *rs, relay_stream_t *sp,
+		char *object, size_t size);
+void relay_abort(relay_sched_t *rs, relay_stream_t *sp);
+int relay_wait(relay_sched_t *rs, struct pollfd *extra, int nextra);
+void relay_drain(relay_sched_t *rs);
+
+/* Provided by proxy.c */
+void forward_request(relay_sched_t *rs, relay_stream_t *sp,
+		char *request, size_t len);
+
+#endif /* __RELAY_H__ */
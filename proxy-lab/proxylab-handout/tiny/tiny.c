@@ -112,27 +112,29 @@ void read_requesthdrs(rio_t *rp)
 int parse_uri(char *uri, char *filename, char *cgiargs) 
 {
     char *ptr;
-
-    if (!strstr(uri, "cgi-bin")) {  /* Static content */
-	strcpy(cgiargs, "");
-	strcpy(filename, ".");
-	strcat(filename, uri);
-	if (uri[strlen(uri)-1] == '/')
-	    strcat(filename, "home.html");
-	return 1;
-    }
-    else {  /* Dynamic content */
-	ptr = index(uri, '?');
-	if (ptr) {
-	    strcpy(cgiargs, ptr+1);
-	    *ptr = '\0';
-	}
-	else 
-	    strcpy(cgiargs, "");
-	strcpy(filename, ".");
-	strcat(filename, uri);
-	return 0;
+    size_t len;
+    int is_static, is_dir;
+
+    /* One pass: any "cgi-bin" makes it dynamic, and only then is it
+     * split at '?'; a static filename keeps its query, as before */
+    is_static = strstr(uri, "cgi-bin") == NULL;
+    ptr = is_static ? NULL : strchr(uri, '?');
+    len = ptr ? (size_t)(ptr - uri) : strlen(uri);
+    is_dir = is_static && len > 0 && uri[len-1] == '/';
+    if (len + sizeof("home.html") + 1 > MAXLINE)
+	len = MAXLINE - sizeof("home.html") - 1;
+
+    cgiargs[0] = '\0';
+    if (ptr) {
+	strncpy(cgiargs, ptr+1, MAXLINE-1);
+	cgiargs[MAXLINE-1] = '\0';
     }
+    filename[0] = '.';
+    memcpy(filename+1, uri, len);
+    filename[len+1] = '\0';
+    if (is_dir)
+	strcpy(filename+len+1, "home.html");
+    return is_static;
 }
 /* $end parse_uri */
 
@@ -39,7 +39,8 @@
   "trace21.txt",\
   "trace22.txt",\
   "trace23.txt",\
-  "trace24.txt"
+  "trace24.txt",\
+  "trace28.txt"
 
 /* Various constants */
 #define ITERS 3
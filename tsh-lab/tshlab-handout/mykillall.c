@@ -0,0 +1,52 @@
+/* 
+ * mykillall.c - Sends a signal to every other child of its parent, as
+ *     fast as it can, so that the shell gets a burst of SIGCHLDs
+ *
+ * Usage: ./mykillall [signo]    (default SIGINT)
+ */ 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#define MAXPIDS 65536
+
+pid_t pids[MAXPIDS];
+
+int main(int argc, char **argv) 
+{
+    int sig = (argc > 1) ? atoi(argv[1]) : SIGINT;
+    pid_t self = getpid(), parent = getppid(), pid, ppid;
+    char path[64], buf[512], *p;
+    struct dirent *de;
+    FILE *fp;
+    DIR *dir;
+    int i, n = 0;
+
+    /* Find them all first, then send the signals back to back */
+    if ((dir = opendir("/proc")) == NULL) {
+        perror("opendir");
+        exit(1);
+    }
+    while ((de = readdir(dir)) != NULL && n < MAXPIDS) {
+        if ((pid = atoi(de->d_name)) <= 0 || pid == self)
+            continue;
+        sprintf(path, "/proc/%d/stat", pid);
+        if ((fp = fopen(path, "r")) == NULL)
+            continue;
+        /* The parent follows the command name, which may hold spaces */
+        if (fgets(buf, sizeof(buf), fp) != NULL &&
+                (p = strrchr(buf, ')')) != NULL &&
+                sscanf(p + 2, "%*c %d", &ppid) == 1 && ppid == parent)
+            pids[n++] = pid;
+        fclose(fp);
+    }
+    closedir(dir);
+
+    for (i = 0; i < n; i++)
+        kill(pids[i], sig);
+    exit(0);
+}
@@ -3,6 +3,19 @@
  *
  * Runs a tiny shell on a trace file.
  *
+ * All waiting is done in one epoll set: the shell's output socket, the
+ * job sync socket, a pidfd for the shell, and a signalfd for signals
+ * that should stop the run. A wait ends as soon as what it waits for
+ * arrives, or at once if the shell has exited and nothing more can;
+ * timeouts are in milliseconds.
+ *
+ * Benchmark mode (-B) times each step of the trace instead of printing
+ * the shell's output: from sending a command line, SIGINT or SIGTSTP
+ * to the prompt that NEXT waits for. "PHASE name" starts a new group
+ * of timings, and "REPEAT n" ... "END" runs the lines between n times,
+ * with {i} in them replaced by the iteration (1..n). At the end it
+ * prints the latency distribution of each phase.
+ *
  * Copyright (c) 2004, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
@@ -18,9 +31,20 @@
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include "config.h"
 
 #define MAXBUF 1024
+#define MAXPHASES 64
+#define MAXREPEAT 8         /* REPEAT nesting depth */
+
+/* Results of wait_readable() */
+#define WAIT_TIMEOUT   0
+#define WAIT_READABLE  1
+#define WAIT_EXITED   -1    /* the shell exited first */
 
 /* 
  * Global variables 
@@ -37,6 +61,38 @@ int sandboxing = 0;
 char *tracefile = NULL;
 char *shellprog = "./tsh";
 char *shellargs = NULL;
+int timeout_ms = DRIVER_TIMEOUT * 1000; /* -t */
+int report_time = 0;                    /* -T */
+int bench = 0;                          /* -B */
+char *shellarg = NULL;                  /* -a */
+
+/* The trace, read in whole so REPEAT can go back */
+char **lines;
+int nlines, pc;
+struct {
+    int start;              /* line after the REPEAT */
+    int count, iter;        /* iterations, and the current one (1..count) */
+} repeats[MAXREPEAT];
+int nrepeats;
+
+/* Timings of each phase, in microseconds */
+struct phase {
+    char name[MAXBUF];
+    double *us;
+    int n, cap;
+} phases[MAXPHASES];
+int nphases;
+int bench_done = 0;         /* the trace ran to the end */
+struct timespec op_start;   /* when the step being timed began */
+int op_pending = 0;
+
+/* What the event loop waits on */
+int epfd;
+int pidfd = -1;             /* the child shell */
+int sigfd;
+int shell_exited = 0;       /* pidfd has fired */
+pid_t shell_pid;
+struct timespec start_time;
 
 /* domain socket pairs */
 int datafd[2];
@@ -47,18 +103,17 @@ void usage(char *msg);
 int blankline(char *str);
 void print_child_status(void);
 int next_prompt(void);
-int readable(int fd, int secs);
+int wait_readable(int fd, int ms);
+void watch(int fd);
+void print_wall_time(void);
 void clean(void);
-
-/*
- * sigalrm_handler - Notify when we timeout waiting for the child
- */
-void sigalrm_handler(int sig) 
-{
-    printf("%s: Runtrace timed out while %s.\n", tracefile, state);
-    clean();
-    exit(1);
-}
+void read_trace(FILE *fp);
+int next_line(char *dst);
+void start_op(void);
+void end_op(void);
+int is_prompt(char *str);
+void print_bench(void);
+int cmp_double(const void *a, const void *b);
 
 /* Main routine */
 int main(int argc, char **argv) 
@@ -70,12 +125,12 @@ int main(int argc, char **argv)
     FILE *tracefp;
     int n;
     struct stat statbuf;
-    
-    /* Install the signal handler */
-    signal(SIGALRM, sigalrm_handler);
+    sigset_t mask;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
 
     /* Parse the command line */
-    while ((c = getopt(argc, argv, "hVxs:f:")) != EOF) {
+    while ((c = getopt(argc, argv, "hVxBs:f:t:Ta:")) != EOF) {
         switch (c) {
         case 'h':             /* Print help message */
             usage("");
@@ -92,6 +147,18 @@ int main(int argc, char **argv)
 	case 'x':             /* Enable sandboxing */
 	    sandboxing = 1;   /* Hidden argument */
 	    break;
+	case 't':             /* Timeout in ms (default DRIVER_TIMEOUT s) */
+	    timeout_ms = atoi(optarg);
+	    break;
+	case 'T':             /* Report the wall time on stderr */
+	    report_time = 1;
+	    break;
+	case 'B':             /* Time the trace instead of echoing output */
+	    bench = 1;
+	    break;
+	case 'a':             /* One more argument for the shell */
+	    shellarg = strdup(optarg);
+	    break;
 	default:
             usage("Unrecognized argument");
 	}
@@ -142,6 +209,37 @@ int main(int argc, char **argv)
 	printf("Created environment variable %s\n", buf);
     }
 
+    /* Keep trace commands out of the user's tsh history, and the
+     * history out of the traces */
+    setenv("TSH_HISTFILE", "", 1);
+
+    if (report_time)
+	atexit(print_wall_time);
+    if (bench)
+	atexit(print_bench);
+    read_trace(tracefp);
+
+    /*
+     * Signals that end the run come in through sigfd; the shell gets
+     * back the default mask before it runs
+     */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    if ((sigfd = signalfd(-1, &mask, SFD_CLOEXEC)) < 0) {
+	perror("signalfd");
+	exit(1);
+    }
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+	perror("epoll_create1");
+	exit(1);
+    }
+    watch(sigfd);
+    watch(datafd[0]);
+    watch(syncfd[0]);
+
 
     /************************* 
      * Child code runs a shell
@@ -150,20 +248,26 @@ int main(int argc, char **argv)
 
 	/* Close the descriptor the child is not using */
 	close(datafd[0]);
+	sigprocmask(SIG_UNBLOCK, &mask, NULL);
 
 	/* Redirect stdin and stdout to the domain socket */
 	dup2(datafd[1], 0);
 	dup2(datafd[1], 1);
+
+	/* Other shells print their prompt on stderr, and only as PS1 */
+	if (bench) {
+	    dup2(datafd[1], 2);
+	    setenv("PS1", PROMPT, 1);
+	}
 	
 	/* Create the shell command line arguments */
-	shellargv[0] = shellprog;
-	if (verbose) {
-	    shellargv[1] = "-v";
-	    shellargv[2] = '\0';
-	}
-	else {
-	    shellargv[1] = '\0';
-	}
+	n = 0;
+	shellargv[n++] = shellprog;
+	if (verbose)
+	    shellargv[n++] = "-v";
+	if (shellarg)
+	    shellargv[n++] = shellarg;
+	shellargv[n] = '\0';
 
 	/* Modify the environment if sandboxing is enabled */
 	if (sandboxing) {
@@ -185,14 +289,36 @@ int main(int argc, char **argv)
     /* Close the descriptor the parent is not using */
     close(datafd[1]); 
 
+    /* Watch for the shell to exit */
+    if (child_pid < 0) {
+	perror("fork");
+	exit(1);
+    }
+    shell_pid = child_pid;
+    if ((pidfd = syscall(SYS_pidfd_open, child_pid, 0)) < 0) {
+	perror("pidfd_open");
+	exit(1);
+    }
+    watch(pidfd);
+
     /* Read the initial prompt from the shell */
-    if (readable(datafd[0], DRIVER_TIMEOUT) == 0) {
-	fprintf(stderr, "%s: Runtrace timed out waiting for initial shell prompt\n", tracefile);
+    if ((n = wait_readable(datafd[0], timeout_ms)) != WAIT_READABLE) {
+	if (n == WAIT_EXITED)
+	    fprintf(stderr, "%s: Shell exited before its initial prompt\n", tracefile);
+	else
+	    fprintf(stderr, "%s: Runtrace timed out waiting for initial shell prompt\n", tracefile);
     }     
     else {
 	bzero(buf, MAXBUF);
-	n = recv(datafd[0], buf, MAXBUF, 0);
-	if (strcmp(buf, PROMPT)) {
+	n = recv(datafd[0], buf, MAXBUF-1, 0);
+
+	/* A shell under test may say something first */
+	while (bench && !is_prompt(buf) && 
+	       wait_readable(datafd[0], timeout_ms) == WAIT_READABLE) {
+	    bzero(buf, MAXBUF);
+	    n = recv(datafd[0], buf, MAXBUF-1, 0);
+	}
+	if (!is_prompt(buf)) {
 	    fprintf(stderr, "%s: Runtrace expected initial shell prompt but got '%s' instead.\n", tracefile, buf);
 	    exit(1);
 	}
@@ -201,10 +327,7 @@ int main(int argc, char **argv)
     /* 
      * Parent reads trace file and sends commands to the shell 
      */
-    while (fgets(line, MAXBUF, tracefp)) {
-
-	/* Delete newline character */
-	line[strlen(line)-1] = '\0';
+    while (next_line(line)) {
 
 	/* Ignore blank lines */
 	if (blankline(line)) { 
@@ -215,7 +338,8 @@ int main(int argc, char **argv)
 
 	/* Echo comment lines */ 
 	if (line[0] == '#') {
-	    printf("%s\n", line);
+	    if (!bench)
+		printf("%s\n", line);
 	    continue;
 	}
 
@@ -226,7 +350,7 @@ int main(int argc, char **argv)
 	
 	/* WAIT command */
 	if (!strcmp(command, "WAIT")) {
-	    if (readable(syncfd[0], DRIVER_TIMEOUT) == 0) {
+	    if (wait_readable(syncfd[0], timeout_ms) != WAIT_READABLE) {
 		printf("%s: Runtrace timed out waiting for sync from job\n", 
 		       tracefile);
 		exit(1);
@@ -247,7 +371,20 @@ int main(int argc, char **argv)
 	/* NEXT command */
 	else if (!strcmp(command, "NEXT")) {
 	    if (next_prompt() == 0) 
-		exit(0);
+		exit(bench ? 1 : 0);
+	    end_op();
+	    continue;
+	}
+
+	/* PHASE command: time what follows under a new name */
+	else if (!strcmp(command, "PHASE")) {
+	    if (nphases == MAXPHASES) {
+		fprintf(stderr, "%s: too many phases\n", tracefile);
+		exit(1);
+	    }
+	    bufp = line + strspn(line, " \t") + strlen("PHASE");
+	    strcpy(phases[nphases++].name, bufp + strspn(bufp, " \t"));
+	    op_pending = 0;
 	    continue;
 	}
 
@@ -265,6 +402,7 @@ int main(int argc, char **argv)
 
 	/* SIGINT command */
 	else if (!strcmp(command, "SIGINT")) {
+	    start_op();
 	    if (kill(child_pid, SIGINT) < 0) {
 		perror("kill SIGINT");
 		exit(1);
@@ -276,6 +414,7 @@ int main(int argc, char **argv)
 
 	/* SIGTSTP command */
 	else if (!strcmp(command, "SIGTSTP")) {
+	    start_op();
 	    if (kill(child_pid, SIGTSTP) < 0) {
 		perror("kill SIGTSTP");
 		exit(1);
@@ -291,6 +430,7 @@ int main(int argc, char **argv)
 		printf("runtrace: Sending '%s' to shell\n", line);
 	    }
 	    strcat(line, "\n");
+	    start_op();
 	    if ((send(datafd[0], line, strlen(line), 0)) < 0) {
 		perror("send datafd[0]");
 		exit(1);
@@ -304,9 +444,14 @@ int main(int argc, char **argv)
     send(datafd[0], bufp, 0, 0);
 
     /* Wait for the shell to terminate */
-    alarm(DRIVER_TIMEOUT);
     state = "waiting for shell to terminate";
+    if (wait_readable(pidfd, timeout_ms) == WAIT_TIMEOUT) {
+	printf("%s: Runtrace timed out while %s.\n", tracefile, state);
+	clean();
+	exit(1);
+    }
     waitpid(child_pid, NULL, 0);
+    bench_done = 1;
 
     /* Kill any of our stray shells and jobs */
     clean();
@@ -327,11 +472,15 @@ void clean() {
 void usage(char *msg)
 {
     printf("%s\n", msg);
-    printf("Usage: runtrace -f <file> -s <shellprog> [-hV]\n");
+    printf("Usage: runtrace -f <file> -s <shellprog> [-hVTB] [-t <ms>] [-a <arg>]\n");
     printf("Options:\n");
     printf("  -h            Print this message\n");
     printf("  -s <shell>    Shell program to test (default ./tsh)\n");
     printf("  -f <file>     Trace file\n");
+    printf("  -t <ms>       Timeout for each wait (default %d)\n", DRIVER_TIMEOUT * 1000);
+    printf("  -T            Print the wall time of the run on stderr\n");
+    printf("  -B            Benchmark: print step latencies, not shell output\n");
+    printf("  -a <arg>      Pass <arg> to the shell (e.g. -i for /bin/sh)\n");
     printf("  -V            Be more verbose\n");
 
     exit(0);
@@ -406,14 +555,18 @@ int next_prompt(void)
     int n;
     
     bzero(buf, MAXBUF);
-    if (readable(datafd[0], DRIVER_TIMEOUT) == 0) {
-	printf("%s: Runtrace timed out waiting for next shell prompt\n", 
-	       tracefile);
+    if ((n = wait_readable(datafd[0], timeout_ms)) != WAIT_READABLE) {
+	if (n == WAIT_EXITED)
+	    printf("%s: Shell exited while runtrace waited for next shell prompt\n",
+		   tracefile);
+	else
+	    printf("%s: Runtrace timed out waiting for next shell prompt\n", 
+		   tracefile);
 	print_child_status();
 	return 0;
     }
     else {
-	if ((n = recv(datafd[0], buf, MAXBUF, 0)) < 0) {
+	if ((n = recv(datafd[0], buf, MAXBUF-1, 0)) < 0) {
 	    perror("next_prompt:recv1");
 	    exit(1);
 	}
@@ -422,18 +575,23 @@ int next_prompt(void)
 	} 
     }
 
-    while(strcmp(buf, PROMPT)) {
-	printf("%s", buf);
+    while(!is_prompt(buf)) {
+	if (!bench)
+	    printf("%s", buf);
 
 	bzero(buf, MAXBUF);
-	if (readable(datafd[0], DRIVER_TIMEOUT) == 0) {
-	    printf("%s: Runtrace timed out waiting for next shell prompt\n", 
-		   tracefile);
+	if ((n = wait_readable(datafd[0], timeout_ms)) != WAIT_READABLE) {
+	    if (n == WAIT_EXITED)
+		printf("%s: Shell exited while runtrace waited for next shell prompt\n",
+		       tracefile);
+	    else
+		printf("%s: Runtrace timed out waiting for next shell prompt\n", 
+		       tracefile);
 	    print_child_status();
 	    return 0;
 	}
 	else {
-	    if ((n = recv(datafd[0], buf, MAXBUF, 0)) < 0) {
+	    if ((n = recv(datafd[0], buf, MAXBUF-1, 0)) < 0) {
 		perror("next_prompt:recv1");
 		exit(1);
 	    }
@@ -446,26 +604,264 @@ int next_prompt(void)
 }
 
 /*
- * readable - Wait secs seconds for descriptor fd to become readable
- *            Return > 0 if fd is readable, 0 if timeout.
+ * is_prompt - Return true if str is the shell's prompt. In benchmark
+ *             mode other output may come in the same message first.
  */
-int readable(int fd, int secs) 
+int is_prompt(char *str)
 {
+    size_t n = strlen(str), p = strlen(PROMPT);
+
+    if (bench)
+	return n >= p && !strcmp(str + n - p, PROMPT);
+    return !strcmp(str, PROMPT);
+}
+
+/*
+ * read_trace - Read the lines of the trace, without their newlines
+ */
+void read_trace(FILE *fp)
+{
+    int cap = 64;
+
+    if ((lines = malloc(cap * sizeof(char *))) == NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    while (fgets(line, MAXBUF, fp)) {
+	line[strcspn(line, "\n")] = '\0';
+	if (nlines == cap && (lines = realloc(lines, (cap *= 2) * sizeof(char *))) == NULL) {
+	    perror("realloc");
+	    exit(1);
+	}
+	lines[nlines++] = strdup(line);
+    }
+    fclose(fp);
+}
+
+/*
+ * next_line - Copy the next trace line to run into dst, handling
+ *     REPEAT and END. Returns 0 at the end of the trace.
+ */
+int next_line(char *dst)
+{
+    char *src, *p, *q;
     int n;
 
-    fd_set rset;
-    struct timeval tv;
+    while (pc < nlines) {
+	src = lines[pc++];
+	p = src + strspn(src, " \t");
+	if (!strncmp(p, "REPEAT", 6) && isspace(p[6])) {
+	    if (nrepeats == MAXREPEAT || (n = atoi(p + 7)) < 0) {
+		fprintf(stderr, "%s: bad REPEAT on line %d\n", tracefile, pc);
+		exit(1);
+	    }
+	    repeats[nrepeats].start = pc;
+	    repeats[nrepeats].count = n;
+	    repeats[nrepeats].iter = 1;
+	    nrepeats++;
+	    if (n == 0) {
+		/* Skip to the matching END */
+		for (n = 1; pc < nlines && n > 0; pc++) {
+		    p = lines[pc] + strspn(lines[pc], " \t");
+		    if (!strncmp(p, "REPEAT", 6) && isspace(p[6]))
+			n++;
+		    else if (!strncmp(p, "END", 3) && blankline(p + 3))
+			n--;
+		}
+		nrepeats--;
+	    }
+	    continue;
+	}
+	if (!strncmp(p, "END", 3) && blankline(p + 3) && nrepeats > 0) {
+	    if (repeats[nrepeats-1].iter++ < repeats[nrepeats-1].count)
+		pc = repeats[nrepeats-1].start;
+	    else
+		nrepeats--;
+	    continue;
+	}
 
-    FD_ZERO(&rset);
-    FD_SET(fd, &rset);
+	/* Copy, putting in the iteration for {i} */
+	for (q = dst; *src != '\0' && q < dst + MAXBUF - 16; ) {
+	    if (nrepeats > 0 && src[0] == '{' && src[1] == 'i' && src[2] == '}') {
+		q += sprintf(q, "%d", repeats[nrepeats-1].iter);
+		src += 3;
+	    } else {
+		*q++ = *src++;
+	    }
+	}
+	*q = '\0';
+	return 1;
+    }
+    return 0;
+}
 
-    tv.tv_sec = secs;
-    tv.tv_usec = 0;
-    
-    if ((n = select(fd+1, &rset, NULL, NULL, &tv)) < 0) {
-	perror("select");
+/*
+ * start_op - Note that a step to be timed begins now
+ */
+void start_op(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &op_start);
+    op_pending = 1;
+}
+
+/*
+ * end_op - The step begun by start_op() is done: add its time to
+ *          the current phase
+ */
+void end_op(void)
+{
+    struct timespec now;
+    struct phase *ph;
+
+    if (!op_pending || nphases == 0)
+	return;
+    op_pending = 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ph = &phases[nphases-1];
+    if (ph->n == ph->cap && 
+	(ph->us = realloc(ph->us, (ph->cap = ph->cap ? 2*ph->cap : 64) * sizeof(double))) == NULL) {
+	perror("realloc");
 	exit(1);
     }
+    ph->us[ph->n++] = (now.tv_sec - op_start.tv_sec) * 1e6 +
+	(now.tv_nsec - op_start.tv_nsec) / 1e3;
+}
+
+/*
+ * print_bench - Print the latency distribution of each phase, in
+ *     microseconds. A phase the run did not finish is marked
+ *     incomplete.
+ */
+void print_bench(void)
+{
+    struct phase *ph;
+    double sum;
+    int i, j;
+
+    printf("# %-18s %6s %9s %9s %9s %9s %9s (us)\n",
+	   "phase", "n", "mean", "p50", "p90", "p99", "max");
+    for (i = 0; i < nphases; i++) {
+	ph = &phases[i];
+	if (ph->n == 0) {
+	    printf("%-20s %6d%s\n", ph->name, 0,
+		   (!bench_done && i == nphases-1) ? " incomplete" : "");
+	    continue;
+	}
+	qsort(ph->us, ph->n, sizeof(double), cmp_double);
+	for (j = 0, sum = 0; j < ph->n; j++)
+	    sum += ph->us[j];
+	printf("%-20s %6d %9.1f %9.1f %9.1f %9.1f %9.1f%s\n", ph->name, ph->n,
+	       sum / ph->n, ph->us[(ph->n - 1) / 2], ph->us[(ph->n * 9 - 1) / 10],
+	       ph->us[(ph->n * 99 - 1) / 100], ph->us[ph->n - 1],
+	       (!bench_done && i == nphases-1) ? " incomplete" : "");
+    }
+    fflush(stdout);
+}
+
+/* cmp_double - qsort order for doubles */
+int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * watch - Add fd to the epoll set
+ */
+void watch(int fd)
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+	perror("epoll_ctl");
+	exit(1);
+    }
+}
+
+/*
+ * wait_readable - Wait up to ms milliseconds for descriptor fd to
+ *     become readable. Returns WAIT_READABLE, WAIT_TIMEOUT, or
+ *     WAIT_EXITED if the shell has exited and fd has nothing to read.
+ *     A signal on sigfd ends the run.
+ */
+int wait_readable(int fd, int ms) 
+{
+    struct epoll_event evs[4];
+    struct signalfd_siginfo si;
+    struct timespec now, deadline;
+    int i, n, left, ready;
+
+    if (fd == pidfd && shell_exited)
+	return WAIT_READABLE;
+
+    /* An exited shell sends nothing more, so only look at what is left */
+    if (fd == datafd[0] && shell_exited)
+	ms = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+	deadline.tv_sec++;
+	deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (1) {
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	left = (deadline.tv_sec - now.tv_sec) * 1000 +
+	    (deadline.tv_nsec - now.tv_nsec + 999999) / 1000000;
+	if (left < 0)
+	    left = 0;
+
+	if ((n = epoll_wait(epfd, evs, 4, left)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("epoll_wait");
+	    exit(1);
+	}
+	if (n == 0)
+	    return (fd == datafd[0] && shell_exited) ? WAIT_EXITED : WAIT_TIMEOUT;
+
+	ready = 0;
+	for (i = 0; i < n; i++) {
+	    if (evs[i].data.fd == sigfd) {
+		if (read(sigfd, &si, sizeof(si)) == sizeof(si))
+		    printf("%s: Runtrace stopped by signal %d\n", tracefile,
+			   si.ssi_signo);
+		kill(shell_pid, SIGKILL);
+		clean();
+		exit(1);
+	    }
+	    if (evs[i].data.fd == fd)
+		ready = 1;
+
+	    /* An exited pidfd stays readable, so stop watching it */
+	    if (evs[i].data.fd == pidfd && !shell_exited) {
+		shell_exited = 1;
+		epoll_ctl(epfd, EPOLL_CTL_DEL, pidfd, NULL);
+	    }
+	}
+	if (ready)
+	    return WAIT_READABLE;
+
+	/* Nothing more will come from an exited shell; jobs may still sync */
+	if (shell_exited && fd == datafd[0])
+	    return WAIT_EXITED;
+    }
+}
+
+/*
+ * print_wall_time - Report how long the run took
+ */
+void print_wall_time(void)
+{
+    struct timespec now;
 
-    return n;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(stderr, "%s: %.1f ms\n", tracefile,
+	    (now.tv_sec - start_time.tv_sec) * 1e3 +
+	    (now.tv_nsec - start_time.tv_nsec) / 1e6);
 }
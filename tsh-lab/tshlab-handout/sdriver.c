@@ -5,38 +5,98 @@
  *
  * Introduces non-determinism in the fork() function call to 
  * identify erroneous races in the student code.
+ *
+ * With -B, runs a benchmark trace (see bench.txt) under "runtrace -B"
+ * on the test shell, the reference shell and /bin/sh in turn, and
+ * prints their per-phase latencies side by side.
+ *
+ * With -F, runs random traces (see make_trace) on the test shell and
+ * the reference shell instead, and reports those whose outputs differ.
+ *
+ * The output of each runtrace is read from a pipe into memory while
+ * it runs, and the outputs are normalized and compared in place, so
+ * no temp files, sort or diff processes are involved.
  *  
  * Copyright (c) 2004-2011, R. Bryant and D. O'Hallaron
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
+#include <ctype.h>
 #include <float.h>
 #include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
 #include "driverlib.h"
 #include "config.h"
 
-/* Prototypes */
-void usage(void);
-int runtrace(char *tracefile);
-void delete_tmpfiles(void);
-void emit_file(char *filename);
+/*
+ * A runtrace process and what it printed, which is read from a pipe
+ * while it runs
+ */
+struct trace_out {
+    pid_t pid;                  /* runtrace process, 0 once reaped */
+    int pidfd;                  /* readable once it has exited */
+    int fd;                     /* read end of its stdout, -1 at EOF */
+    int status;                 /* its wait status */
+    char *buf;                  /* its output, NUL-terminated */
+    size_t len, cap;
+};
 
 /* 
- * Perl program that filters a shell output file:
- *
- * (1) Elides all whitespace. 
- * (2) Converts PIDs of the form "(12345)" to "(PID)". 
- *
- * These transformations allow us to do diffs on the outputs of 
- * different runs of different shells.  
+ * A trace being run. Its test and reference shells run side by side,
+ * each under its own runtrace in its own process group.
  */
-#define PERLPROG "while(<>){chomp; s/\\s+//g; s/\\(\\d+\\)/\\(PID\\)/g; print \"$_\"}"
+struct trace_run {
+    int trace;                  /* Index of the trace, -1 if slot is free */
+    int iter;                   /* Iterations of it run so far */
+    struct trace_out test;
+    struct trace_out ref;
+};
+
+/* A line of an output, for diffing; not NUL-terminated */
+struct line {
+    char *s;
+    int len;
+    char *key;                  /* filtered as by same_output(), to compare */
+};
+
+/* Prototypes */
+void usage(void);
+int runtrace(char *tracefile);
+void run_parallel(char **tracefiles, int num_tracefiles, int *correct);
+static void start_trace(struct trace_run *tr, char *tracefile);
+static void start_reported(struct trace_run *tr, char *tracefile, FILE *out);
+static void start_runtrace(struct trace_out *o, char **argv);
+static struct trace_out *wait_output(void);
+static void read_output(struct trace_out *o);
+static int check_trace(struct trace_run *tr, char *tracefile, FILE *out);
+static void abort_runs(void);
+static void print_report(void);
+static int same_output(struct trace_out *a, struct trace_out *b);
+static int next_filtered(const char **p, const char **pid);
+static void emit_output(FILE *out, struct trace_out *o);
+static void emit_diff(FILE *out, struct trace_out *a, struct trace_out *b);
+static char *diff_ops(struct line *a, int n, struct line *b, int m, int *nops);
+static struct line *split_lines(char *buf, size_t len, int *nlines);
+static char *filter_line(const char *s, int len);
+static void free_lines(struct line *lines, int n);
+static void benchmark(char *tracefile);
+static void fuzz(int count);
+static char *make_trace(unsigned seed);
+static void trace_command(FILE *fp, char *cmd);
+static unsigned xorshift(unsigned *r);
+static int bench_shell(char *shell, char *arg, char *tracefile);
 
 /********************
  * Global variables
@@ -46,6 +106,20 @@ char *shellprog = "./tsh";  /* Name of test shell (-s) */
 int sandboxing = 0;         /* Enable sandboxing (-x) */
 int autograded = 0;         /* Set only on the Autolab server (-A) */
 int num_iters=ITERS;        /* How many times to test each trace file */
+int num_jobs = 1;           /* How many traces to run at once (-j) */
+int fuzz_count = 0;         /* Random traces to run (-F) */
+unsigned fuzz_seed = 1;     /* Seed of the first of them (-R) */
+
+/* One slot per trace that may run at once */
+struct trace_run *runs;
+int num_runs;
+
+/* With -j, what each trace printed, held until the traces before it are done */
+FILE *report[MAXTRACES];
+char *report_buf[MAXTRACES];
+size_t report_len[MAXTRACES];
+int num_reports;            /* Traces that have a report */
+int num_printed;            /* Reports already printed */
 
 /* Null-terminated list of trace files */
 static char *default_tracefiles[] = {TRACEFILES, NULL};
@@ -54,15 +128,6 @@ static char *default_tracefiles[] = {TRACEFILES, NULL};
 char autoresult[MAXBUF]; /* Autolab autoresult string */  
 char status[MAXBUF];
 
-/* Temp filenames for unfiltered shell output */
-char ref_raw_outfile[MAXBUF];
-char test_raw_outfile[MAXBUF];
-char diff_raw_outfile[MAXBUF];
-
-/* Temp filenames for filtered shell output */
-char ref_filtered_outfile[MAXBUF];
-char test_filtered_outfile[MAXBUF];
-char diff_filtered_outfile[MAXBUF];
 
 /**************
  * Main routine
@@ -71,8 +136,6 @@ int main(int argc, char **argv)
 {
     int i, j;
     char c;
-    int pid;
-    int current_time;
 
     int correct[MAXTRACES];    /* True if trace i is correct */
     int num_correct;           /* Number of correct traces */ 
@@ -81,6 +144,7 @@ int main(int argc, char **argv)
     int num_tracefiles = 0;    /* The number of traces in that array */
     int tracenum;              /* Number of trace file to test (-t) */
     int singletrace = 0;       /* Are we testing one trace or all? (-t) */
+    char *benchfile = NULL;    /* Benchmark trace (-B) */
 
     struct stat statbuf;
 
@@ -91,13 +155,25 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "Ai:t:s:hVx")) != EOF) {
+    while ((c = getopt(argc, argv, "AB:F:i:j:R:t:s:hVx")) != EOF) {
         switch (c) {
 
 		case 'A': /* hidden Autolab driver argument */
 		    autograded = 1;
 		    break;
 
+		case 'B': /* Benchmark the shells on this trace */
+		    benchfile = strdup(optarg);
+		    break;
+
+		case 'F': /* Run this many random traces */
+		    fuzz_count = atoi(optarg);
+		    if (fuzz_count < 1) {
+				printf("Error: Invalid number of traces (-F)\n");
+				usage();
+		    }
+		    break;
+
 		case 'i': /* number of iterations to test each function */
 		    num_iters = atoi(optarg);
 		    if (num_iters < 1) {
@@ -106,6 +182,18 @@ int main(int argc, char **argv)
 		    }
 		    break;
 
+		case 'j': /* number of traces to run at once */
+		    num_jobs = atoi(optarg);
+		    if (num_jobs < 1) {
+				printf("Error: Invalid number of jobs (-j)\n");
+				usage();
+		    }
+		    break;
+
+		case 'R': /* Seed of the first random trace */
+		    fuzz_seed = strtoul(optarg, NULL, 0);
+		    break;
+
 		case 's':  /* The name of the test shell (default ./tsh) */
 		    shellprog = strdup(optarg);
 		    break;
@@ -152,27 +240,27 @@ int main(int argc, char **argv)
 		printf("Warning: -A flag is ignored when testing single traces\n");
     }
 
-    /* Get the current time stamp and PID */
-    current_time = (int) time(NULL);
-    pid = (int) getpid();
+    /* One slot per trace that may run at once */
+    num_runs = singletrace ? 1 : num_jobs;
+    if ((runs = calloc(num_runs, sizeof(struct trace_run))) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+    }
+    for (i = 0; i < num_runs; i++)
+		runs[i].trace = -1;
 
-    /* Generate some (truly) unique filenames in /usr/tmp */
-    sprintf(test_raw_outfile, 
-		    "/tmp/test_raw_outfile.%d.%d", current_time, pid);
-    sprintf(ref_raw_outfile, 
-		    "/tmp/ref_raw_outfile.%d.%d", current_time, pid);
-    sprintf(diff_raw_outfile, 
-		    "/tmp/diff_raw_outfile.%d.%d", current_time, pid);
+    /* Compare the speed of the shells */
+    if (benchfile) {
+		benchmark(benchfile);
+    }
 
-    sprintf(test_filtered_outfile, 
-		    "/tmp/test_filtered_outfile.%d.%d", current_time, pid);
-    sprintf(ref_filtered_outfile, 
-		    "/tmp/ref_filtered_outfile.%d.%d", current_time, pid);
-    sprintf(diff_filtered_outfile, 
-		    "/tmp/diff_filtered_outfile.%d.%d", current_time, pid);
+    /* Compare the shells on random traces */
+    else if (fuzz_count) {
+		fuzz(fuzz_count);
+    }
 
     /* Evaluate a single tracefile */
-    if (singletrace) {
+    else if (singletrace) {
 		printf("Running %s...\n", tracefiles[tracenum]);
 		fflush(stdout);
 		runtrace(tracefiles[tracenum]);
@@ -181,7 +269,12 @@ int main(int argc, char **argv)
     /* Evaluate all trace files */
     else {
 		num_correct = 0;
-		for (i = 0; i < num_tracefiles; i++) {
+		if (num_jobs > 1) {
+		    run_parallel(tracefiles, num_tracefiles, correct);
+		    for (i = 0; i < num_tracefiles; i++)
+				num_correct += correct[i];
+		}
+		else for (i = 0; i < num_tracefiles; i++) {
 		    if (num_iters > 1) 
 				printf("Running %d iters of %s\n", num_iters, tracefiles[i]);
 		    for (j = 0; j < num_iters; j++) {
@@ -215,8 +308,6 @@ int main(int argc, char **argv)
 		driver_post(NULL, autoresult, autograded, status);
     }
 
-    /* Clean up */
-    delete_tmpfiles();
     exit(0);
 }
 
@@ -226,121 +317,895 @@ int main(int argc, char **argv)
   */
 int runtrace(char *tracefile)
 { 
-    int status;
-    char buf[MAXBUF];
+    struct trace_run *tr = &runs[0];
+
+    start_trace(tr, tracefile);
+    while (tr->test.pid || tr->ref.pid)
+		wait_output();
+    return check_trace(tr, tracefile, stdout);
+}
+
+/*
+ * run_parallel - Run all trace files, num_jobs at a time. Each trace
+ *     runs its iterations one after another in its slot and stops at
+ *     the first failure, as in the serial loop. What would be printed
+ *     for a trace is kept until every trace before it is done, so the
+ *     report reads the same as a serial run.
+ */
+void run_parallel(char **tracefiles, int num_tracefiles, int *correct)
+{
+    int done[MAXTRACES];
+    struct trace_run *tr;
+    struct trace_out *o;
+    int next = 0, running = 0, ok, i;
+
+    for (i = 0; i < num_tracefiles; i++) {
+		done[i] = 0;
+		if ((report[i] = open_memstream(&report_buf[i], &report_len[i])) == NULL) {
+		    perror("open_memstream");
+		    exit(1);
+		}
+		num_reports++;
+    }
+
+    for (i = 0; i < num_runs && next < num_tracefiles; i++, next++) {
+		runs[i].trace = next;
+		runs[i].iter = 0;
+		running++;
+		start_reported(&runs[i], tracefiles[next], report[next]);
+    }
+
+    while (running > 0) {
+		/* Find the slot of the runtrace that finished */
+		o = wait_output();
+		for (i = 0, tr = NULL; i < num_runs; i++)
+		    if (o == &runs[i].test || o == &runs[i].ref)
+				tr = &runs[i];
+		if (tr == NULL || tr->test.pid || tr->ref.pid)
+		    continue;
+
+		/* Both shells are done: check, then go on in this slot */
+		ok = check_trace(tr, tracefiles[tr->trace], report[tr->trace]);
+		if (ok && tr->iter < num_iters) {
+		    start_reported(tr, tracefiles[tr->trace], report[tr->trace]);
+		    continue;
+		}
+		correct[tr->trace] = ok;
+		done[tr->trace] = 1;
+		if (next < num_tracefiles) {
+		    tr->trace = next++;
+		    tr->iter = 0;
+		    start_reported(tr, tracefiles[tr->trace], report[tr->trace]);
+		}
+		else {
+		    tr->trace = -1;
+		    running--;
+		}
+
+		/* Print the reports that are now in order */
+		while (num_printed < num_tracefiles && done[num_printed])
+		    print_report();
+    }
+}
+
+/*
+ * start_trace - Start the next iteration of tracefile in slot tr: the
+ *     test and the reference shell, both at once
+ */
+static void start_trace(struct trace_run *tr, char *tracefile)
+{
+    char *test_argv[] = { "./runtrace", "-s", shellprog, "-f", tracefile,
+			  sandboxing ? "-x" : NULL, NULL };
+    char *ref_argv[] = { "./runtrace", "-s", "./tshref", "-f", tracefile, NULL };
     struct stat statbuf;
 
     if (stat(tracefile, &statbuf) < 0) {
 		printf("%s: trace file not found", tracefile);
-		exit(1);
+		abort_runs();
     }
 
-    /* Run the student's test shell */
-    if (sandboxing)
-		sprintf(buf, "./runtrace -x -s %s -f %s > %s\n", 
-				shellprog, tracefile, test_raw_outfile);
+    tr->iter++;
+    start_runtrace(&tr->test, test_argv);
+    start_runtrace(&tr->ref, ref_argv);
+}
+/*
+ * start_reported - start_trace(), noting it in out as the serial
+ *                  loop in main would
+ */
+static void start_reported(struct trace_run *tr, char *tracefile, FILE *out)
+{
+    if (num_iters > 1 && tr->iter == 0)
+		fprintf(out, "Running %d iters of %s\n", num_iters, tracefile);
+    if (num_iters > 1)
+		fprintf(out, "%d. Running %s...\n", tr->iter+1, tracefile);
     else
-		sprintf(buf, "./runtrace -s %s -f %s > %s\n", 
-				shellprog, tracefile, test_raw_outfile);
+		fprintf(out, "Running %s...\n", tracefile);
+    start_trace(tr, tracefile);
+}
+
+/*
+ * start_runtrace - Run argv, a runtrace command, in a process group of
+ *     its own, with its output going to a pipe that o reads. No /bin/sh
+ *     is involved.
+ */
+static void start_runtrace(struct trace_out *o, char **argv)
+{
+    int fds[2];
 
-    if (system(buf) != 0) {
-		printf("sdriver unable to run %s\n", buf);
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+		perror("pipe");
+		abort_runs();
     }
-    
-    /* Run the reference shell */
-    sprintf(buf, "./runtrace -s ./tshref -f %s > %s\n", 
-		    tracefile, ref_raw_outfile);
-    if (system(buf) != 0) {
-		emit_file(ref_raw_outfile);
-		printf("sdriver unable to run %s\n", buf);
-		delete_tmpfiles();
-		exit(1);
+    if ((o->pid = fork()) < 0) {
+		perror("fork");
+		abort_runs();
     }
-    
-    /* Filter the test and reference outputs */
-    sprintf(buf, "perl -e '%s' < %s | sort > %s", 
-		    PERLPROG, test_raw_outfile, test_filtered_outfile);
-    system(buf);
-    
-    sprintf(buf, "perl -e '%s' < %s | sort > %s", 
-		    PERLPROG, ref_raw_outfile, ref_filtered_outfile);
-    system(buf);
-    
-    /* Diff the filtered output files */
-    sprintf(buf, "diff %s %s > %s\n", 
-		    test_filtered_outfile, ref_filtered_outfile, diff_filtered_outfile);
-    status = system(buf);
-    
-    /* Filtered output files were different */
-    if (status != 0) {
-		sprintf(buf, "diff %s %s > %s\n", 
-				test_raw_outfile, ref_raw_outfile, diff_raw_outfile);
-		system(buf);
+    if (o->pid == 0) {
+		setpgid(0, 0);
+		if (dup2(fds[1], STDOUT_FILENO) < 0) {
+		    perror("dup2");
+		    _exit(1);
+		}
+		execv(argv[0], argv);
+		perror(argv[0]);
+		_exit(1);
+    }
+    setpgid(o->pid, o->pid);
+    close(fds[1]);
+
+    /* The pidfd tells us it is done even if a job it left behind
+     * still holds the pipe open */
+    if ((o->pidfd = syscall(SYS_pidfd_open, o->pid, 0)) < 0) {
+		perror("pidfd_open");
+		abort_runs();
+    }
+    o->fd = fds[0];
+    fcntl(o->fd, F_SETFL, O_NONBLOCK);
+    o->len = 0;
+    if (o->buf == NULL && (o->buf = malloc(o->cap = MAXBUF)) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		abort_runs();
+    }
+    o->buf[0] = '\0';
+}
+
+/*
+ * wait_output - Read the output of every runtrace still running until
+ *     one of them exits. Returns that one, reaped, with all that it
+ *     printed in its buffer.
+ */
+static struct trace_out *wait_output(void)
+{
+    static struct pollfd *fds;
+    static struct trace_out **who;
+    struct trace_out *outs[2];
+    int i, k, n;
 
-		printf("Oops: test and reference outputs for %s differed.\n", 
+    if (fds == NULL && ((fds = malloc(4 * num_runs * sizeof(struct pollfd))) == NULL ||
+						(who = malloc(4 * num_runs * sizeof(struct trace_out *))) == NULL)) {
+		fprintf(stderr, "Out of memory\n");
+		abort_runs();
+    }
+
+    while (1) {
+		for (i = n = 0; i < num_runs; i++) {
+		    outs[0] = &runs[i].test;
+		    outs[1] = &runs[i].ref;
+		    for (k = 0; k < 2; k++) {
+				if (outs[k]->pid == 0)
+				    continue;
+				if (outs[k]->fd >= 0) {
+				    fds[n].fd = outs[k]->fd;
+				    fds[n].events = POLLIN;
+				    who[n++] = outs[k];
+				}
+				fds[n].fd = outs[k]->pidfd;
+				fds[n].events = POLLIN;
+				who[n++] = outs[k];
+		    }
+		}
+		if (n == 0)
+		    return NULL;
+		if (poll(fds, n, -1) < 0) {
+		    if (errno == EINTR)
+				continue;
+		    perror("poll");
+		    abort_runs();
+		}
+
+		for (i = 0; i < n; i++) {
+		    if (fds[i].revents == 0)
+				continue;
+		    if (fds[i].fd == who[i]->fd) {
+				read_output(who[i]);
+				continue;
+		    }
+
+		    /* It has exited: what it wrote is all in the pipe now */
+		    read_output(who[i]);
+		    if (who[i]->fd >= 0) {
+				close(who[i]->fd);
+				who[i]->fd = -1;
+		    }
+		    while (waitpid(who[i]->pid, &who[i]->status, 0) < 0) {
+				if (errno != EINTR) {
+				    perror("waitpid");
+				    abort_runs();
+				}
+		    }
+		    close(who[i]->pidfd);
+		    who[i]->pid = 0;
+		    return who[i];
+		}
+    }
+}
+
+/*
+ * read_output - Append what can be read from the pipe of o to its
+ *     buffer without blocking, closing the pipe at EOF
+ */
+static void read_output(struct trace_out *o)
+{
+    ssize_t n;
+
+    while (o->fd >= 0) {
+		if (o->cap - o->len < MAXBUF &&
+		    (o->buf = realloc(o->buf, o->cap *= 2)) == NULL) {
+		    fprintf(stderr, "Out of memory\n");
+		    abort_runs();
+		}
+		if ((n = read(o->fd, o->buf + o->len, o->cap - o->len - 1)) < 0) {
+		    if (errno == EINTR)
+				continue;
+		    if (errno != EAGAIN) {
+				perror("read");
+				abort_runs();
+		    }
+		    break;
+		}
+		if (n == 0) {
+		    close(o->fd);
+		    o->fd = -1;
+		}
+		o->len += n;
+		o->buf[o->len] = '\0';
+    }
+}
+
+/*
+ * check_trace - Compare the outputs of the iteration of tracefile that
+ *     just finished in slot tr, reporting to out.
+ *     Return 0 if results are different, 1 if identical
+ */
+static int check_trace(struct trace_run *tr, char *tracefile, FILE *out)
+{ 
+    if (!WIFEXITED(tr->test.status) || WEXITSTATUS(tr->test.status) != 0) {
+		fprintf(out, "sdriver unable to run ./runtrace -s %s -f %s\n",
+				shellprog, tracefile);
+    }
+    if (!WIFEXITED(tr->ref.status) || WEXITSTATUS(tr->ref.status) != 0) {
+		while (num_printed < num_reports && report[num_printed] != out)
+		    print_report();
+		if (out != stdout)
+		    print_report();
+		num_reports = num_printed;      /* Later traces are cut short */
+		emit_output(stdout, &tr->ref);
+		printf("sdriver unable to run ./runtrace -s ./tshref -f %s\n",
 		       tracefile);
-		printf("\n");
+		abort_runs();
+    }
 
-		printf("Test output:\n");
-		emit_file(test_raw_outfile);
-		printf("\n");
+    /* Filtered outputs were different */
+    if (!same_output(&tr->test, &tr->ref)) {
+		fprintf(out, "Oops: test and reference outputs for %s differed.\n", 
+		       tracefile);
+		fprintf(out, "\n");
 
-		printf("Reference output:\n");
-		emit_file(ref_raw_outfile);
-		printf("\n");
+		fprintf(out, "Test output:\n");
+		emit_output(out, &tr->test);
+		fprintf(out, "\n");
 
-		printf("Output of 'diff test reference':\n");
-		emit_file(diff_raw_outfile);
-		printf("\n");
+		fprintf(out, "Reference output:\n");
+		emit_output(out, &tr->ref);
+		fprintf(out, "\n");
+
+		fprintf(out, "Output of 'diff -u test reference':\n");
+		emit_diff(out, &tr->test, &tr->ref);
+		fprintf(out, "\n");
 
 		return 0;
-}
+    }
     
-    /* Filtered output files were identical */
+    /* Filtered outputs were identical */
     if (verbose) {
-		printf("Success: The test and reference outputs for %s matched!\n", tracefile);
+		fprintf(out, "Success: The test and reference outputs for %s matched!\n", tracefile);
     }
     if (verbose > 1) {
-		printf("Test output:\n");
-		emit_file(test_raw_outfile);
-		printf("\n");
-		printf("Reference output:\n");
-		fflush(stdout);
-		emit_file(ref_raw_outfile);
-		printf("\n");
+		fprintf(out, "Test output:\n");
+		emit_output(out, &tr->test);
+		fprintf(out, "\n");
+		fprintf(out, "Reference output:\n");
+		emit_output(out, &tr->ref);
+		fprintf(out, "\n");
+    }
+
+    return 1;
+}
+
+/*
+ * abort_runs - Kill every runtrace still running, clean up and exit
+ */
+static void abort_runs(void)
+{
+    int i;
+
+    for (i = 0; i < num_runs; i++) {
+		if (runs[i].test.pid)
+		    kill(-runs[i].test.pid, SIGKILL);
+		if (runs[i].ref.pid)
+		    kill(-runs[i].ref.pid, SIGKILL);
     }
+    while (num_printed < num_reports)
+		print_report();
+    exit(1);
+}
+
+/*
+ * print_report - Print the next held report of run_parallel()
+ */
+static void print_report(void)
+{
+    fclose(report[num_printed]);
+    fflush(stdout);
+    fwrite(report_buf[num_printed], 1, report_len[num_printed], stdout);
+    fflush(stdout);
+    free(report_buf[num_printed]);
+    num_printed++;
+}
+
+/*
+ * same_output - Do two outputs match once each is filtered so that
+ *     outputs of different runs of different shells can be compared?
+ *
+ * (1) Elides all whitespace. 
+ * (2) Converts PIDs of the form "(12345)" to "(PID)". 
+ *
+ * The filtered outputs are compared as they are produced, a character
+ * at a time, so they are never built.
+ */
+static int same_output(struct trace_out *a, struct trace_out *b)
+{
+    const char *p = a->buf, *q = b->buf, *p_pid = NULL, *q_pid = NULL;
+    int c;
 
+    do {
+		c = next_filtered(&p, &p_pid);
+		if (c != next_filtered(&q, &q_pid))
+		    return 0;
+    } while (c != '\0');
     return 1;
 }
 
 /*
- * emit_file - prints an ascii file to stdout
+ * next_filtered - Return the next character of the filtered output at
+ *     *p, or '\0' at its end. *pid holds what is left to return of a
+ *     "PID)" that replaced a process ID.
+ */
+static int next_filtered(const char **p, const char **pid)
+{
+    const char *q;
+
+    if (*pid != NULL && **pid != '\0')
+		return *(*pid)++;
+    while (isspace((unsigned char)**p))
+		(*p)++;
+    if (**p == '(') {
+		for (q = *p + 1; isspace((unsigned char)*q); q++)
+		    ;
+		if (isdigit((unsigned char)*q)) {
+		    while (isdigit((unsigned char)*q) || isspace((unsigned char)*q))
+				q++;
+		    if (*q == ')') {
+				*p = q + 1;
+				*pid = "PID)";
+				return '(';
+		    }
+		}
+    }
+    if (**p == '\0')
+		return '\0';
+    return *(*p)++;
+}
+
+/*
+ * emit_output - prints what a runtrace printed to out
+ */
+static void emit_output(FILE *out, struct trace_out *o)
+{
+    fwrite(o->buf, 1, o->len, out);
+}
+
+/*
+ * emit_diff - Print the differences between two outputs to out, in
+ *     the unified format of "diff -u", with three lines of context.
+ *     Lines are compared once filtered as by same_output(), so that
+ *     only lines that made the outputs differ are marked.
+ */
+static void emit_diff(FILE *out, struct trace_out *a, struct trace_out *b)
+{
+    struct line *la, *lb;
+    char *ops;
+    int n, m, nops, i, j, k, x, y, end, alen, blen;
+
+    la = split_lines(a->buf, a->len, &n);
+    lb = split_lines(b->buf, b->len, &m);
+    ops = diff_ops(la, n, lb, m, &nops);
+
+    fprintf(out, "--- test\n+++ reference\n");
+    x = y = 0;                      /* Lines of a and b at ops[i] */
+    for (i = 0; i < nops; ) {
+		if (ops[i] == ' ') {
+		    x++, y++, i++;
+		    continue;
+		}
+
+		/* A hunk: back up 3 lines, then go on until 7 unchanged in a row */
+		k = (i < 3) ? 0 : i - 3;
+		x -= i - k, y -= i - k;
+		for (end = i; end < nops; end++) {
+		    for (j = end; j < nops && j < end + 7 && ops[j] == ' '; j++)
+				;
+		    if (j == nops || j == end + 7)
+				break;
+		    end = j;
+		}
+		end = (end + 3 < nops) ? end + 3 : nops;
+		for (j = k, alen = blen = 0; j < end; j++) {
+		    alen += ops[j] != '+';
+		    blen += ops[j] != '-';
+		}
+
+		fprintf(out, "@@ -%d", alen ? x + 1 : x);
+		if (alen != 1)
+		    fprintf(out, ",%d", alen);
+		fprintf(out, " +%d", blen ? y + 1 : y);
+		if (blen != 1)
+		    fprintf(out, ",%d", blen);
+		fprintf(out, " @@\n");
+		for (j = k; j < end; j++) {
+		    if (ops[j] == '+')
+				fprintf(out, "+%.*s\n", lb[y].len, lb[y].s), y++;
+		    else {
+				fprintf(out, "%c%.*s\n", ops[j], la[x].len, la[x].s), x++;
+				y += ops[j] == ' ';
+		    }
+		}
+		i = end;
+    }
+
+    free(ops);
+    free_lines(la, n);
+    free_lines(lb, m);
+}
+
+/*
+ * diff_ops - Find a shortest edit script from a to b (Myers' O(ND)
+ *     algorithm) and return it as one op per line: ' ' for a line in
+ *     both, '-' for one only in a and '+' for one only in b. The
+ *     caller frees it.
+ */
+static char *diff_ops(struct line *a, int n, struct line *b, int m, int *nops)
+{
+    int max = n + m, d, k, x, y, px, pk, i;
+    int *v, **rows;
+    char *ops;
+
+#define SAME(x, y) (!strcmp(a[x].key, b[y].key))
+    /* v[k] is the furthest x reached on diagonal k = x - y; rows[d] is
+     * v for -d <= k <= d after d edits, to trace the path back */
+    if ((v = malloc((2 * max + 3) * sizeof(int))) == NULL ||
+		(rows = malloc((max + 1) * sizeof(int *))) == NULL ||
+		(ops = malloc(max + 1)) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		abort_runs();
+    }
+    v += max + 1;
+    v[1] = 0;
+    for (d = 0; d <= max; d++) {
+		for (k = -d; k <= d; k += 2) {
+		    if (k == -d || (k != d && v[k-1] < v[k+1]))
+				x = v[k+1];
+		    else
+				x = v[k-1] + 1;
+		    for (y = x - k; x < n && y < m && SAME(x, y); x++, y++)
+				;
+		    v[k] = x;
+		    if (x >= n && y >= m)
+				goto found;
+		}
+		if ((rows[d] = malloc((2 * d + 1) * sizeof(int))) == NULL) {
+		    fprintf(stderr, "Out of memory\n");
+		    abort_runs();
+		}
+		memcpy(rows[d], v - d, (2 * d + 1) * sizeof(int));
+		rows[d] += d;
+    }
+#undef SAME
+
+ found:
+    /* Back from (n, m), an edit and the snake before it at a time */
+    i = max;
+    x = n, y = m;
+    for (; d > 0; d--) {
+		k = x - y;
+		if (k == -d || (k != d && rows[d-1][k-1] < rows[d-1][k+1]))
+		    pk = k + 1;
+		else
+		    pk = k - 1;
+		px = rows[d-1][pk];
+		for (; x > px && y > px - pk; x--, y--)
+		    ops[--i] = ' ';
+		if (pk == k + 1)
+		    ops[--i] = '+', y--;
+		else
+		    ops[--i] = '-', x--;
+		free(rows[d-1] - (d-1));
+    }
+    for (; x > 0; x--)
+		ops[--i] = ' ';
+
+    *nops = max - i;
+    memmove(ops, ops + i, *nops);
+    free(v - (max + 1));
+    free(rows);
+    return ops;
+}
+
+/*
+ * split_lines - Return the lines of the len bytes at buf, without
+ *     their newlines, each with its filtered key. The caller frees
+ *     them with free_lines().
+ */
+static struct line *split_lines(char *buf, size_t len, int *nlines)
+{
+    struct line *lines = NULL;
+    char *p, *end = buf + len, *nl;
+    int n = 0, max = 0;
+
+    for (p = buf; p < end; p = nl + 1) {
+		if (n == max) {
+		    max = max ? 2 * max : 64;
+		    if ((lines = realloc(lines, max * sizeof(struct line))) == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				abort_runs();
+		    }
+		}
+		if ((nl = memchr(p, '\n', end - p)) == NULL)
+		    nl = end;
+		lines[n].s = p;
+		lines[n].len = nl - p;
+		lines[n++].key = filter_line(p, nl - p);
+    }
+    *nlines = n;
+    return lines;
+}
+
+/*
+ * filter_line - Return the len bytes at s filtered as by same_output(),
+ *     NUL-terminated. "(1)" grows to "(PID)", so the result may be up
+ *     to 5/3 as long as the line.
+ */
+static char *filter_line(const char *s, int len)
+{
+    char *line, *key;
+    const char *p, *pid = NULL;
+    int i = 0;
+
+    if ((line = malloc(len + 1)) == NULL ||
+		(key = malloc(2 * len + 1)) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		abort_runs();
+    }
+    memcpy(line, s, len);
+    line[len] = '\0';
+    for (p = line; (key[i] = next_filtered(&p, &pid)) != '\0'; i++)
+		;
+    free(line);
+    return key;
+}
+
+/* free_lines - Free the n lines returned by split_lines() */
+static void free_lines(struct line *lines, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+		free(lines[i].key);
+    free(lines);
+}
+
+/*
+ * benchmark - Run tracefile under "runtrace -B" on each shell in turn
+ *     and print the latencies of each phase, one row per shell. A
+ *     shell that cannot get through a phase (/bin/sh has no job
+ *     control without a terminal) reports it as incomplete.
  */
-void emit_file(char *filename) 
+static void benchmark(char *tracefile)
 {
+    static struct {
+		char *name, *arg;
+		char *buf;
+		struct line *lines;
+		int nlines, status;
+    } shells[] = {
+		{ NULL, NULL }, { "./tshref", NULL }, { "/bin/sh", "-i" },
+    };
+    int nshells = sizeof(shells) / sizeof(shells[0]);
+    int i, j, k, n, count, most = 0;
+    char name[MAXBUF];
+
+    shells[0].name = shellprog;
+    for (i = 0; i < nshells; i++) {
+		printf("Running %s on %s...\n", tracefile, shells[i].name);
+		fflush(stdout);
+		shells[i].status = bench_shell(shells[i].name, shells[i].arg, tracefile);
+
+		/* Keep its output, as NUL-terminated lines */
+		shells[i].buf = runs[0].test.buf;
+		shells[i].lines = split_lines(runs[0].test.buf, runs[0].test.len,
+									  &shells[i].nlines);
+		for (k = 0; k < shells[i].nlines; k++)
+		    shells[i].lines[k].s[shells[i].lines[k].len] = '\0';
+		runs[0].test.buf = NULL;
+		if (shells[i].nlines > shells[most].nlines)
+		    most = i;
+    }
+
+    /* Phases in the order of the shell that got furthest */
+    printf("\n%-14s %-10s %6s %9s %9s %9s %9s %9s (us)\n",
+		   "phase", "shell", "n", "mean", "p50", "p90", "p99", "max");
+    for (j = 0; j < shells[most].nlines; j++) {
+		if (shells[most].lines[j].s[0] == '#' ||
+			sscanf(shells[most].lines[j].s, "%s %d", name, &count) != 2)
+		    continue;
+		for (i = 0; i < nshells; i++) {
+		    printf("%-14s %-10s ", i == 0 ? name : "", shells[i].name);
+		    for (k = 0; k < shells[i].nlines; k++)
+				if (sscanf(shells[i].lines[k].s, "%s %d%n", name + MAXBUF/2,
+						   &count, &n) == 2 && !strcmp(name, name + MAXBUF/2))
+				    break;
+		    if (k < shells[i].nlines)
+				printf("%6d%s\n", count, shells[i].lines[k].s + n);
+		    else
+				printf("%6s\n", "-");
+		}
+    }
+
+    for (i = 0; i < nshells; i++) {
+		if (shells[i].status != 0)
+		    printf("Note: %s did not finish the trace (%s)\n", shells[i].name,
+				   shells[i].status < 0 ? "not executable" : "runtrace failed");
+		free(shells[i].lines);
+		free(shells[i].buf);
+    }
+}
+
+/*
+ * bench_shell - Run "./runtrace -B -s shell [-a arg] -f tracefile"
+ *     with its output read into runs[0].test. Returns its exit status,
+ *     or -1 if the shell is not executable.
+ */
+static int bench_shell(char *shell, char *arg, char *tracefile)
+{
+    char *argv[] = { "./runtrace", "-B", "-s", shell, "-f", tracefile,
+		     arg ? "-a" : NULL, arg, NULL };
+    struct trace_out *o = &runs[0].test;
+
+    if (access(shell, X_OK) < 0) {
+		if (o->buf == NULL && (o->buf = malloc(o->cap = MAXBUF)) == NULL) {
+		    fprintf(stderr, "Out of memory\n");
+		    abort_runs();
+		}
+		o->buf[o->len = 0] = '\0';
+		return -1;
+    }
+    start_runtrace(o, argv);
+    while (o->pid)
+		wait_output();
+    return WIFEXITED(o->status) ? WEXITSTATUS(o->status) : 1;
+}
+
+/*
+ * fuzz - Run count random traces, num_jobs at a time, on the test
+ *     shell and tshref, and report each that does not run to the end
+ *     or whose outputs differ, followed by the trace. The traces are
+ *     made in memory (memfd) and read by runtrace through /proc.
+ */
+static void fuzz(int count)
+{
+    char *text[num_runs], path[MAXBUF], name[MAXBUF];
+    int fds[num_runs];
+    struct trace_run *tr;
+    struct trace_out *o;
+    struct timespec t0, t1;
+    int next = 0, running = 0, failed = 0, i;
+    size_t len;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (next < count || running > 0) {
+		/* Start a trace in every free slot */
+		for (i = 0; i < num_runs && next < count; i++) {
+		    if (runs[i].trace >= 0)
+				continue;
+		    text[i] = make_trace(fuzz_seed + next);
+		    len = strlen(text[i]);
+		    if ((fds[i] = memfd_create("trace", MFD_CLOEXEC)) < 0 ||
+				write(fds[i], text[i], len) != len) {
+				perror("memfd");
+				abort_runs();
+		    }
+		    sprintf(path, "/proc/%d/fd/%d", (int)getpid(), fds[i]);
+		    runs[i].trace = next++;
+		    runs[i].iter = 0;
+		    running++;
+		    start_trace(&runs[i], path);
+		}
+
+		/* Find the slot of the runtrace that finished */
+		o = wait_output();
+		for (i = 0, tr = NULL; i < num_runs; i++)
+		    if (o == &runs[i].test || o == &runs[i].ref)
+				tr = &runs[i];
+		if (tr == NULL || tr->test.pid || tr->ref.pid)
+		    continue;
+
+		i = tr - runs;
+		sprintf(name, "random trace %u", fuzz_seed + tr->trace);
+		if (verbose > 0)
+		    printf("Running %s...\n", name);
+		if (!check_trace(tr, name, stdout)) {
+		    printf("Trace (sdriver -F 1 -R %u):\n%s\n",
+				   fuzz_seed + tr->trace, text[i]);
+		    failed++;
+		}
+		fflush(stdout);
+		close(fds[i]);
+		free(text[i]);
+		tr->trace = -1;
+		running--;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("Summary: %d/%d random traces matched, %.1f traces/s\n",
+		   count - failed, count, count / (t1.tv_sec - t0.tv_sec +
+										   (t1.tv_nsec - t0.tv_nsec) / 1e9));
+}
+
+/*
+ * make_trace - Return a random trace made from seed, which the caller
+ *     frees. It uses only what tshref has: jobs, fg and bg, the helper
+ *     programs in the foreground and background, and ctrl-c and
+ *     ctrl-z from the driver. The jobs are followed as the shells
+ *     should number them, so that each WAIT is met and fg and bg are
+ *     only given a job that will not hold up the trace; they get a bad
+ *     argument otherwise.
+ */
+static char *make_trace(unsigned seed)
+{
+    enum { SPIN, STOPPED_EXITS, STOPPED_SPINS, STOPPED_SPLIT, RUNNING };
+    struct { int jid, kind; } jobs[8];
+    static char *bad[] = { "", " %9", " abc", " %x", " 99999" };
+    int njobs = 0, spins = 0, steps, i, jid;
+    unsigned r = seed ? seed : 1;
+    char cmd[MAXBUF], *buf;
+    size_t len;
     FILE *fp;
-    char buf[MAXBUF];
 
-    if ((fp = fopen(filename, "r")) == NULL) {
-		printf("fopen error: Unable to open file %s\n", filename);
-		exit(1);
+/* xorshift32 */
+#define RAND(n) (int)(xorshift(&r) % (n))
+    if ((fp = open_memstream(&buf, &len)) == NULL) {
+		perror("open_memstream");
+		abort_runs();
     }
-    while(fgets(buf, MAXBUF, fp)) {
-		printf("%s", buf);
+    fprintf(fp, "#\n# Random trace %u\n#\n", seed);
+    for (steps = 3 + RAND(10); steps > 0; steps--) {
+		for (i = 0, jid = 1; i < njobs; i++)
+		    if (jobs[i].jid >= jid)
+				jid = jobs[i].jid + 1;
+		jobs[njobs].jid = jid;
+
+		switch (RAND(8)) {
+		case 0:                 /* a background job, until SIGNAL */
+		    if (njobs == 8)
+				break;
+		    trace_command(fp, "./myspin1 10 &");
+		    fprintf(fp, "WAIT\n");
+		    jobs[njobs++].kind = SPIN;
+		    spins++;
+		    break;
+
+		case 1:                 /* a job that is killed by ctrl-c */
+		    trace_command(fp, "./myintp");
+		    break;
+
+		case 2:                 /* jobs that are stopped by ctrl-z */
+		case 3:
+		    if (njobs == 8)
+				break;
+		    trace_command(fp, (steps & 1) ? "./mytstps" : "./mytstpp");
+		    jobs[njobs++].kind = (steps & 1) ? STOPPED_EXITS : STOPPED_SPINS;
+		    break;
+
+		case 4:                 /* ctrl-c or ctrl-z from the driver */
+		    if (njobs == 8)
+				break;
+		    fprintf(fp, "\n/bin/echo -e tsh\\076 ./mysplit 10\nNEXT\n"
+				    "./mysplit 10\nWAIT\n");
+		    if (RAND(2)) {
+				fprintf(fp, "SIGTSTP\nNEXT\n");
+				jobs[njobs++].kind = STOPPED_SPLIT;
+		    }
+		    else
+				fprintf(fp, "SIGINT\nNEXT\n");
+		    break;
+
+		case 5:
+		case 6:
+		    trace_command(fp, "jobs");
+		    break;
+
+		case 7:                 /* fg or bg */
+		    i = njobs ? RAND(njobs) : -1;
+		    if (i >= 0 && jobs[i].kind == STOPPED_EXITS && RAND(2)) {
+				sprintf(cmd, "fg %%%d", jobs[i].jid);
+				jobs[i] = jobs[--njobs];
+		    }
+		    else if (i >= 0 && jobs[i].kind == STOPPED_SPINS) {
+				sprintf(cmd, "bg %%%d", jobs[i].jid);
+				jobs[i].kind = RUNNING;
+		    }
+		    else
+				sprintf(cmd, "%s%s", RAND(2) ? "fg" : "bg",
+						bad[RAND(sizeof(bad) / sizeof(bad[0]))]);
+		    trace_command(fp, cmd);
+		    break;
+		}
     }
+#undef RAND
+
+    for (i = 0; i < spins; i++)
+		fprintf(fp, "SIGNAL\n");
+    trace_command(fp, "quit");
     fclose(fp);
+    return buf;
 }
 
 /*
- * delete_tmpfiles - Clean up the temp files we created during testing
+ * trace_command - Write cmd to a trace, after a line that echoes it
+ *     behind the prompt, as the trace files do
  */
-void delete_tmpfiles()
+static void trace_command(FILE *fp, char *cmd)
+{
+    char *p;
+
+    fprintf(fp, "\n/bin/echo -e tsh\\076 ");
+    for (p = cmd; *p; p++) {
+		if (*p == '&' || *p == '<' || *p == '>')
+		    fprintf(fp, "\\%03o", *p);
+		else
+		    fputc(*p, fp);
+    }
+    fprintf(fp, "\nNEXT\n%s\n", cmd);
+    if (strcmp(cmd, "quit"))
+		fprintf(fp, "NEXT\n");
+}
+
+/* xorshift - Next number of the xorshift32 generator in *r */
+static unsigned xorshift(unsigned *r)
 {
-    char buf[MAXBUF];
-    sprintf(buf, "rm -rf %s %s %s %s %s %s",
-		    test_raw_outfile, ref_raw_outfile, diff_raw_outfile,
-		    test_filtered_outfile, ref_filtered_outfile, diff_filtered_outfile);
-    system(buf);
+    *r ^= *r << 13;
+    *r ^= *r >> 17;
+    *r ^= *r << 5;
+    return *r;
 }
 
 /* 
@@ -348,11 +1213,16 @@ void delete_tmpfiles()
  */
 void usage(void) 
 {
-    printf("Usage: sdriver [-hV] [-s <shell> -t <tracenum> -i <iters>]\n");
+    printf("Usage: sdriver [-hV] [-s <shell> -t <tracenum> -i <iters> -j <n>] [-B <trace>]\n"
+		   "               [-F <n> [-R <seed>]]\n");
     printf("Options\n");
+    printf("\t-B <trace>   Time <trace> on the test shell, tshref and /bin/sh\n");
+    printf("\t-F <n>       Run <n> random traces on the test shell and tshref\n");
     printf("\t-h           Print this message.\n");
     printf("\t-i <iters>   Run each trace <iters> times (default %d)\n", 
 		   num_iters);
+    printf("\t-j <n>       Run <n> traces at once (default 1)\n");
+    printf("\t-R <seed>    Seed of the first random trace (default 1)\n");
     printf("\t-s <shell>   Name of test shell (default ./tsh)\n");
     printf("\t-t <n>       Run trace <n> only (default all)\n");
     printf("\t-V           Be more verbose.\n");
@@ -0,0 +1,275 @@
+/*
+ * spawnbench - Time starting a job from a shell with a large heap
+ *
+ * Runs /bin/true in a process group of its own and waits for it, as
+ * tsh does for a foreground job, three ways:
+ *
+ *   fork     fork() and execve(), which copies the page tables of the
+ *            whole heap, only for exec to throw them away
+ *   spawn    posix_spawn(), as tsh uses; glibc creates the child with
+ *            clone(CLONE_VM|CLONE_VFORK), so nothing is copied
+ *   zygote   a helper forked before the heap grew is sent argv, the
+ *            process group and the stdio descriptors (SCM_RIGHTS)
+ *            over a UNIX socket, and forks from its own small address
+ *            space. CLONE_PARENT makes the job a child of the shell,
+ *            so that the shell can still wait for it.
+ *
+ * Each is timed with heaps of 0, 64, 256 and 1024 MB (-m sets the
+ * largest), touched so that they are resident.
+ *
+ * Usage: spawnbench [-n <iters>] [-m <max MB>]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#define MAXLINE 1024
+
+extern char **environ;
+
+static char *prog = "/bin/true";
+static int zygote_fd = -1;
+
+static pid_t run_fork(void);
+static pid_t run_spawn(void);
+static pid_t run_zygote(void);
+static void zygote(int fd);
+static double bench(pid_t (*run)(void), int iters);
+static double now(void);
+static void unix_error(char *msg);
+
+int main(int argc, char **argv)
+{
+	static const long sizes[] = { 0, 64, 256, 1024 };
+	int c, i, iters = 200, sv[2];
+	long max_mb = 1024, mb, have = 0;
+	char *heap = NULL;
+	pid_t pid;
+
+	while ((c = getopt(argc, argv, "n:m:")) != -1) {
+		switch (c) {
+		case 'n':
+			iters = atoi(optarg);
+			break;
+		case 'm':
+			max_mb = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n <iters>] [-m <max MB>]\n", argv[0]);
+			exit(1);
+		}
+	}
+
+	/* The zygote starts while this process is still small */
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0)
+		unix_error("socketpair error");
+	if ((pid = fork()) < 0)
+		unix_error("fork error");
+	if (pid == 0) {
+		close(sv[0]);
+		zygote(sv[1]);
+	}
+	close(sv[1]);
+	zygote_fd = sv[0];
+
+	printf("%d runs of %s, mean us per job\n", iters, prog);
+	printf("%8s %10s %10s %10s\n", "heap MB", "fork", "spawn", "zygote");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if ((mb = sizes[i] < max_mb ? sizes[i] : max_mb) < have)
+			break;
+		if (mb > have) {
+			if ((heap = realloc(heap, mb << 20)) == NULL)
+				unix_error("realloc error");
+			memset(heap + (have << 20), 1, (mb - have) << 20);
+			have = mb;
+		}
+		printf("%8ld %10.1f %10.1f %10.1f\n", mb, bench(run_fork, iters),
+				bench(run_spawn, iters), bench(run_zygote, iters));
+		fflush(stdout);
+		if (mb == max_mb)
+			break;
+	}
+
+	close(zygote_fd);
+	wait(NULL);
+	exit(0);
+}
+
+/*
+ * bench - Start and reap a job iters times; returns the mean in us
+ */
+static double bench(pid_t (*run)(void), int iters)
+{
+	double start = now();
+	int i, status;
+	pid_t pid;
+
+	for (i = 0; i < iters; i++) {
+		pid = run();
+		if (waitpid(pid, &status, 0) < 0)
+			unix_error("waitpid error");
+	}
+	return (now() - start) * 1e6 / iters;
+}
+
+/* run_fork - Start the job with fork() and execve() */
+static pid_t run_fork(void)
+{
+	char *argv[] = { prog, NULL };
+	pid_t pid;
+
+	if ((pid = fork()) < 0)
+		unix_error("fork error");
+	if (pid == 0) {
+		setpgid(0, 0);
+		execve(prog, argv, environ);
+		_exit(127);
+	}
+	setpgid(pid, pid);
+	return pid;
+}
+
+/* run_spawn - Start the job with posix_spawn(), as tsh does */
+static pid_t run_spawn(void)
+{
+	char *argv[] = { prog, NULL };
+	posix_spawnattr_t attr;
+	pid_t pid;
+	int err;
+
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+	posix_spawnattr_setpgroup(&attr, 0);
+	err = posix_spawn(&pid, prog, NULL, &attr, argv, environ);
+	posix_spawnattr_destroy(&attr);
+	if (err != 0) {
+		errno = err;
+		unix_error("posix_spawn error");
+	}
+	return pid;
+}
+
+/*
+ * run_zygote - Have the zygote start the job. The request is the
+ *     process group (0 for a new one) and the NUL-separated argv, with
+ *     the job's stdin, stdout and stderr attached; the reply is the PID.
+ */
+static pid_t run_zygote(void)
+{
+	char buf[MAXLINE], cbuf[CMSG_SPACE(3 * sizeof(int))];
+	struct msghdr msg = { 0 };
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	int fds[3] = { 0, 1, 2 };
+	pid_t pgid = 0, pid;
+	size_t len;
+
+	memcpy(buf, &pgid, sizeof(pgid));
+	len = sizeof(pgid);
+	strcpy(buf + len, prog);
+	len += strlen(prog) + 1;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	if (sendmsg(zygote_fd, &msg, 0) < 0)
+		unix_error("sendmsg error");
+	if (recv(zygote_fd, &pid, sizeof(pid), 0) != sizeof(pid))
+		unix_error("recv error");
+	if (pid < 0) {
+		errno = -pid;
+		unix_error("zygote error");
+	}
+	return pid;
+}
+
+/*
+ * zygote - Serve spawn requests on fd until it is closed. The jobs are
+ *     created with CLONE_PARENT, so they are our parent's children.
+ */
+static void zygote(int fd)
+{
+	char buf[MAXLINE], cbuf[CMSG_SPACE(3 * sizeof(int))];
+	char *argv[MAXLINE / 2];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	int fds[3], i, argc;
+	ssize_t n;
+	char *p;
+	pid_t pgid, pid;
+
+	while (1) {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf;
+		iov.iov_len = sizeof(buf) - 1;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cbuf;
+		msg.msg_controllen = sizeof(cbuf);
+		if ((n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) <= 0)
+			_exit(0);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		if (n < sizeof(pgid) + 1 || cmsg == NULL ||
+				cmsg->cmsg_type != SCM_RIGHTS ||
+				cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+			_exit(1);
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+		memcpy(&pgid, buf, sizeof(pgid));
+		buf[n] = '\0';
+		for (argc = 0, p = buf + sizeof(pgid); p < buf + n &&
+				argc < MAXLINE / 2 - 1; p += strlen(p) + 1)
+			argv[argc++] = p;
+		argv[argc] = NULL;
+
+		pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL, NULL, 0);
+		if (pid == 0) {
+			for (i = 0; i < 3; i++)
+				dup2(fds[i], i);
+			setpgid(0, pgid);
+			execve(argv[0], argv, environ);
+			_exit(127);
+		}
+		if (pid < 0)
+			pid = -errno;
+		for (i = 0; i < 3; i++)
+			close(fds[i]);
+		if (send(fd, &pid, sizeof(pid), 0) < 0)
+			_exit(1);
+	}
+}
+
+/* now - Monotonic time in seconds */
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void unix_error(char *msg)
+{
+	fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+	exit(1);
+}
@@ -14,6 +14,7 @@
 #endif
 
 
+#define _GNU_SOURCE       /* for prlimit() */
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,12 +26,29 @@
 #include <fcntl.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <spawn.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sched.h>
+#include <dirent.h>
 
 /* Misc manifest constants */
-#define MAXLINE    1024   /* max line size */
-#define MAXARGS     128   /* max args on a command line */
-#define MAXJOBS      16   /* max jobs at any point in time */
-#define MAXJID    1<<16   /* max job ID */
+#define MAXLINE    1024   /* I/O buffer size; lines may be longer */
+#define MAXJOBS      16   /* initial job table size; it grows as needed */
+#define MAXJID  (1<<16)   /* max job ID */
+#define DEFPATH "/bin:/usr/bin" /* search path when PATH is not set */
 
 /* Job states */
 #define UNDEF         0   /* undefined */
@@ -48,10 +66,16 @@
  * At most 1 job can be in the FG state.
  */
 
-/* Parsing states */
-#define ST_NORMAL   0x0   /* next token is an argument */
-#define ST_INFILE   0x1   /* next token is the input file */
-#define ST_OUTFILE  0x2   /* next token is the output file */
+/* When a pipeline of a command line runs, given the one before it */
+#define LIST_SEQ    0     /* first, or after ';' or '&': always */
+#define LIST_AND    1     /* after '&&': if that one succeeded */
+#define LIST_OR     2     /* after '||': if that one failed */
+
+/* Redirection types */
+#define REDIR_IN     0    /* [n]< file */
+#define REDIR_OUT    1    /* [n]> file */
+#define REDIR_APPEND 2    /* [n]>> file */
+#define REDIR_DUP    3    /* [n]>&m or [n]<&m */
 
 
 /* Global variables */
@@ -61,49 +85,442 @@ int verbose = 0;            /* if true, print additional output */
 int nextjid = 1;            /* next job ID to allocate */
 char sbuf[MAXLINE];         /* for composing sprintf messages */
 
+/*
+ * Job scheduling: the CPUs, nice value and scheduling policy of every
+ * process of a job, as given with the sched builtin or a sched prefix.
+ * A new job's CPUs are inherited: the shell runs on them itself while
+ * it spawns the job, so that the job never runs anywhere else. An
+ * unprivileged shell could not undo a nice value or policy, so those
+ * are set on each process right after it is spawned, and until then it
+ * runs with the shell's. Only SCHED_OTHER is set earlier, in the child
+ * by posix_spawn(), as glibc's spawn attributes take no other policy
+ * we allow. A running job is changed in every thread of every process
+ * in its group.
+ */
+struct job_sched {
+    int has_cpus;           /* cpus given */
+    cpu_set_t cpus;         /* CPUs it may run on */
+    int has_nice;           /* nice given */
+    int nice;               /* nice value, -20 to 19 */
+    int policy;             /* SCHED_OTHER, SCHED_BATCH or SCHED_IDLE,
+                               -1 if not given */
+};
+struct job_sched job_sched_new = { .policy = -1 }; /* for new jobs */
+
 struct job_t {              /* The job struct */
     pid_t pid;              /* job PID */
     int jid;                /* job ID [1, 2, ...] */
     int state;              /* UNDEF, BG, FG, or ST */
-    char cmdline[MAXLINE];  /* command line */
+    int nprocs;             /* processes of the pipeline still running */
+    int leader_done;        /* pid has exited, but other processes have not */
+    int timed;              /* report usage when done (time prefix) */
+    struct timespec start;  /* when it was started (CLOCK_MONOTONIC) */
+    struct rusage usage;    /* of its processes reaped so far, from wait4 */
+    long cpu_max;           /* CPU limit in percent of one CPU, 0 for none */
+    long mem_max;           /* memory limit in bytes, 0 for none */
+    int cgroup;             /* has a cgroup, named job<jid> */
+    struct job_sched sched; /* how it is scheduled */
+    pid_t last;             /* last command of the pipeline, 0 if it
+                               did not start */
+    int status;             /* wait status of last, once reaped */
+    int client;             /* job server connection waiting for its
+                               exit status, -1 if none */
+    char cmdline[MAXLINE];  /* command line, cut short if longer */
+};
+struct job_t *job_list;     /* The job list, job_slots entries */
+int job_slots;              /* entries allocated in job_list */
+
+/*
+ * Job table indexes: open addressing hash tables, probed linearly,
+ * from a pid or jid to a job_list slot. pid_index holds every process
+ * of every job, so any stage of a pipeline maps to its job. free_slots
+ * is a min-heap of unused slots, so a new job takes the lowest free
+ * slot just as it did when the table was scanned. Only addjob() and
+ * addjobproc() reallocate any of these, and they do so with signals
+ * blocked, so lookups and deletions from the signal handlers always
+ * see a consistent table.
+ */
+struct job_index {
+    int *keys;              /* pid or jid in each bucket */
+    int *slots;             /* job_list slot + 1, 0 for an empty bucket */
+    int mask;               /* number of buckets - 1 */
+    int count;              /* buckets in use */
+};
+struct job_index pid_index; /* process ID -> slot */
+struct job_index jid_index; /* job ID -> slot */
+int *free_slots;            /* min-heap of unused slots */
+int nfree;                  /* entries in free_slots */
+int max_jid;                /* largest job ID in use */
+int fg_slot = -1;           /* slot of the FG job, -1 if none */
+
+/* Usage of the last timed job, saved by deletejob() as it goes away */
+struct timespec last_timed_real;
+struct rusage last_timed_usage;
+volatile sig_atomic_t last_timed_done;
+
+int fg_status;              /* exit status of the last FG job to finish,
+                               saved by deletejob() */
+int last_status;            /* of the last pipeline run, as $? in sh */
+int capture_sig;            /* signal that stopped a $(...), or 0 */
+
+/*
+ * Child status queue: sigchld_handler() only reaps, leaving each child's
+ * pid, status and usage here, and chld_drain() applies them to the job
+ * list and prints the notifications from the main flow of control.
+ * The handler is the only producer and advances chld_head; chld_drain()
+ * is the only consumer and advances chld_tail, so neither needs a lock.
+ * Both are free-running counters. If the queue fills, the handler
+ * leaves the remaining zombies and sets chld_overflow, and chld_drain()
+ * runs the handler again once it has made room.
+ */
+#define CHLD_QSIZE 1024     /* power of 2 */
+struct chld_event {
+    pid_t pid;
+    int status;
+    struct rusage ru;
+};
+struct chld_event chld_queue[CHLD_QSIZE];
+unsigned int chld_head;     /* next entry the handler fills */
+unsigned int chld_tail;     /* next entry chld_drain() reads */
+volatile sig_atomic_t chld_overflow;
+
+/*
+ * Parse arena: the words and tree of a command line are carved out of
+ * these blocks, so parsing does not call malloc() for each token. The
+ * first block is kept when the arena is reset for the next line, and
+ * any others, added when a line needs more, are freed.
+ */
+#define ARENA_BLOCK (16*MAXLINE) /* size of the first block */
+struct arena_block {
+    struct arena_block *next;
+    size_t size;            /* bytes in data */
+    size_t used;
+    char data[];
+};
+struct arena {
+    struct arena_block *first;
+    struct arena_block *cur;  /* block being allocated from */
+};
+struct arena line_arena;    /* for the command line being run */
+
+/* A redirection of one command of a pipeline; they apply in order */
+struct redir {
+    int stage;              /* which command of the pipeline */
+    int fd;                 /* descriptor redirected */
+    int type;               /* REDIR_IN, REDIR_OUT, ... */
+    char *file;             /* file name, NULL for REDIR_DUP */
+    int dupfd;              /* REDIR_DUP: fd becomes a copy of this */
+    struct redir *next;
 };
-struct job_t job_list[MAXJOBS]; /* The job list */
 
+/*
+ * A parsed command line is a list of these, one per pipeline, linked
+ * in the order they appear. Everything they point to is in an arena.
+ */
 struct cmdline_tokens {
-    int argc;               /* Number of arguments */
-    char *argv[MAXARGS];    /* The arguments list */
-    char *infile;           /* The input file */
-    char *outfile;          /* The output file */
+    int argc;               /* Number of entries used in argv */
+    char **argv;            /* The arguments list; pipeline stages are
+                               separated by NULL entries */
+    int nstages;            /* Number of commands in the pipeline */
+    int *stage;             /* Index in argv where each command starts */
+    struct redir *redirs;   /* of all its commands, in order */
+    int bg;                 /* ended with '&' */
+    int op;                 /* when it runs: LIST_SEQ, LIST_AND, LIST_OR */
+    char *text;             /* its part of the line, for the job list */
+    struct cmdline_tokens *next;
+    int subst;              /* has $(...) not yet substituted */
+    int timed;              /* It started with "time" */
+    struct job_sched *sched; /* settings of a sched prefix, or NULL */
     enum builtins_t {       /* Indicates if argv[0] is a builtin command */
         BUILTIN_NONE,
         BUILTIN_QUIT,
         BUILTIN_JOBS,
         BUILTIN_BG,
-        BUILTIN_FG} builtins;
+        BUILTIN_FG,
+        BUILTIN_HASH,
+        BUILTIN_LIMIT,
+        BUILTIN_PARALLEL,
+        BUILTIN_WAIT,
+        BUILTIN_HISTORY,
+        BUILTIN_SCHED} builtins;
 };
 
 
 int fg_pid ; /* pid of current foreground group */
 pid_t  tsh_pid; /* for storing shell pid */
 
+/*
+ * Event loop mode (-e): SIGCHLD, SIGINT and SIGTSTP stay blocked and
+ * are read from sig_fd, a signalfd, in the same poll() as stdin. The
+ * shell then reaps, forwards and reports in its main flow of control
+ * rather than in handlers, so nothing can interrupt a job list update
+ * or a printf.
+ */
+int event_mode = 0;         /* if true, use the event loop */
+int sig_fd = -1;            /* signalfd for the blocked signals */
+char *inbuf;                /* stdin bytes not yet returned as lines */
+int inlen, incap;           /* bytes in inbuf, and its size */
+
+/*
+ * Job server (-S socket): clients connect to a UNIX socket and send a
+ * command line with their stdin, stdout and stderr attached (SCM_RIGHTS).
+ * It runs as a background job on those descriptors, and the job keeps
+ * the connection until deletejob() sends back its exit status. A
+ * request is only read once poll() says it has arrived, so a slow
+ * client cannot hold up the others.
+ */
+int srv_fd = -1;            /* listening socket */
+int *srv_conns;             /* connections whose request is not read yet */
+int srv_nconns, srv_conncap;
+
+/*
+ * Command hash: where the PATH search found each command name, so that
+ * running it again costs one faccessat() instead of one per directory
+ * in PATH. Open addressing with linear probing, like the job indexes;
+ * entries are only ever replaced or all dropped at once, so no removal
+ * is needed. The table is emptied whenever PATH differs from hash_path.
+ */
+struct cmd_hash_entry {
+    char *name;             /* command name, NULL for an empty bucket */
+    char *path;             /* where it was found */
+    int hits;               /* times it was looked up */
+};
+struct cmd_hash_entry *cmd_hash; /* cmd_hash_mask + 1 buckets */
+int cmd_hash_mask = -1;
+int cmd_hash_count;         /* buckets in use */
+char *hash_path;            /* PATH that the table was filled under */
+
+/*
+ * Job resource limits. With cgroup v2, the shell makes a cgroup of its
+ * own, tsh.<pid>, next to the one it runs in, and each limited job gets
+ * a child job<jid> of it with cpu.max and memory.max set. Processes are
+ * moved in right after they are spawned, so they run outside the limits
+ * for that long. The cpu and memory controllers are enabled in the
+ * parent's cgroup.subtree_control if they are not already, which the
+ * shell does not undo: other cgroups may have come to rely on them.
+ * tsh.<pid> is removed when the shell exits, after any job still in it
+ * is moved back to the shell's own cgroup. If the cgroup cannot be made
+ * or the cpu and memory controllers cannot be enabled for it, memory
+ * limits fall back to RLIMIT_AS: the shell lowers its own soft limit
+ * while it spawns a job, so the children inherit it, and uses prlimit()
+ * on running jobs. CPU bandwidth has no rlimit equivalent and is then
+ * not limited.
+ */
+#define CPU_PERIOD 100000   /* cpu.max period, in microseconds */
+long job_cpu_max;           /* limits given to new jobs, 0 for none */
+long job_mem_max;
+int cg_state;               /* 0 untried, 1 usable, -1 unavailable */
+int cg_dirfd = -1;          /* the shell's cgroup directory */
+int cg_basefd = -1;         /* the directory it is in */
+int cg_homefd = -1;         /* the cgroup the shell runs in */
+pid_t cg_owner;             /* the shell that made it */
+
+/*
+ * Command substitution: a line is first parsed with each $(...) only
+ * checked, and each pipeline that has one is parsed again just before
+ * it runs, this time running the command line inside. Its output is
+ * captured through a pipe into a buffer that doubles as it fills,
+ * read MAXLINE*64 bytes at a time, and copied into the words.
+ */
+#define CAPTURE_CHUNK (64*MAXLINE) /* initial capture buffer size */
+
+/*
+ * Parser state for one command line. Words are written to out, which
+ * is as long as the line: a word and its terminating NUL take no more
+ * than the text it came from and the byte that ended it. A word that
+ * has command output in it gets a buffer of its own instead.
+ */
+struct parser {
+    struct arena *a;
+    const char *text;       /* the line */
+    const char *p;          /* next byte of it to read */
+    char *out;              /* where the next word goes */
+    int expand;             /* run $(...), rather than just check it */
+    char **argv;            /* words of the pipelines parsed so far */
+    int argc, cap;
+    int first;              /* where the current pipeline starts */
+    int subst;              /* a $(...) was only checked */
+};
+
+/*
+ * Command history. Lines read at the prompt are appended to a file,
+ * $TSH_HISTFILE or ~/.tsh_history, one per line, each with a single
+ * write() so that shells sharing the file do not mix their lines.
+ * ~/.tsh_history is only used when stdin is a terminal, so that
+ * drivers and pipes leave no files behind; a shell fed from anything
+ * else keeps its history in memory unless $TSH_HISTFILE is set.
+ *
+ * Searches go through an index of trigram signatures. The lines are
+ * taken HIST_BLOCK at a time, and for each block a bit is set in two
+ * rows, by two hashes, for every trigram it has; each line has two '\1'
+ * bytes put in front of it first, so that a prefix has trigrams of its
+ * own. A chunk holds the rows of HIST_BLOCK blocks, one 64-bit word a
+ * row, so ANDing the rows of a query's trigrams gives the blocks of the
+ * chunk that may hold a match, and only those lines are compared. For
+ * searches too short to have a trigram, each chunk also has a bitmap of
+ * the byte pairs and bytes in it; that one is exact, so only the newest
+ * chunk that has the pair is searched. Complete chunks are appended to
+ * the index file (the history file's name with ".idx"), so each line is
+ * indexed once; the rest are built the first time the history is used.
+ * At startup both files are only mapped, so a long history costs
+ * nothing until then. Lines read since startup are kept in memory and
+ * searched first.
+ */
+#define HIST_BLOCK   64     /* lines in a block, and blocks in a chunk */
+#define HIST_CHUNK (HIST_BLOCK*HIST_BLOCK) /* lines in a complete chunk */
+#define HIST_ROWS  8192     /* trigram hash values */
+#define HIST_MAGIC "tshidx1"
+#define HIST_SETPAIR(ck, a, b) ((ck)->pairs[(a) << 2 | (b) >> 6] |= 1ULL << ((b) & 63))
+#define HIST_HASPAIR(ck, a, b) ((ck)->pairs[(a) << 2 | (b) >> 6] >> ((b) & 63) & 1)
+/* Whether the n bytes at line start with or contain the len at str */
+#define HIST_MATCH(line, n, str, len, prefix) \
+    ((prefix) ? (n) >= (len) && !memcmp(line, str, len) : \
+     memmem(line, n, str, len) != NULL)
+struct hist_chunk {
+    uint64_t start[HIST_BLOCK+1]; /* offset of each block in the file,
+                                     then of the end of the chunk */
+    uint64_t check;               /* hist_check() of the chunk's end */
+    uint64_t pairs[65536/64];     /* bit ab set: the chunk has bytes ab,
+                                     or byte b if a is 2 */
+    uint64_t rows[HIST_ROWS];     /* bit b set: block b has a trigram
+                                     that hashes to the row */
+};
+struct hist_header {        /* at the start of the index file */
+    char magic[8];
+    uint64_t ino;           /* of the history file it indexes */
+};
+int hist_fd = -1;           /* the history file, opened for appending */
+char *hist_map;             /* its contents at startup */
+size_t hist_size;
+int hist_idx_fd = -1;       /* the index file */
+char *hist_idx_map;         /* its contents at startup */
+size_t hist_idx_size;
+struct hist_chunk *hist_saved; /* chunks from the index file */
+int hist_nsaved;
+struct hist_chunk *hist_built; /* chunks indexed by this shell */
+int hist_nbuilt;
+int hist_nlines;            /* lines in hist_map */
+int hist_indexed;
+char **hist_new;            /* lines read since startup */
+int hist_nnew, hist_newcap;
+
+/*
+ * One command of the parallel builtin. Its standard output goes to a
+ * pipe and is kept in out until every earlier command's output has
+ * been written, so the output comes out in input order.
+ */
+struct par_task {
+    pid_t pid;              /* 0 until started */
+    int pidfd;              /* readable once it exits */
+    int outfd;              /* read end of its stdout, -1 at EOF */
+    int done;               /* reaped */
+    int status;
+    char *out;              /* output not yet written */
+    size_t len, cap;
+};
+
+
+
 /* End global variables */
 
 
 /* Function prototypes */
 void eval(char *cmdline);
+void run_list(struct cmdline_tokens *list);
+void run_command(struct cmdline_tokens *tok);
+struct job_t *bgfg_job(char **argv);
 
 void sigchld_handler(int sig);
 void sigtstp_handler(int sig);
 void sigint_handler(int sig);
+void chld_drain(void);
 
 /* Here are helper routines that we've provided for you */
-int parseline(const char *cmdline, struct cmdline_tokens *tok); 
+int parseline(const char *cmdline, struct cmdline_tokens **list); 
+int parse_tokens(struct arena *a, const char *text, int expand,
+		struct cmdline_tokens **list);
+static int parse_pipeline(struct parser *ps, struct cmdline_tokens *tok);
+static int parse_redir(struct parser *ps, struct cmdline_tokens *tok);
+static int scan_word(struct parser *ps, int split, char **word);
+static void add_arg(struct parser *ps, char *arg);
+void *arena_alloc(struct arena *a, size_t n);
+void arena_reset(struct arena *a);
+pid_t spawn_pipeline(struct cmdline_tokens *tok, int state, char *cmdline);
+static int spawn_stages(struct cmdline_tokens *tok, int out_fd, pid_t *pids,
+		pid_t *last, const struct job_sched *sched);
+int open_outfile(struct cmdline_tokens *tok);
+static char *redir_infile(struct cmdline_tokens *tok);
+static const char *subst_end(const char *p);
+static char *capture(struct arena *a, const char *cmdline, size_t n,
+		size_t *len);
+static int exit_code(int status);
 void sigquit_handler(int sig);
 
+void event_init(void);
+ssize_t event_getline(char **line, size_t *cap);
+void event_waitfg(pid_t pid);
+static void event_dispatch(void);
+static void event_reap(void);
+
+void server_loop(const char *path);
+static void server_accept(void);
+static void server_request(int k);
+static int server_run(char *text, int *fds, int conn);
+static struct redir **client_redir(struct redir **tail, int stage, int fd,
+		int from);
+
+void run_script_file(const char *path);
+void run_script(const char *text, size_t len, const char *name);
+
+char *find_command(const char *name);
+void hash_builtin(char **argv, int output_fd);
+static char *search_path(const char *name, const char *path);
+static struct cmd_hash_entry *hash_bucket(const char *name);
+static void hash_forget(void);
+
+void limit_builtin(char **argv, int output_fd);
+static void limit_proc(struct job_t *job, pid_t pid);
+static void limit_job(struct job_t *job, long cpu, long mem);
+static long parse_limit(const char *arg, int mem);
+static int cgroup_init(void);
+static void cgroup_cleanup(void);
+static int cgroup_has(const char *list, const char *name);
+static int cgroup_write(int dirfd, const char *file, const char *val);
+static void cgroup_name(char *buf, int jid);
+
+void sched_builtin(char **argv, int output_fd);
+static int parse_sched(char **argv, struct job_sched *s, char **bad);
+static int parse_cpus(const char *arg, cpu_set_t *set);
+static void format_cpus(char *buf, size_t size, cpu_set_t *set);
+static void sched_merge(struct job_sched *to, const struct job_sched *from);
+static int sched_job(struct job_t *job, const struct job_sched *s);
+static int sched_task(pid_t tid, const struct job_sched *s);
+
+void parallel_builtin(char **argv, const char *infile, int output_fd);
+static int par_start(struct par_task *t, char **argv, const char *path,
+		char *input);
+static void par_read(struct par_task *t, int head, int output_fd,
+		int *can_splice);
+void wait_builtin(char **argv);
+static int wait_pending(char **argv);
+
+void hist_init(void);
+void hist_add(const char *line);
+int hist_expand(char **cmdline, size_t *cap);
+void history_builtin(char **argv, int output_fd);
+static void hist_index(void);
+static int hist_build(struct hist_chunk *ck, size_t off);
+static const struct hist_chunk *hist_chunk(int c);
+static const char *hist_line(int n, size_t *len);
+static int hist_search(const char *str, size_t len, int prefix);
+static unsigned hist_row(unsigned a, unsigned b, unsigned c, int h);
+static uint64_t hist_check(size_t end);
+
 void clearjob(struct job_t *job);
-void initjobs(struct job_t *job_list);
+void initjobs(void);
 int maxjid(struct job_t *job_list); 
 int addjob(struct job_t *job_list, pid_t pid, int state, char *cmdline);
+int addjobproc(struct job_t *job_list, pid_t leader, pid_t pid);
 int deletejob(struct job_t *job_list, pid_t pid); 
 pid_t fgpid(struct job_t *job_list);
 struct job_t *getjobpid(struct job_t *job_list, pid_t pid);
@@ -111,12 +528,24 @@ struct job_t *getjobjid(struct job_t *job_list, int jid);
 int pid2jid(pid_t pid); 
 pid_t jid2pid(int jid);
 void listjobs(struct job_t *job_list, int output_fd);
+void listjobs_usage(struct job_t *job_list, int output_fd);
+void jobusage(struct job_t *job_list, pid_t pid, int status, const struct rusage *ru);
+void print_usage(const struct timespec *real, const struct rusage *ru, int output_fd);
+static double live_cpu(int slot);
 void printjob(pid_t pid,int output_fd); 
 void printjob_jid(int jid,int output_fd); 
 void print_sigint_job(struct job_t *job_list,pid_t pid,int signal,int output_fd);           
 void print_sigtstp_job(struct job_t *job_list,pid_t pid,int signal,int output_fd);
 void change_job_state(struct job_t *job_list,pid_t pid,int new_state);
 void change_job_state_jid(struct job_t *job_list,int jid,int new_state);
+static struct job_t *grow_jobs(void);
+static int index_reserve(struct job_index *ix, int n);
+static int index_find(struct job_index *ix, int key);
+static void index_insert(struct job_index *ix, int key, int slot);
+static void index_remove(struct job_index *ix, int key);
+static void set_job_state(int slot, int state);
+static void free_slot_push(int slot);
+static int free_slot_pop(void);
 void usage(void);
 void unix_error(char *msg);
 void app_error(char *msg);
@@ -138,15 +567,19 @@ int
 main(int argc, char **argv) 
 {
     char c;
-    char cmdline[MAXLINE];    /* cmdline for fgets */
+    char *cmdline = NULL;     /* cmdline, grown by getline */
+    size_t cmdcap = 0;
+    ssize_t len;
     int emit_prompt = 1; /* emit prompt (default) */
+    char *command = NULL; /* -c command string */
+    char *server = NULL;  /* -S job server socket */
 
     /* Redirect stderr to stdout (so that driver will get all output
      * on the pipe connected to stdout) */
     dup2(1, 2);
 
     /* Parse the command line */
-    while ((c = getopt(argc, argv, "hvp")) != EOF) {
+    while ((c = getopt(argc, argv, "hvpec:S:")) != EOF) {
         switch (c) {
         case 'h':             /* print help message */
             usage();
@@ -157,6 +590,16 @@ main(int argc, char **argv)
         case 'p':             /* don't print a prompt */
             emit_prompt = 0;  /* handy for automatic testing */
             break;
+        case 'e':             /* read signals with signalfd */
+            event_mode = 1;
+            break;
+        case 'c':             /* run a command string, then exit */
+            command = optarg;
+            break;
+        case 'S':             /* serve jobs on a UNIX socket */
+            server = optarg;
+            event_mode = 1;
+            break;
         default:
             usage();
         }
@@ -175,19 +618,44 @@ main(int argc, char **argv)
     Signal(SIGQUIT, sigquit_handler); 
 
     /* Initialize the job list */
-    initjobs(job_list);
+    initjobs();
+
+    if (event_mode)
+        event_init();
+
+    //Get shell pid
+    tsh_pid = getpid();
+
+    /* Script mode: run a -c string or a script file, then exit */
+    if (command != NULL)
+        run_script(command, strlen(command), "-c");
+    if (optind < argc)
+        run_script_file(argv[optind]);
+
+    /* Job server mode: a client that has gone away must not kill us */
+    if (server != NULL) {
+        Signal(SIGPIPE, SIG_IGN);
+        server_loop(server);
+    }
+
+    hist_init();
 
 
     /* Execute the shell's read/eval loop */
     while (1) {
 
+        /* Report the jobs that finished since the last command */
+        chld_drain();
+
         if (emit_prompt) {
             printf("%s", prompt);
             fflush(stdout);
         }
-        if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin))
-            app_error("fgets error");
-        if (feof(stdin)) { 
+        if (event_mode)
+            len = event_getline(&cmdline, &cmdcap);
+        else if ((len = getline(&cmdline, &cmdcap, stdin)) < 0 && ferror(stdin))
+            app_error("getline error");
+        if (len < 0) { 
             /* End of file (ctrl-d) */
             printf ("\n");
             fflush(stdout);
@@ -196,7 +664,13 @@ main(int argc, char **argv)
         }
         
         /* Remove the trailing newline */
-        cmdline[strlen(cmdline)-1] = '\0';
+        if (len > 0 && cmdline[len-1] == '\n')
+            cmdline[len-1] = '\0';
+
+        /* Expand a !reference and remember the line */
+        if (hist_expand(&cmdline, &cmdcap) < 0)
+            continue;
+        hist_add(cmdline);
         
         /* Evaluate the command line */
         eval(cmdline);
@@ -222,21 +696,75 @@ main(int argc, char **argv)
 void 
 eval(char *cmdline) 
 {
-    int bg;              /* should the job run in bg or fg? */
+    struct cmdline_tokens *list;
+
+    /* Parse command line */
+    if (parseline(cmdline, &list) < 0)
+        return;                         /* parsing error */
+
+    run_list(list);                     /* nothing for an empty line */
+}
+
+/*
+ * run_list - Run the pipelines of a parsed command line in order. One
+ *     after && only runs if the one before it succeeded, and one after
+ *     || only if it failed; a pipeline that is skipped passes on the
+ *     status it was tested on, as in sh. A pipeline with $(...) in it
+ *     is parsed again just before it runs, to substitute. A job
+ *     killed by ctrl-c, or a $(...) stopped by ctrl-c or ctrl-z, ends
+ *     the line.
+ */
+void 
+run_list(struct cmdline_tokens *list) 
+{
+    struct cmdline_tokens *tok, *sub;
+
+    capture_sig = 0;
+    for (tok = list; tok != NULL; tok = tok->next) {
+        if ((tok->op == LIST_AND && last_status != 0) ||
+                (tok->op == LIST_OR && last_status == 0))
+            continue;
+        if (!tok->subst)
+            run_command(tok);
+        else if (parse_tokens(&line_arena, tok->text, 1, &sub) < 0)
+            last_status = capture_sig ? 128 + capture_sig : 2;
+        else if (sub == NULL)
+            last_status = 0;        /* $(...) gave no words */
+        else
+            run_command(sub);
+        if (last_status == 128 + SIGINT || capture_sig)
+            break;
+    }
+}
+
+/* 
+ * run_command - Run the pipeline tok, in the background if tok->bg,
+ *     and set last_status. Both run_list() and script mode, which
+ *     parses a whole script before running any of it, end up here.
+ */
+void 
+run_command(struct cmdline_tokens *tok) 
+{
+    int bg = tok->bg;   /* should the job run in bg or fg? */
+    char *cmdline = tok->text; /* for the job list */
     int job_state;      /* initial value of job BG or FG based on bg */
     int status;
     int check;
-    struct cmdline_tokens tok;
-    pid_t pid = -255;  // Initialzing to
-    int jid = -255;   //  dummy values 
+    struct rusage ru;
+    pid_t pid = -255;  // Initialzing to a dummy value
+    struct job_t *job;  //the job of fg or bg
     sigset_t mask;      
     sigset_t mask2;      
     int flag = 0; //Used while processing "fg" built in command
-    int infile_fd ; //file descriptor to be used for infile if specified in job 
     int outfile_fd ; //file descriptor to be used for outfile if specified in job
+    struct timespec t0, t1; //For the time prefix: wall clock and
+    struct rusage self0, self1; //shell's own usage around a builtin
 
-    //Get shell pid
-    tsh_pid = getpid();
+    if (tok->timed) {
+	    clock_gettime(CLOCK_MONOTONIC,&t0);
+	    getrusage(RUSAGE_SELF,&self0);
+	    last_timed_done = 0;
+    }
 
     //Intialize mask for blocked signal
     //Block SIGCHLD SIGINT SIGTSTP signals
@@ -249,20 +777,27 @@ eval(char *cmdline)
     Sigaddset(&mask2,SIGTSTP);
     Sigprocmask(SIG_BLOCK,&mask,NULL);
 
-    /* Parse command line */
-    bg = parseline(cmdline, &tok); 
-
-    if (bg == -1) return;               /* parsing error */
-    if (tok.argv[0] == NULL)  return;   /* ignore empty lines */
+    //Bring the job list up to date; with SIGCHLD blocked nothing can
+    //be queued again until the new job is in it
+    chld_drain();
 
     /* If tok is a BUILTIN shell command */
-    if (tok.builtins != BUILTIN_NONE) {
+    if (tok->builtins != BUILTIN_NONE) {
+
+       //Output goes to the outfile if one is given; skip the
+       //command if it cannot be opened
+       last_status = 0;
+       if ((outfile_fd = open_outfile(tok)) < 0) {
+	       tok->builtins = BUILTIN_NONE;
+	       last_status = 1;
+       }
         
-       switch(tok.builtins) {                           
+       switch(tok->builtins) {                           
 
                            //Built in command quit :
                            //Send SIGKILL to all processes in shell
        case BUILTIN_QUIT : tsh_pid = getpid();
+                           cgroup_cleanup();
                            kill(-tsh_pid,SIGKILL);
                            break;
 
@@ -270,14 +805,11 @@ eval(char *cmdline)
                            //Also open output file if redirection specified and 
                            //redirect jobs output to the new file's descriptor
 
-       case BUILTIN_JOBS :  if (tok.outfile != NULL) {
-				    outfile_fd = open(tok.outfile , O_WRONLY);
-				    listjobs(job_list,outfile_fd);
-				    break;
-			    }
-
+       case BUILTIN_JOBS :  //"jobs -l" adds the time and resources each job used
+			    if ((tok->argv[1] != NULL) && !strcmp(tok->argv[1],"-l"))
+				    listjobs_usage(job_list,outfile_fd);
 			    else
-				    listjobs(job_list,STDOUT_FILENO);
+				    listjobs(job_list,outfile_fd);
 			    break;
 
 
@@ -285,14 +817,11 @@ eval(char *cmdline)
 			    // Change state from ST to BG in job_list
 			    // Send SIGCONT signal to job
 
-       case BUILTIN_FG :   if(*(char *)(tok.argv[1]) == '%' ) {
-				   jid = atoi( (((char *)(tok.argv[1])) + 1) ); 
-				   pid = jid2pid(jid);
-			   }
-			   else {
-				   pid = atoi(tok.argv[1]);
-				   jid = pid2jid(pid);
+       case BUILTIN_FG :   if ((job = bgfg_job(tok->argv)) == NULL) {
+				   last_status = 1;
+				   break;
 			   }
+			   pid = job->pid;
 			   change_job_state(job_list,pid,FG);
 			   flag = 1;                            //flag set because we want to jump into else clause below 
 			   // to process resumed job as a foreground job
@@ -302,28 +831,67 @@ eval(char *cmdline)
 			   //Parse job id or pid given with bg command
 			   // Change state from ST to BG in job_list
 			   // Send SIGCONT signal to job
-       case BUILTIN_BG :   if(*(char *)(tok.argv[1]) == '%' ) {
-				   jid = atoi( (((char *)(tok.argv[1])) + 1) ); 
-				   pid = jid2pid(jid);
-			   }
-			   else {
-				   pid = atoi(tok.argv[1]);
-				   jid = pid2jid(pid);
+       case BUILTIN_BG :   if ((job = bgfg_job(tok->argv)) == NULL) {
+				   last_status = 1;
+				   break;
 			   }
+			   pid = job->pid;
 			   printjob(pid,STDOUT_FILENO);
 			   change_job_state(job_list,pid,BG);
 			   Kill(-pid,SIGCONT);
 			   break;
+			   //Show or reset the command hash, to outfile if given
+       case BUILTIN_HASH : hash_builtin(tok->argv,outfile_fd);
+			   break;
+			   //Show or set job resource limits
+       case BUILTIN_LIMIT : limit_builtin(tok->argv,outfile_fd);
+			   break;
+			   //Run a command over input lines, output kept in order
+       case BUILTIN_PARALLEL : parallel_builtin(tok->argv,redir_infile(tok),outfile_fd);
+			   break;
+			   //Wait for background jobs to finish
+       case BUILTIN_WAIT : wait_builtin(tok->argv);
+			   break;
+			   //List the command history, to outfile if given
+       case BUILTIN_HISTORY : history_builtin(tok->argv,outfile_fd);
+			   break;
+			   //Show or set job CPUs, nice value and policy
+       case BUILTIN_SCHED : sched_builtin(tok->argv,outfile_fd);
+			   break;
        case BUILTIN_NONE : break;
        default : break;
 
        }
 
+       //The rest write nothing to it
+       if ((outfile_fd != STDOUT_FILENO) && (outfile_fd >= 0) &&
+		       ((tok->builtins == BUILTIN_QUIT) || (tok->builtins == BUILTIN_FG) ||
+			(tok->builtins == BUILTIN_BG) || (tok->builtins == BUILTIN_WAIT)))
+	       close(outfile_fd);
+
+       //A timed builtin runs in the shell itself
+       if (tok->timed) {
+	       clock_gettime(CLOCK_MONOTONIC,&t1);
+	       getrusage(RUSAGE_SELF,&self1);
+	       t1.tv_sec -= t0.tv_sec;
+	       if ((t1.tv_nsec -= t0.tv_nsec) < 0) {
+		       t1.tv_sec--;
+		       t1.tv_nsec += 1000000000L;
+	       }
+	       timersub(&self1.ru_utime,&self0.ru_utime,&self1.ru_utime);
+	       timersub(&self1.ru_stime,&self0.ru_stime,&self1.ru_stime);
+	       self1.ru_minflt -= self0.ru_minflt;
+	       self1.ru_majflt -= self0.ru_majflt;
+	       self1.ru_nvcsw -= self0.ru_nvcsw;
+	       self1.ru_nivcsw -= self0.ru_nivcsw;
+	       print_usage(&t1,&self1,STDOUT_FILENO);
+       }
+
     }
 
 
     //If tok is a external program to be run by shell 
-    else if ((tok.builtins == BUILTIN_NONE) || (flag == 1)) {
+    else if ((tok->builtins == BUILTIN_NONE) || (flag == 1)) {
 
 	    if (flag == 1) 
 		    bg = 0;
@@ -336,61 +904,74 @@ eval(char *cmdline)
 
 
 
-	    //Child process   
-	    if ((pid = Fork()) == 0) {
-
-		    setpgid(0,0);  //Start process in new group     
-		    Signal(SIGINT,  SIG_DFL);   /* ctrl-c from child handled by parent's sigchld */
-
-		    addjob(job_list,getpid(),job_state,cmdline); 
-
-		    // If input/output redirection specified open given file and point STDIN/STDOUT descriptor
-		    // to new file's file descriptor
-		    if (tok.infile != NULL) {
-			    infile_fd = open(tok.infile , O_RDONLY);
-			    dup2(infile_fd,STDIN_FILENO);   
-		    }
-
-		    if (tok.outfile != NULL) {
-			    outfile_fd = open(tok.outfile , O_WRONLY);
-			    dup2(outfile_fd,STDOUT_FILENO);   
-		    }
-
-		    //Unblock masks inherited from parent process
-		    //and execute program using exec
-		    Sigprocmask(SIG_UNBLOCK,&mask,NULL);
-		    Execve(tok.argv[0],tok.argv,environ); 
-
+	    //Start every command of the pipeline in one new process group
+	    //and add them to job list as one job, then unblock signals
+	    //and set fg_pid if job is foreground job
+	    if ((pid = spawn_pipeline(tok,job_state,cmdline)) == 0) {
+		    if (!event_mode)
+			    Sigprocmask(SIG_UNBLOCK,&mask,NULL); 
+		    last_status = 127;
+		    return;
 	    }
-
-
-	    //Parent process
-	    //Add child to job list and unblock signal,also set fg_pid if job is foreground job	    
-	    addjob(job_list,pid,job_state,cmdline); 
+	    last_status = 0;
 	    if(!bg)
 		    fg_pid = pid;
+	    if (tok->timed)
+		    getjobpid(job_list,pid)->timed = 1;
+
+	    //In event loop mode the signals stay blocked and are read from sig_fd
+	    if (event_mode) {
+		    if (!bg) {
+			    event_waitfg(pid);
+			    last_status = (getjobpid(job_list,pid) != NULL) ?
+				    128 + SIGTSTP : exit_code(fg_status);
+		    }
+		    else
+			    printjob(pid,STDOUT_FILENO);
+		    if (tok->timed && !bg && last_timed_done)
+			    print_usage(&last_timed_real,&last_timed_usage,STDOUT_FILENO);
+		    return;
+	    }
 	    Sigprocmask(SIG_UNBLOCK,&mask2,NULL); 
 
 	    //Until foreground process terminates SIGCHLD functionality is done here , SIGINT and SIGTSTP are handled by handlers 
+	    //The job leaves the list once its last process is deleted
 	    if(!bg) {
 
-		    check = waitpid(pid,&status,WUNTRACED);
-		    if ((check<0) && (errno!=ECHILD)) 
-			    unix_error("waitfg : wait pid error\n");
-
-		    if ((check == pid) && WIFSTOPPED(status)){
-			    print_sigtstp_job(job_list,pid,SIGTSTP,STDOUT_FILENO);          //Print message that job was stopped by SIGSTP signal 
-
-			    //Change stopped job state in list to ST (stopped) 
-			    change_job_state(job_list,pid,ST);
-			    return;
-		    }
+		    while (getjobpid(job_list,pid) != NULL) {
+			    check = wait4(-pid,&status,WUNTRACED,&ru);
+			    if (check < 0) {
+				    if (errno!=ECHILD) 
+					    unix_error("waitfg : wait pid error\n");
+				    break;
+			    }
 
-		    if ((check == pid) && (WIFSIGNALED(status)))
-			    print_sigint_job(job_list,pid,WTERMSIG(status),STDOUT_FILENO);       //Print message that job/pid was terminated by a signal 
+			    if (WIFSTOPPED(status)){
+				    print_sigtstp_job(job_list,pid,SIGTSTP,STDOUT_FILENO);          //Print message that job was stopped by SIGSTP signal 
+
+				    //Change stopped job state in list to ST (stopped) 
+				    //and collect what the other commands reported meanwhile
+				    change_job_state(job_list,pid,ST);
+				    last_status = 128 + WSTOPSIG(status);
+				    while ((check = wait4(-pid,&status,WUNTRACED|WNOHANG,&ru)) > 0)
+					    if (!WIFSTOPPED(status)) {
+						    jobusage(job_list,check,status,&ru);
+						    deletejob(job_list,check);
+					    }
+				    return;
+			    }
 
+			    //Report the job once, when its last process was killed by a signal
+			    if ((WIFSIGNALED(status)) && (getjobpid(job_list,check) != NULL) &&
+					    (getjobpid(job_list,check)->nprocs == 1))
+				    print_sigint_job(job_list,pid,WTERMSIG(status),STDOUT_FILENO);       //Print message that job/pid was terminated by a signal 
 
-		    deletejob(job_list,pid);
+			    jobusage(job_list,check,status,&ru);
+			    deletejob(job_list,check);
+		    }
+		    last_status = exit_code(fg_status);
+		    if (tok->timed && !bg && last_timed_done)
+			    print_usage(&last_timed_real,&last_timed_usage,STDOUT_FILENO);
 		    Sigprocmask(SIG_UNBLOCK,&mask,NULL); 
 
 	    }
@@ -407,133 +988,249 @@ eval(char *cmdline)
     return;
 }
 
+/*
+ * bgfg_job - Find the job that fg or bg, as argv[0], is to act on:
+ *     argv[1] is %jid or the PID of any of its processes. If there is
+ *     none, says why as tshref does and returns NULL.
+ */
+	struct job_t *
+bgfg_job(char **argv)
+{
+	struct job_t *job = NULL;
+	char buf[MAXLINE];
+
+	if (argv[1] == NULL)
+		snprintf(buf, MAXLINE, "%s command requires PID or %%jobid argument\n",
+				argv[0]);
+	else if (argv[1][0] == '%') {
+		if ((job = getjobjid(job_list, atoi(argv[1] + 1))) == NULL)
+			snprintf(buf, MAXLINE, "%.*s: No such job\n", MAXLINE / 2,
+					argv[1]);
+	}
+	else if (isdigit((unsigned char)argv[1][0])) {
+		if ((job = getjobpid(job_list, atoi(argv[1]))) == NULL)
+			snprintf(buf, MAXLINE, "(%d): No such process\n", atoi(argv[1]));
+	}
+	else
+		snprintf(buf, MAXLINE, "%s: argument must be a PID or %%jobid\n",
+				argv[0]);
+
+	if (job == NULL && write(STDOUT_FILENO, buf, strlen(buf)) < 0)
+		unix_error("write error");
+	return job;
+}
+
 /* 
- * parseline - Parse the command line and build the argv array.
+ * parseline - Parse the command line into a list of pipelines.
  * 
  * Parameters:
  *   cmdline:  The command line, in the form:
  *
- *                command [arguments...] [< infile] [> oufile] [&]
+ *                pipeline [op pipeline]... [; | &]
+ *
+ *             where op is ';' or '&' (run the next one regardless),
+ *             "&&" (run it if this one succeeded) or "||" (if it
+ *             failed), and a pipeline is one or more commands joined
+ *             by '|', the first maybe preceded by "time" and then
+ *             by "sched" with settings (see sched_builtin):
+ *
+ *                command [arguments...] [redirection...]
+ *
+ *             Redirections may come anywhere among the arguments:
+ *             "< file", "> file", ">> file" (append) and "n>&m" (make
+ *             descriptor n a copy of m), each optionally starting with
+ *             the descriptor number, as in "2> file". A pipeline ending
+ *             with '&' runs in the background. Any argument or file
+ *             name may contain $(command line), replaced by its output.
+ *             Lines and argument lists may be of any length.
  *
- *   tok:      Pointer to a cmdline_tokens structure. The elements of this
- *             structure will be populated with the parsed tokens. Characters 
- *             enclosed in single or double quotes are treated as a single
- *             argument. 
+ *   list:     Set to the first pipeline of the list, or NULL for an
+ *             empty line. Characters enclosed in single or double
+ *             quotes are part of a word even if they are blanks or
+ *             operators; $(...) is left alone in single quotes.
  * Returns:
- *   1:        if the user has requested a BG job
- *   0:        if the user has requested a FG job  
+ *   0:        on success
  *  -1:        if cmdline is incorrectly formatted
  * 
- * Note:       The string elements of tok (e.g., argv[], infile, outfile) 
- *             are statically allocated inside parseline() and will be 
- *             overwritten the next time this function is invoked.
+ * Note:       The list is allocated in line_arena, which is reset the
+ *             next time this function is invoked.
  */
 	int 
-parseline(const char *cmdline, struct cmdline_tokens *tok) 
+parseline(const char *cmdline, struct cmdline_tokens **list) 
 {
-
-	static char array[MAXLINE];          /* holds local copy of command line */
-	const char delims[10] = " \t\r\n";   /* argument delimiters (white-space) */
-	char *buf = array;                   /* ptr that traverses command line */
-	char *next;                          /* ptr to the end of the current arg */
-	char *endbuf;                        /* ptr to the end of the cmdline string */
-	int is_bg;                           /* background job? */
-
-	int parsing_state;                   /* indicates if the next token is the
-						input or output file */
-
 	if (cmdline == NULL) {
 		(void) fprintf(stderr, "Error: command line is NULL\n");
 		return -1;
 	}
 
-	(void) strncpy(buf, cmdline, MAXLINE);
-	endbuf = buf + strlen(buf);
+	arena_reset(&line_arena);
+	return parse_tokens(&line_arena, cmdline, 0, list);
+}
 
-	tok->infile = NULL;
-	tok->outfile = NULL;
+/*
+ * parse_tokens - The work of parseline(), with the list allocated in
+ *     a. If expand is set, each $(...) is run and replaced by its
+ *     output; otherwise it is only checked, and the pipelines with one
+ *     have subst set. Script mode calls this directly to keep the
+ *     lists of every line.
+ */
+	int 
+parse_tokens(struct arena *a, const char *text, int expand,
+		struct cmdline_tokens **list)
+{
+	struct parser ps;
+	struct cmdline_tokens *tok, **tail = list;
+	const char *start, *end;
+	size_t len = strlen(text);
+	int op = LIST_SEQ;
+
+	ps.a = a;
+	ps.text = ps.p = text;
+	ps.out = arena_alloc(a, len + 1);
+	ps.expand = expand;
+	ps.cap = len + 2;
+	ps.argv = arena_alloc(a, ps.cap * sizeof(char *));
+	ps.argc = 0;
+
+	*list = NULL;
+	while (1) {
+		start = ps.p;
+		if (*list != NULL)
+			start += strspn(start, " \t\r\n");
+		tok = arena_alloc(a, sizeof(struct cmdline_tokens));
+		ps.subst = 0;
+		if (parse_pipeline(&ps, tok) < 0)
+			return -1;
+		end = ps.p;
+
+		/* An operator must have a command on either side */
+		if (tok->argc == 0 && (*end != '\0' || op != LIST_SEQ)) {
+			if (*end != '\0')
+				(void) fprintf(stderr, "Error: missing command before '%.*s'\n",
+						(end[0] == end[1] && end[0] != ';') ? 2 : 1, end);
+			else
+				(void) fprintf(stderr, "Error: missing command after '%s'\n",
+						op == LIST_AND ? "&&" : "||");
+			return -1;
+		}
+		if (tok->argc == 0)
+			return 0;
+
+		tok->op = op;
+		tok->subst = ps.subst;
+		*tail = tok;
+		tail = &tok->next;
+
+		/* The operator that ended it; the text for the job list
+		 * keeps a '&' but no blanks next to the other pipelines */
+		op = LIST_SEQ;
+		if (*end == '&' && end[1] == '&')
+			op = LIST_AND;
+		else if (*end == '|')
+			op = LIST_OR;
+		else if (*end == '&')
+			tok->bg = 1;
+		ps.p = end + (op != LIST_SEQ ? 2 : *end != '\0');
+		if (*end != '\0') {
+			if (tok->bg)
+				end++;
+			else
+				while (end > start && strchr(" \t\r\n", end[-1]))
+					end--;
+		}
+		tok->text = arena_alloc(a, end - start + 1);
+		memcpy(tok->text, start, end - start);
+		tok->text[end - start] = '\0';
+		if (*ps.p == '\0' && op == LIST_SEQ)
+			return 0;
+	}
+}
 
-	/* Build the argv list */
-	parsing_state = ST_NORMAL;
-	tok->argc = 0;
+/*
+ * parse_pipeline - Parse the pipeline at ps->p into tok, up to the end
+ *     of the line or the ';', '&', "&&" or "||" that ends it, which is
+ *     left at ps->p. Its argv may be empty, if the pipeline is.
+ *     Returns -1 on an error.
+ */
+	static int 
+parse_pipeline(struct parser *ps, struct cmdline_tokens *tok)
+{
+	struct job_sched sched;
+	const char *p;
+	int i, n;
 
-	while (buf < endbuf) {
+	memset(tok, 0, sizeof(*tok));
+	ps->first = ps->argc;
+	while (1) {
 		/* Skip the white-spaces */
-		buf += strspn (buf, delims);
-		if (buf >= endbuf) break;
+		ps->p += strspn(ps->p, " \t\r\n");
+		p = ps->p;
+		if (*p == '\0' || *p == ';' || *p == '&' || (p[0] == '|' && p[1] == '|'))
+			break;
 
-		/* Check for I/O redirection specifiers */
-		if (*buf == '<') {
-			if (tok->infile) {
-				(void) fprintf(stderr, "Error: Ambiguous I/O redirection\n");
+		/* A pipe ends the current command */
+		if (*p == '|') {
+			if (ps->argc == ps->first || ps->argv[ps->argc-1] == NULL) {
+				(void) fprintf(stderr, "Error: missing command in pipeline\n");
 				return -1;
 			}
-			parsing_state |= ST_INFILE;
-			buf++;
+			add_arg(ps, NULL);
+			tok->nstages++;
+			ps->p++;
 			continue;
 		}
-		if (*buf == '>') {
-			if (tok->outfile) {
-				(void) fprintf(stderr, "Error: Ambiguous I/O redirection\n");
+
+		/* Redirections, maybe with a descriptor number in front */
+		if (*p == '<' || *p == '>' || (isdigit((unsigned char)*p) &&
+					(p += strspn(p, "0123456789"), *p == '<' || *p == '>'))) {
+			if (parse_redir(ps, tok) < 0)
 				return -1;
-			}
-			parsing_state |= ST_OUTFILE;
-			buf ++;
 			continue;
 		}
 
-		if (*buf == '\'' || *buf == '\"') {
-			/* Detect quoted tokens */
-			buf++;
-			next = strchr (buf, *(buf-1));
-		} else {
-			/* Find next delimiter */
-			next = buf + strcspn (buf, delims);
-		}
-
-		if (next == NULL) {
-			/* Returned by strchr(); this means that the closing
-			   quote was not found. */
-			(void) fprintf (stderr, "Error: unmatched %c.\n", *(buf-1));
+		/* Anything else is an argument, or more than one after $(...) */
+		if (scan_word(ps, 1, NULL) < 0)
 			return -1;
-		}
-
-		/* Terminate the token */
-		*next = '\0';
-
-		/* Record the token as either the next argument or the input/output file */
-		switch (parsing_state) {
-			case ST_NORMAL:
-				tok->argv[tok->argc++] = buf;
-				break;
-			case ST_INFILE:
-				tok->infile = buf;
-				break;
-			case ST_OUTFILE:
-				tok->outfile = buf;
-				break;
-			default:
-				(void) fprintf(stderr, "Error: Ambiguous I/O redirection\n");
-				return -1;
-		}
-		parsing_state = ST_NORMAL;
-
-		/* Check if argv is full */
-		if (tok->argc >= MAXARGS-1) break;
-
-		buf = next + 1;
 	}
 
-	if (parsing_state != ST_NORMAL) {
-		(void) fprintf(stderr, "Error: must provide file name for redirection\n");
+	if (ps->argc > ps->first && ps->argv[ps->argc-1] == NULL) {
+		(void) fprintf(stderr, "Error: missing command in pipeline\n");
 		return -1;
 	}
+	if (ps->argc == ps->first) {
+		if (tok->redirs != NULL) {
+			(void) fprintf(stderr, "Error: missing command for redirection\n");
+			return -1;
+		}
+		return 0;
+	}
 
 	/* The argument list must end with a NULL pointer */
-	tok->argv[tok->argc] = NULL;
+	add_arg(ps, NULL);
+	tok->argv = &ps->argv[ps->first];
+	tok->argc = ps->argc - ps->first - 1;
+	tok->nstages++;
+
+	/* A leading "time" times the rest of the pipeline */
+	if (!strcmp(tok->argv[0], "time") && tok->argv[1] != NULL) {
+		tok->argv++;
+		tok->argc--;
+		tok->timed = 1;
+	}
 
-	if (tok->argc == 0)  /* ignore blank line */
-		return 1;
+	/* So does a leading "sched" with settings, for how it is scheduled */
+	if (!strcmp(tok->argv[0], "sched") &&
+			(n = parse_sched(&tok->argv[1], &sched, NULL)) > 0 &&
+			tok->argv[n+1] != NULL) {
+		tok->sched = arena_alloc(ps->a, sizeof(struct job_sched));
+		*tok->sched = sched;
+		tok->argv += n + 1;
+		tok->argc -= n + 1;
+	}
+	tok->stage = arena_alloc(ps->a, tok->nstages * sizeof(int));
+	for (i = 0, n = 0; i < tok->argc; i++)
+		if (i == 0 || tok->argv[i-1] == NULL)
+			tok->stage[n++] = i;
 
 	if (!strcmp(tok->argv[0], "quit")) {                 /* quit command */
 		tok->builtins = BUILTIN_QUIT;
@@ -543,102 +1240,2808 @@ parseline(const char *cmdline, struct cmdline_tokens *tok)
 		tok->builtins = BUILTIN_BG;
 	} else if (!strcmp(tok->argv[0], "fg")) {            /* fg command */
 		tok->builtins = BUILTIN_FG;
+	} else if (!strcmp(tok->argv[0], "hash")) {          /* hash command */
+		tok->builtins = BUILTIN_HASH;
+	} else if (!strcmp(tok->argv[0], "limit")) {         /* limit command */
+		tok->builtins = BUILTIN_LIMIT;
+	} else if (!strcmp(tok->argv[0], "parallel")) {      /* parallel command */
+		tok->builtins = BUILTIN_PARALLEL;
+	} else if (!strcmp(tok->argv[0], "wait")) {          /* wait command */
+		tok->builtins = BUILTIN_WAIT;
+	} else if (!strcmp(tok->argv[0], "history")) {       /* history command */
+		tok->builtins = BUILTIN_HISTORY;
+	} else if (!strcmp(tok->argv[0], "sched")) {         /* sched command */
+		tok->builtins = BUILTIN_SCHED;
 	} else {
 		tok->builtins = BUILTIN_NONE;
 	}
 
-	/* Should the job run in the background? */
-	if ((is_bg = (*tok->argv[tok->argc-1] == '&')) != 0)
-		tok->argv[--tok->argc] = NULL;
-
-	return is_bg;
+	if (tok->nstages > 1 && tok->builtins != BUILTIN_NONE) {
+		(void) fprintf(stderr, "Error: %s cannot be part of a pipeline\n",
+				tok->argv[0]);
+		return -1;
+	}
+	if (tok->sched != NULL && tok->builtins != BUILTIN_NONE) {
+		(void) fprintf(stderr, "Error: sched cannot be given to %s\n",
+				tok->argv[0]);
+		return -1;
+	}
+	return 0;
 }
 
+/*
+ * parse_redir - Parse the redirection at ps->p and add it to the
+ *     current command of tok. Returns -1 on an error.
+ */
+	static int 
+parse_redir(struct parser *ps, struct cmdline_tokens *tok)
+{
+	struct redir *r, **tail;
+	const char *p = ps->p;
+	char *end;
+	long n;
+
+	r = arena_alloc(ps->a, sizeof(struct redir));
+	r->stage = tok->nstages;
+	r->fd = -1;
+	r->file = NULL;
+	r->next = NULL;
+	if (isdigit((unsigned char)*p)) {
+		n = strtol(p, &end, 10);
+		p = end;
+		if (n > INT_MAX) {
+			(void) fprintf(stderr, "Error: bad descriptor in redirection\n");
+			return -1;
+		}
+		r->fd = n;
+	}
+	if (*p == '<') {
+		r->type = REDIR_IN;
+		if (r->fd < 0)
+			r->fd = STDIN_FILENO;
+	} else {
+		r->type = (p[1] == '>') ? REDIR_APPEND : REDIR_OUT;
+		if (r->fd < 0)
+			r->fd = STDOUT_FILENO;
+	}
+	p += (r->type == REDIR_APPEND) ? 2 : 1;
+
+	/* n>&m and n<&m copy a descriptor instead of opening a file */
+	if (*p == '&' && r->type != REDIR_APPEND) {
+		p++;
+		if (!isdigit((unsigned char)*p) ||
+				(n = strtol(p, &end, 10)) > INT_MAX) {
+			(void) fprintf(stderr, "Error: bad descriptor in redirection\n");
+			return -1;
+		}
+		r->type = REDIR_DUP;
+		r->dupfd = n;
+		ps->p = end;
+	} else {
+		p += strspn(p, " \t\r\n");
+		if (*p == '\0' || strchr("|&;<>", *p)) {
+			(void) fprintf(stderr, "Error: must provide file name for redirection\n");
+			return -1;
+		}
+		ps->p = p;
+		if (scan_word(ps, 0, &r->file) < 0)
+			return -1;
+	}
 
-/*****************
- * Signal handlers
- *****************/
+	for (tail = &tok->redirs; *tail != NULL; tail = &(*tail)->next)
+		;
+	*tail = r;
+	return 0;
+}
 
-/* 
- * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
- *     a child job terminates (becomes a zombie), or stops because it
- *     received a SIGSTOP, SIGTSTP, SIGTTIN or SIGTTOU signal. The 
- *     handler reaps all available zombie children, but doesn't wait 
- *     for any other currently running children to terminate.  
+/*
+ * scan_word - Read the word at ps->p, up to an unquoted blank or
+ *     operator. Quotes are removed. Each $(...) outside single quotes
+ *     is replaced by the output of the command line inside, less
+ *     trailing newlines, if ps->expand is set, and otherwise only
+ *     checked. If split is set the result goes straight into argv,
+ *     with output from an unquoted $(...) split into words at blanks,
+ *     so there may be any number of words; otherwise it is set in
+ *     *word. Returns the number of words, or -1 on an error.
  */
-	void 
-sigchld_handler(int sig) 
-{       
-	int status;
-	pid_t pid;
-	//Reap zombie processes
-	while((pid = waitpid(-1,&status,WNOHANG)) > 0) {
-
-		if(WIFSIGNALED(status))
-			print_sigint_job(job_list,pid,WTERMSIG(status),STDOUT_FILENO);       //Print message that job/pid was terminated by a signal 
+	static int 
+scan_word(struct parser *ps, int split, char **word)
+{
+	const char *p = ps->p, *end;
+	char *w = ps->out, *d = ps->out, *sub, *buf;
+	size_t n, i;
+	int quote = 0, keep = 0, in_out = 1, nwords = 0;
+
+	while (*p != '\0' && (quote || !strchr(" \t\r\n|&;<>", *p))) {
+		if ((*p == '\'' || *p == '"') && (quote == 0 || quote == *p)) {
+			quote = quote ? 0 : *p;
+			keep = 1;                /* "" is an empty argument */
+			p++;
+			continue;
+		}
+		if (p[0] != '$' || p[1] != '(' || quote == '\'') {
+			*d++ = *p++;
+			continue;
+		}
 
-		deletejob(job_list,pid);
+		if ((end = subst_end(p + 1)) == NULL) {
+			(void) fprintf(stderr, "Error: unmatched (.\n");
+			return -1;
+		}
+		if (!ps->expand) {
+			ps->subst = 1;
+			memcpy(d, p, end + 1 - p);
+			d += end + 1 - p;
+			p = end + 1;
+			continue;
+		}
+		if ((sub = capture(ps->a, p + 2, end - (p + 2), &n)) == NULL)
+			return -1;
+		while (n > 0 && sub[n-1] == '\n')
+			n--;
+		p = end + 1;
+
+		/* Room for the word so far, the output, a NUL after each
+		 * byte of it at most, and the rest of the line */
+		buf = arena_alloc(ps->a, (d - w) + 2 * n + strlen(p) + 1);
+		memcpy(buf, w, d - w);
+		d = buf + (d - w);
+		w = buf;
+		in_out = 0;
+		for (i = 0; i < n; i++) {
+			if (!split || quote || !strchr(" \t\n", sub[i])) {
+				*d++ = sub[i];
+				continue;
+			}
+			if (d > w || keep) {
+				*d++ = '\0';
+				add_arg(ps, w);
+				nwords++;
+				w = d;
+				keep = 0;
+			}
+		}
+		free(sub);
+	}
+	if (quote) {
+		(void) fprintf(stderr, "Error: unmatched %c.\n", quote);
+		return -1;
 	}
 
-	if(errno!=ECHILD)
-		unix_error("waitpid error"); 
-
-	return;
+	*d = '\0';
+	ps->p = p;
+	if (in_out)
+		ps->out = d + 1;
+	if (!split) {
+		*word = w;
+		return 1;
+	}
+	/* Output of $(...) alone may leave nothing */
+	if (d > w || keep) {
+		add_arg(ps, w);
+		nwords++;
+	}
+	return nwords;
 }
 
-/* 
- * sigint_handler - The kernel sends a SIGINT to the shell whenver the
- *    user types ctrl-c at the keyboard.  Catch it and send it along
- *    to the foreground job. 
- *    If the SIGINT is sent to shell then forward it to the fg job else get 
- *    pid of current process and kill itself.
- *
+/*
+ * add_arg - Append arg to the argv of the pipeline being parsed,
+ *     moving it to an array twice the size if it is full
  */
+	static void 
+add_arg(struct parser *ps, char *arg)
+{
+	char **argv;
+
+	/* Only the current pipeline's part needs to move; those already
+	 * parsed keep pointing into the old array */
+	if (ps->argc == ps->cap) {
+		argv = arena_alloc(ps->a, 2 * ps->cap * sizeof(char *));
+		memcpy(argv, &ps->argv[ps->first],
+				(ps->argc - ps->first) * sizeof(char *));
+		ps->argv = argv;
+		ps->argc -= ps->first;
+		ps->first = 0;
+		ps->cap *= 2;
+	}
+	ps->argv[ps->argc++] = arg;
+}
 
+/*
+ * arena_alloc - Return n bytes from a, aligned for a pointer, adding a
+ *     block twice the size of the last one if they do not fit
+ */
+	void *
+arena_alloc(struct arena *a, size_t n)
+{
+	struct arena_block *b = a->cur;
+	size_t size;
+
+	n = (n + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	if (b == NULL || b->size - b->used < n) {
+		size = (b == NULL) ? ARENA_BLOCK : 2 * b->size;
+		if (size < n)
+			size = n;
+		if ((b = malloc(sizeof(struct arena_block) + size)) == NULL)
+			unix_error("malloc error");
+		b->next = NULL;
+		b->size = size;
+		b->used = 0;
+		if (a->cur == NULL)
+			a->first = b;
+		else
+			a->cur->next = b;
+		a->cur = b;
+	}
+	b->used += n;
+	return b->data + b->used - n;
+}
 
-	void 
+/*
+ * arena_reset - Make all of a free again, keeping only its first block
+ */
+	void 
+arena_reset(struct arena *a)
+{
+	struct arena_block *b, *next;
+
+	if (a->first == NULL)
+		return;
+	for (b = a->first->next; b != NULL; b = next) {
+		next = b->next;
+		free(b);
+	}
+	a->first->next = NULL;
+	a->first->used = 0;
+	a->cur = a->first;
+}
+
+/*
+ * spawn_pipeline - Start the commands of tok, connected by pipes, in a
+ *     new process group led by the first one, and add them to the job
+ *     list as one job in the given state. Call with SIGCHLD blocked.
+ *     Returns the PID of the group leader, or 0 if no command could be
+ *     started.
+ */
+	pid_t 
+spawn_pipeline(struct cmdline_tokens *tok, int state, char *cmdline)
+{
+	struct rlimit as, old_as;
+	struct job_sched sched = job_sched_new;
+	cpu_set_t old_cpus;
+	int set_as = 0, set_cpus = 0, err = 0, n, i;
+	pid_t *pids, last, pgid;
+	struct job_t *job;
+
+	/* Without cgroups, the children inherit the memory limit */
+	if (job_mem_max != 0 && !cgroup_init() &&
+			getrlimit(RLIMIT_AS, &old_as) == 0) {
+		as = old_as;
+		if (old_as.rlim_max == RLIM_INFINITY ||
+				(rlim_t)job_mem_max < old_as.rlim_max)
+			as.rlim_cur = job_mem_max;
+		set_as = setrlimit(RLIMIT_AS, &as) == 0;
+	}
+
+	/* and the CPUs they may run on */
+	if (tok->sched != NULL)
+		sched_merge(&sched, tok->sched);
+	if (sched.has_cpus && sched_getaffinity(0, sizeof(old_cpus), &old_cpus) == 0)
+		set_cpus = sched_setaffinity(0, sizeof(sched.cpus), &sched.cpus) == 0;
+
+	if ((pids = malloc(tok->nstages * sizeof(pid_t))) == NULL)
+		unix_error("malloc error");
+	n = spawn_stages(tok, -1, pids, &last, &sched);
+	if (set_as)
+		setrlimit(RLIMIT_AS, &old_as);
+	if (set_cpus)
+		sched_setaffinity(0, sizeof(old_cpus), &old_cpus);
+
+	pgid = (n > 0) ? pids[0] : 0;
+	if (n > 0 && !addjob(job_list, pgid, state, cmdline)) {
+		Kill(-pgid, SIGKILL);
+		pgid = 0;
+	} else if (n > 0) {
+		job = getjobpid(job_list, pgid);
+		job->last = last;
+		job->sched = sched;
+		for (i = 0; i < n; i++) {
+			if (i > 0)
+				addjobproc(job_list, pgid, pids[i]);
+			limit_proc(job, pids[i]);
+			if (sched_task(pids[i], &sched) < 0 && err == 0)
+				err = errno;
+		}
+		if (err != 0)
+			printf("sched: %s\n", strerror(err));
+	}
+	free(pids);
+	return pgid;
+}
+
+/*
+ * spawn_stages - Start the commands of tok, connected by pipes, in a
+ *     new process group led by the first one started. The last one
+ *     writes to out_fd if it is not -1. The redirections of each are
+ *     applied after its pipes, in the order given, so they win.
+ *     The children only need their descriptors moved, their process
+ *     group set and their signal mask cleared, so they are created
+ *     with posix_spawn(), which vforks instead of copying the shell's
+ *     page tables; the policy of sched, unless sched is NULL, is set
+ *     there too if posix_spawn() can. Stores their PIDs in pids and
+ *     returns how many there are; *last, unless last is NULL, is set
+ *     to the PID of the last command, or 0 if it could not be started.
+ */
+	static int 
+spawn_stages(struct cmdline_tokens *tok, int out_fd, pid_t *pids, pid_t *last,
+		const struct job_sched *sched)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	struct sched_param param = { 0 };
+	sigset_t empty, dfl;
+	struct redir *r;
+	int fds[2], in = -1, i, err, n = 0, flags;
+	pid_t pid;
+	char **argv, *path;
+
+	Sigemptyset(&empty);
+	Sigemptyset(&dfl);
+	Sigaddset(&dfl, SIGPIPE);   /* the job server ignores it */
+	for (i = 0; i < tok->nstages; i++) {
+		argv = &tok->argv[tok->stage[i]];
+
+		/* Pipe to the next command, if there is one */
+		fds[0] = fds[1] = -1;
+		if (i < tok->nstages-1 && pipe(fds) < 0)
+			unix_error("pipe error");
+
+		posix_spawn_file_actions_init(&actions);
+		if (in >= 0) {
+			posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+			posix_spawn_file_actions_addclose(&actions, in);
+		}
+		if (fds[1] >= 0) {
+			posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+			posix_spawn_file_actions_addclose(&actions, fds[1]);
+			posix_spawn_file_actions_addclose(&actions, fds[0]);
+		} else if (out_fd >= 0) {
+			posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+		}
+		for (r = tok->redirs; r != NULL; r = r->next) {
+			if (r->stage != i)
+				continue;
+			if (r->type == REDIR_DUP)
+				posix_spawn_file_actions_adddup2(&actions, r->dupfd, r->fd);
+			else
+				posix_spawn_file_actions_addopen(&actions, r->fd, r->file,
+						r->type == REDIR_IN ? O_RDONLY : O_WRONLY | O_CREAT |
+						(r->type == REDIR_APPEND ? O_APPEND : O_TRUNC), 0666);
+		}
+
+		/* Leader starts a new group (pgroup 0), the rest join it */
+		posix_spawnattr_init(&attr);
+		flags = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK |
+			POSIX_SPAWN_SETSIGDEF;
+		if (sched != NULL && sched->policy >= 0 &&
+				posix_spawnattr_setschedpolicy(&attr, sched->policy) == 0) {
+			posix_spawnattr_setschedparam(&attr, &param);
+			flags |= POSIX_SPAWN_SETSCHEDULER | POSIX_SPAWN_SETSCHEDPARAM;
+		}
+		posix_spawnattr_setflags(&attr, flags);
+		posix_spawnattr_setpgroup(&attr, n > 0 ? pids[0] : 0);
+		posix_spawnattr_setsigmask(&attr, &empty);
+		posix_spawnattr_setsigdefault(&attr, &dfl);
+
+		if ((path = find_command(argv[0])) != NULL)
+			err = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+		else
+			err = ENOENT;
+		posix_spawnattr_destroy(&attr);
+		posix_spawn_file_actions_destroy(&actions);
+
+		/* The pipe ends now belong to the children */
+		if (in >= 0)
+			close(in);
+		if (fds[1] >= 0)
+			close(fds[1]);
+		in = fds[0];
+
+		if (last != NULL && i == tok->nstages-1)
+			*last = (err == 0) ? pid : 0;
+		if (err != 0) {
+			printf("%s: %s\n", argv[0], strerror(err));
+			continue;
+		}
+		pids[n++] = pid;
+	}
+	if (in >= 0)
+		close(in);
+	return n;
+}
+
+/*
+ * open_outfile - Where a builtin's output goes: the file named by the
+ *     last redirection of its standard output, created if it does not
+ *     exist and truncated unless given with >>, or a copy of the
+ *     descriptor given with >&. Files named by earlier ones are opened
+ *     too, as sh does. Returns STDOUT_FILENO if there are none, or
+ *     prints why and returns -1 if one cannot be opened.
+ */
+	int 
+open_outfile(struct cmdline_tokens *tok)
+{
+	struct redir *r;
+	int fd = STDOUT_FILENO, newfd;
+
+	for (r = tok->redirs; r != NULL; r = r->next) {
+		if (r->stage != 0 || r->fd != STDOUT_FILENO || r->type == REDIR_IN)
+			continue;
+		if (r->type == REDIR_DUP)
+			newfd = dup(r->dupfd);
+		else
+			newfd = open(r->file, O_WRONLY | O_CREAT |
+					(r->type == REDIR_APPEND ? O_APPEND : O_TRUNC), 0666);
+		if (fd != STDOUT_FILENO)
+			close(fd);
+		if ((fd = newfd) < 0) {
+			if (r->type == REDIR_DUP)
+				printf("%d: %s\n", r->dupfd, strerror(errno));
+			else
+				printf("%s: %s\n", r->file, strerror(errno));
+			return -1;
+		}
+	}
+	return fd;
+}
+
+/*
+ * redir_infile - The file the first command of tok reads its standard
+ *     input from, or NULL if it is not redirected from one
+ */
+	static char *
+redir_infile(struct cmdline_tokens *tok)
+{
+	struct redir *r;
+	char *file = NULL;
+
+	for (r = tok->redirs; r != NULL; r = r->next)
+		if (r->stage == 0 && r->fd == STDIN_FILENO)
+			file = (r->type == REDIR_IN) ? r->file : NULL;
+	return file;
+}
+
+/*
+ * exit_code - The status sh would give $? for a wait() status: the
+ *     exit status, or 128 plus the signal that ended the process
+ */
+	int 
+exit_code(int status)
+{
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	return WEXITSTATUS(status);
+}
+
+/*
+ * subst_end - Returns the ')' that closes the '(' at p, skipping
+ *     quoted text and nested parentheses, or NULL if there is none
+ */
+	static const char *
+subst_end(const char *p)
+{
+	int depth = 0;
+
+	for (; *p != '\0'; p++) {
+		if (*p == '\'' || *p == '"') {
+			if ((p = strchr(p + 1, *p)) == NULL)
+				return NULL;
+		} else if (*p == '(') {
+			depth++;
+		} else if (*p == ')' && --depth == 0) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * capture - Run the n bytes of text at cmdline, a pipeline of external
+ *     commands, and return its standard output in a malloc'd buffer,
+ *     of *len bytes. Its words are parsed into arena a. It runs in the
+ *     foreground, with the shell's signals blocked, and is not a job;
+ *     the shell waits for its processes by PID, so neither the handler
+ *     nor the event loop sees them. Returns NULL, so that the pipeline
+ *     it is in does not run, if it cannot be run or if ctrl-c or
+ *     ctrl-z stopped it; capture_sig is set to the signal then.
+ */
+	static char *
+capture(struct arena *a, const char *cmdline, size_t n, size_t *len)
+{
+	struct cmdline_tokens *tok;
+	struct signalfd_siginfo si;
+	struct pollfd pfd[2];
+	sigset_t mask, prev, intr;
+	pid_t *pids;
+	size_t cap = CAPTURE_CHUNK;
+	char *buf, *text;
+	ssize_t r;
+	int fds[2], i, started, sfd;
+
+	*len = 0;
+	if ((buf = malloc(cap)) == NULL)
+		unix_error("malloc error");
+	text = arena_alloc(a, n + 1);
+	memcpy(text, cmdline, n);
+	text[n] = '\0';
+	if (parse_tokens(a, text, 1, &tok) < 0)
+		goto fail;
+	if (tok == NULL)
+		return buf;             /* an empty $() */
+	if (tok->next != NULL || tok->bg) {
+		fprintf(stderr, "Error: only a single pipeline can be substituted\n");
+		goto fail;
+	}
+	if (tok->builtins != BUILTIN_NONE) {
+		fprintf(stderr, "%s: builtins cannot be substituted\n", tok->argv[0]);
+		goto fail;
+	}
+
+	sigemptyset(&intr);
+	sigaddset(&intr, SIGINT);
+	sigaddset(&intr, SIGTSTP);
+	mask = intr;
+	sigaddset(&mask, SIGCHLD);
+	Sigprocmask(SIG_BLOCK, &mask, &prev);
+	if (pipe2(fds, O_CLOEXEC) < 0)
+		unix_error("pipe error");
+	if ((sfd = signalfd(-1, &intr, SFD_CLOEXEC)) < 0)
+		unix_error("signalfd error");
+	pids = arena_alloc(a, tok->nstages * sizeof(pid_t));
+	started = spawn_stages(tok, fds[1], pids, NULL, NULL);
+	close(fds[1]);
+
+	/* Read straight into the free end of the buffer. The commands are
+	 * in a group of their own, so ctrl-c and ctrl-z come to the shell,
+	 * still blocked, and kill them */
+	pfd[0].fd = fds[0];
+	pfd[1].fd = sfd;
+	pfd[0].events = pfd[1].events = POLLIN;
+	while (1) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			unix_error("poll error");
+		}
+		if (pfd[1].revents & POLLIN) {
+			capture_sig = (read(sfd, &si, sizeof(si)) == sizeof(si)) ?
+				(int)si.ssi_signo : SIGINT;
+			if (started > 0)
+				kill(-pids[0], SIGKILL);
+			free(buf);
+			buf = NULL;
+			break;
+		}
+		if (pfd[0].revents == 0)
+			continue;
+		if ((r = read(fds[0], buf + *len, cap - *len)) == 0)
+			break;
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			unix_error("read error");
+		}
+		if ((*len += r) == cap &&
+				(buf = realloc(buf, cap *= 2)) == NULL)
+			unix_error("realloc error");
+	}
+	close(fds[0]);
+	close(sfd);
+	for (i = 0; i < started; i++)
+		while (waitpid(pids[i], NULL, 0) < 0 && errno == EINTR)
+			;
+	Sigprocmask(SIG_SETMASK, &prev, NULL);
+	return buf;
+
+fail:
+	free(buf);
+	return NULL;
+}
+
+
+/*****************
+ * Signal handlers
+ *****************/
+
+/* 
+ * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
+ *     a child job terminates (becomes a zombie), or stops because it
+ *     received a SIGSTOP, SIGTSTP, SIGTTIN or SIGTTOU signal. The 
+ *     handler reaps all available zombie children into chld_queue,
+ *     but doesn't wait for any other currently running children to
+ *     terminate. It neither prints nor touches the job list.
+ */
+	void 
+sigchld_handler(int sig) 
+{       
+	int olderrno = errno;
+	pid_t pid;
+	unsigned int head = chld_head;
+	struct chld_event *ev;
+
+	//Reap zombie processes into the queue while there is room; the
+	//job list is left to chld_drain()
+	while (1) {
+		if (head - __atomic_load_n(&chld_tail,__ATOMIC_ACQUIRE) == CHLD_QSIZE) {
+			chld_overflow = 1;
+			pid = 0;
+			break;
+		}
+		ev = &chld_queue[head % CHLD_QSIZE];
+		if ((pid = wait4(-1,&ev->status,WNOHANG,&ev->ru)) <= 0)
+			break;
+		ev->pid = pid;
+		__atomic_store_n(&chld_head,++head,__ATOMIC_RELEASE);
+	}
+
+	//0 means other children are still running, errno is only set on -1
+	if((pid < 0) && (errno!=ECHILD))
+		unix_error("waitpid error"); 
+
+	errno = olderrno;
+	return;
+}
+
+/*
+ * chld_drain - Apply the children sigchld_handler() queued to the job
+ *     list: add up their usage, report those killed by a signal and
+ *     delete them. Called from the main flow of control only.
+ */
+	void 
+chld_drain(void) 
+{
+	struct chld_event *ev;
+	sigset_t mask, prev;
+
+	do {
+		while (chld_tail != __atomic_load_n(&chld_head,__ATOMIC_ACQUIRE)) {
+			ev = &chld_queue[chld_tail % CHLD_QSIZE];
+			if (WIFSIGNALED(ev->status) && getjobpid(job_list,ev->pid) != NULL)
+				print_sigint_job(job_list,ev->pid,WTERMSIG(ev->status),STDOUT_FILENO);       //Print message that job/pid was terminated by a signal 
+			jobusage(job_list,ev->pid,ev->status,&ev->ru);
+			deletejob(job_list,ev->pid);
+			__atomic_store_n(&chld_tail,chld_tail + 1,__ATOMIC_RELEASE);
+		}
+
+		//Collect the zombies left behind when the queue was full
+		if (chld_overflow) {
+			Sigemptyset(&mask);
+			Sigaddset(&mask,SIGCHLD);
+			Sigprocmask(SIG_BLOCK,&mask,&prev);
+			chld_overflow = 0;
+			sigchld_handler(SIGCHLD);
+			Sigprocmask(SIG_SETMASK,&prev,NULL);
+		}
+	} while (chld_tail != __atomic_load_n(&chld_head,__ATOMIC_ACQUIRE));
+}
+
+/* 
+ * sigint_handler - The kernel sends a SIGINT to the shell whenver the
+ *    user types ctrl-c at the keyboard.  Catch it and send it along
+ *    to the foreground job. 
+ *    If the SIGINT is sent to shell then forward it to the fg job else get 
+ *    pid of current process and kill itself.
+ *
+ */
+
+
+	void 
 sigint_handler(int sig) 
 {       
 
-	//Delete fg job from list and send SIGINT to all processes in fg group 
-	//Only to be done when parent shell or fg job is sent this signal.
-	//OBackground jobs reaped by SIGCHLD handler
+	//Delete fg job from list and send SIGINT to all processes in fg group 
+	//Only to be done when parent shell or fg job is sent this signal.
+	//OBackground jobs reaped by SIGCHLD handler
+
+	pid_t pid; 
+	pid = getpid();
+	if ( (pid == tsh_pid) || (pid == fg_pid) )
+		Kill(-fg_pid,SIGINT);
+
+	return;
+}
+
+/*
+ * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
+ *     the user types ctrl-z at the keyboard. Catch it and suspend the
+ *     foreground job by sending it a SIGTSTP.  
+ */
+	void 
+sigtstp_handler(int sig) 
+{        
+
+	//Delete fg job from list and send SIGTSTP to all processes in fg group 
+	//Only to be done when parent shell or fg job is sent this signal.
+	//Else just send SIGTSTP to process with id "pid"
+
+	pid_t pid; 
+	pid = getpid();
+	if ( (pid == tsh_pid) || (pid == fg_pid) )
+		Kill(-fg_pid,SIGTSTP);
+
+	else
+		Kill(pid,SIGTSTP);
+
+	return;
+}
+
+/*********************
+ * End signal handlers
+ *********************/
+
+/*************************************
+ * Event loop: signals read as events
+ *************************************/
+
+/*
+ * event_init - Block SIGCHLD, SIGINT and SIGTSTP for good and open
+ *     sig_fd to receive them. Children start with an empty signal
+ *     mask (see spawn_pipeline), so they still see these signals.
+ */
+	void 
+event_init(void) 
+{
+	sigset_t mask;
+
+	Sigemptyset(&mask);
+	Sigaddset(&mask,SIGCHLD);
+	Sigaddset(&mask,SIGINT);
+	Sigaddset(&mask,SIGTSTP);
+	Sigprocmask(SIG_BLOCK,&mask,NULL);
+	if ((sig_fd = signalfd(-1,&mask,SFD_NONBLOCK|SFD_CLOEXEC)) < 0)
+		unix_error("signalfd error");
+}
+
+/*
+ * event_getline - Like getline() on stdin, but handles signal events
+ *     while it waits for a line. stdio is not used for reading, since a
+ *     line already in its buffer would not make fd 0 readable for
+ *     poll(). Returns -1 at end of file.
+ */
+	ssize_t 
+event_getline(char **line, size_t *cap) 
+{
+	struct pollfd fds[2];
+	char *nl;
+	ssize_t n, len;
+
+	while (1) {
+		/* Hand out a complete line */
+		if ((nl = memchr(inbuf, '\n', inlen)) != NULL) {
+			len = nl - inbuf + 1;
+			if (*line == NULL || *cap < len + 1) {
+				*cap = len + 1;
+				if ((*line = realloc(*line, *cap)) == NULL)
+					unix_error("realloc error");
+			}
+			memcpy(*line, inbuf, len);
+			(*line)[len] = '\0';
+			inlen -= len;
+			memmove(inbuf, inbuf + len, inlen);
+			return len;
+		}
+
+		/* Room for at least MAXLINE more bytes */
+		if (incap - inlen < MAXLINE) {
+			incap = incap ? 2 * incap : 4 * MAXLINE;
+			if ((inbuf = realloc(inbuf, incap)) == NULL)
+				unix_error("realloc error");
+		}
+
+		fds[0].fd = STDIN_FILENO;
+		fds[0].events = POLLIN;
+		fds[1].fd = sig_fd;
+		fds[1].events = POLLIN;
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			unix_error("poll error");
+		}
+		if (fds[1].revents)
+			event_dispatch();
+		if (fds[0].revents) {
+			n = read(STDIN_FILENO, inbuf + inlen, incap - inlen);
+			if (n < 0 && errno != EINTR)
+				app_error("read error");
+			if (n == 0) {
+				/* A last line without a newline still counts */
+				if (inlen == 0)
+					return -1;
+				inbuf[inlen++] = '\n';
+			}
+			if (n > 0)
+				inlen += n;
+		}
+	}
+}
+
+/*
+ * event_waitfg - Handle signal events until the foreground job led by
+ *     pid has finished or stopped. Stdin is left alone meanwhile.
+ */
+	void 
+event_waitfg(pid_t pid) 
+{
+	struct pollfd fds;
+	struct job_t *job;
+
+	fds.fd = sig_fd;
+	fds.events = POLLIN;
+	while ((job = getjobpid(job_list,pid)) != NULL && job->state == FG) {
+		if (poll(&fds, 1, -1) < 0 && errno != EINTR)
+			unix_error("poll error");
+		event_dispatch();
+	}
+}
+
+/*
+ * event_dispatch - Act on every signal queued on sig_fd: reap children
+ *     on SIGCHLD and forward SIGINT and SIGTSTP to the foreground job.
+ *     Several SIGCHLDs may arrive as one event, so event_reap() collects
+ *     everything that is waiting.
+ */
+	static void 
+event_dispatch(void) 
+{
+	struct signalfd_siginfo si;
+	pid_t pid;
+	int reap = 0;
+
+	while (read(sig_fd, &si, sizeof(si)) == sizeof(si)) {
+		switch (si.ssi_signo) {
+		case SIGCHLD:
+			reap = 1;
+			break;
+		case SIGINT:
+		case SIGTSTP:
+			if ((pid = fgpid(job_list)) != 0)
+				Kill(-pid,si.ssi_signo);
+			break;
+		}
+	}
+	if (errno != EAGAIN && errno != EINTR)
+		unix_error("signalfd read error");
+	if (reap)
+		event_reap();
+}
+
+/*
+ * event_reap - Collect every child that exited, was killed or stopped.
+ *     A job is reported once: when it first stops, or when its last
+ *     process is killed by a signal.
+ */
+	static void 
+event_reap(void) 
+{
+	struct job_t *job;
+	struct rusage ru;
+	int status;
+	pid_t pid;
+
+	while ((pid = wait4(-1,&status,WNOHANG|WUNTRACED,&ru)) > 0) {
+		if ((job = getjobpid(job_list,pid)) == NULL)
+			continue;
+		if (WIFSTOPPED(status)) {
+			if (job->state != ST) {
+				print_sigtstp_job(job_list,job->pid,WSTOPSIG(status),STDOUT_FILENO);
+				change_job_state(job_list,job->pid,ST);
+			}
+			continue;
+		}
+		if (WIFSIGNALED(status) && job->nprocs == 1)
+			print_sigint_job(job_list,job->pid,WTERMSIG(status),STDOUT_FILENO);
+		jobusage(job_list,pid,status,&ru);
+		deletejob(job_list,pid);
+	}
+	if (pid < 0 && errno != ECHILD)
+		unix_error("waitpid error");
+}
+
+/************
+ * Job server
+ ************/
+
+/*
+ * server_loop - Serve job requests on the UNIX socket at path until the
+ *     shell is killed. Signals are handled as in the event loop, and
+ *     stdin is not read.
+ */
+	void
+server_loop(const char *path)
+{
+	struct sockaddr_un addr;
+	struct pollfd *fds = NULL;
+	int nfds, cap = 0, i;
+	mode_t old;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		app_error("socket path too long");
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if ((srv_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC |
+					SOCK_NONBLOCK, 0)) < 0)
+		unix_error("socket error");
+
+	/* Only we may connect: a client can run anything as us */
+	unlink(path);
+	old = umask(077);
+	if (bind(srv_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		unix_error("bind error");
+	umask(old);
+	if (listen(srv_fd, SOMAXCONN) < 0)
+		unix_error("listen error");
+
+	while (1) {
+		if (srv_nconns + 2 > cap) {
+			cap = 2 * (srv_nconns + 2);
+			if ((fds = realloc(fds, cap * sizeof(struct pollfd))) == NULL)
+				unix_error("realloc error");
+		}
+		fds[0].fd = sig_fd;
+		fds[1].fd = srv_fd;
+		for (i = 0; i < srv_nconns; i++)
+			fds[i+2].fd = srv_conns[i];
+		nfds = srv_nconns + 2;
+		for (i = 0; i < nfds; i++)
+			fds[i].events = POLLIN;
+		if (poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			unix_error("poll error");
+		}
+
+		if (fds[0].revents)
+			event_dispatch();
+		/* Back to front, since server_request() moves the last
+		 * connection into the place of the one it takes */
+		for (i = nfds - 1; i >= 2; i--)
+			if (fds[i].revents)
+				server_request(i - 2);
+		if (fds[1].revents)
+			server_accept();
+		fflush(stdout);
+	}
+}
+
+/*
+ * server_accept - Take every pending connection from a process of our
+ *     own user; those of anyone else are closed
+ */
+	static void
+server_accept(void)
+{
+	struct ucred cred;
+	socklen_t len;
+	int fd;
+
+	while ((fd = accept4(srv_fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+		len = sizeof(cred);
+		if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 ||
+				cred.uid != getuid()) {
+			close(fd);
+			continue;
+		}
+		if (srv_nconns == srv_conncap) {
+			srv_conncap = srv_conncap ? 2 * srv_conncap : 16;
+			if ((srv_conns = realloc(srv_conns,
+							srv_conncap * sizeof(int))) == NULL)
+				unix_error("realloc error");
+		}
+		srv_conns[srv_nconns++] = fd;
+	}
+	if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+		unix_error("accept error");
+}
+
+/*
+ * server_request - Read the request on connection k of srv_conns and
+ *     run it. What the shell prints about it, such as a parse error,
+ *     goes to the client's stderr.
+ */
+	static void
+server_request(int k)
+{
+	char cbuf[CMSG_SPACE(3 * sizeof(int))], *text;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	int conn = srv_conns[k], fds[3], out, code, i;
+	ssize_t n;
+
+	srv_conns[k] = srv_conns[--srv_nconns];
+
+	/* A SOCK_SEQPACKET peek with MSG_TRUNC gives the message size */
+	if ((n = recv(conn, NULL, 0, MSG_PEEK | MSG_TRUNC)) <= 0) {
+		close(conn);
+		return;
+	}
+	if ((text = malloc(n + 1)) == NULL)
+		unix_error("malloc error");
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = text;
+	iov.iov_len = n;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+	cmsg = (n < 0) ? NULL : CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+			cmsg->cmsg_type != SCM_RIGHTS ||
+			cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+		/* Do not keep descriptors we will not use */
+		if (cmsg != NULL && cmsg->cmsg_type == SCM_RIGHTS)
+			for (i = 0; CMSG_LEN((i + 1) * sizeof(int)) <= cmsg->cmsg_len; i++)
+				close(((int *)CMSG_DATA(cmsg))[i]);
+		free(text);
+		close(conn);
+		return;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	text[n] = '\0';
+
+	fflush(stdout);
+	if ((out = dup(STDOUT_FILENO)) < 0)
+		unix_error("dup error");
+	dup2(fds[2], STDOUT_FILENO);
+	dup2(fds[2], STDERR_FILENO);
+	code = server_run(text, fds, conn);
+	fflush(stdout);
+	dup2(out, STDOUT_FILENO);
+	dup2(out, STDERR_FILENO);
+	close(out);
+
+	for (i = 0; i < 3; i++)
+		close(fds[i]);
+	free(text);
+	if (code >= 0) {
+		send(conn, &code, sizeof(code), MSG_NOSIGNAL);
+		close(conn);
+	}
+}
+
+/*
+ * server_run - Run the command line text for the client on connection
+ *     conn, whose stdin, stdout and stderr are fds. A pipeline of
+ *     external commands becomes a background job, which keeps conn;
+ *     returns -1 then. Otherwise returns the exit status to send now.
+ *     Lists, and the builtins that wait or end the shell, are refused.
+ */
+	static int
+server_run(char *text, int *fds, int conn)
+{
+	struct cmdline_tokens *tok;
+	struct redir *redirs, **tail = &redirs;
+	pid_t pid;
+	int i;
+
+	arena_reset(&line_arena);
+	if (parse_tokens(&line_arena, text, 1, &tok) < 0)
+		return 2;
+	if (tok == NULL)
+		return 0;
+	if (tok->next != NULL) {
+		printf("tsh: one pipeline per request\n");
+		return 2;
+	}
+	if (tok->builtins == BUILTIN_QUIT || tok->builtins == BUILTIN_FG ||
+			tok->builtins == BUILTIN_WAIT ||
+			tok->builtins == BUILTIN_PARALLEL) {
+		printf("%s: not available to job server clients\n", tok->argv[0]);
+		return 2;
+	}
+
+	/* The client's descriptors, then its own redirections */
+	for (i = 0; i < tok->nstages; i++) {
+		if (i == 0)
+			tail = client_redir(tail, i, STDIN_FILENO, fds[0]);
+		if (i == tok->nstages-1)
+			tail = client_redir(tail, i, STDOUT_FILENO, fds[1]);
+		tail = client_redir(tail, i, STDERR_FILENO, fds[2]);
+	}
+	*tail = tok->redirs;
+	tok->redirs = redirs;
+
+	if (tok->builtins != BUILTIN_NONE) {
+		tok->bg = 0;
+		run_command(tok);
+		return last_status;
+	}
+	if ((pid = spawn_pipeline(tok, BG, tok->text)) == 0)
+		return 127;
+	getjobpid(job_list, pid)->client = conn;
+	return -1;
+}
+
+/*
+ * client_redir - Put a redirection of fd in stage to a copy of from at
+ *     *tail; returns where the next one goes
+ */
+	static struct redir **
+client_redir(struct redir **tail, int stage, int fd, int from)
+{
+	struct redir *r = arena_alloc(&line_arena, sizeof(struct redir));
+
+	r->stage = stage;
+	r->fd = fd;
+	r->type = REDIR_DUP;
+	r->file = NULL;
+	r->dupfd = from;
+	r->next = NULL;
+	*tail = r;
+	return &r->next;
+}
+
+/*************
+ * Script mode
+ *************/
+
+/*
+ * run_script_file - Map the script at path into memory and run it
+ */
+	void 
+run_script_file(const char *path) 
+{
+	struct stat st;
+	char *text = NULL;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	if (st.st_size > 0) {
+		text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (text == MAP_FAILED)
+			unix_error("mmap error");
+	}
+	close(fd);
+	run_script(text, st.st_size, path);
+}
+
+/*
+ * run_script - Parse all the lines in the len bytes at text, then run
+ *     them back to back with no prompt or line reading in between.
+ *     Blank lines and lines starting with '#' are skipped. A parse
+ *     error stops the script before any of it runs, as in sh. Exits
+ *     when the last command is done, with its status.
+ */
+	void 
+run_script(const char *text, size_t len, const char *name) 
+{
+	static struct arena script_arena;
+	struct cmdline_tokens **lists;
+	const char *p, *end = text + len, *nl;
+	char *line;
+	int nlists = 0, nlines = 1, lineno = 0, i;
+	size_t n;
+
+	for (p = text; p < end && (nl = memchr(p, '\n', end - p)) != NULL; p = nl + 1)
+		nlines++;
+	if ((lists = malloc(nlines * sizeof(struct cmdline_tokens *))) == NULL)
+		unix_error("malloc error");
+
+	/* The lists of every line stay in script_arena. Pipelines with
+	 * $(...) are only checked here, and parsed again when they run. */
+	for (p = text; p < end; p = nl + 1) {
+		lineno++;
+		if ((nl = memchr(p, '\n', end - p)) == NULL)
+			nl = end;
+		n = nl - p;
+		line = arena_alloc(&script_arena, n + 1);
+		memcpy(line, p, n);
+		line[n] = '\0';
+		if (line[strspn(line, " \t\r")] == '#')
+			continue;
+		if (parse_tokens(&script_arena, line, 0, &lists[nlists]) < 0) {
+			fprintf(stderr, "%s: line %d: script not run\n", name, lineno);
+			exit(1);
+		}
+		if (lists[nlists] != NULL)
+			nlists++;
+	}
+
+	for (i = 0; i < nlists; i++) {
+		arena_reset(&line_arena);
+		run_list(lists[i]);
+	}
+	fflush(stdout);
+	exit(last_status);
+}
+
+/**************
+ * Command hash
+ **************/
+
+/*
+ * find_command - Returns the file to run for command name: name itself
+ *     if it contains a '/', else where the PATH search finds it, from
+ *     the command hash if it is there and still executable. Returns
+ *     NULL if it is not found.
+ */
+	char *
+find_command(const char *name) 
+{
+	struct cmd_hash_entry *e;
+	const char *path;
+	char *found;
+
+	if (strchr(name, '/') != NULL)
+		return (char *)name;
+	if (name[0] == '\0')
+		return NULL;
+
+	if ((path = getenv("PATH")) == NULL)
+		path = DEFPATH;
+	if (hash_path == NULL || strcmp(path, hash_path) != 0) {
+		hash_forget();
+		hash_path = strdup(path);
+	}
+
+	/* A hit costs one system call */
+	e = hash_bucket(name);
+	if (e != NULL && e->name != NULL) {
+		if (faccessat(AT_FDCWD, e->path, X_OK, AT_EACCESS) < 0) {
+			if ((found = search_path(name, path)) == NULL)
+				return NULL;
+			free(e->path);
+			e->path = found;
+		}
+		e->hits++;
+		return e->path;
+	}
+
+	if ((found = search_path(name, path)) == NULL)
+		return NULL;
+	if (e == NULL || (e->name = strdup(name)) == NULL) {
+		/* No room to remember it; still run it this time */
+		static char *uncached;
+		free(uncached);
+		return uncached = found;
+	}
+	e->path = found;
+	e->hits = 1;
+	cmd_hash_count++;
+	return e->path;
+}
+
+/*
+ * hash_builtin - The hash command. With no arguments, list the command
+ *     hash; "hash -r" empties it; "hash name..." looks names up.
+ */
+	void 
+hash_builtin(char **argv, int output_fd) 
+{
+	char buf[MAXLINE];
+	int i;
+
+	if (argv[1] == NULL) {
+		if (cmd_hash_count == 0) {
+			sprintf(buf, "hash: hash table empty\n");
+			if (write(output_fd, buf, strlen(buf)) < 0)
+				unix_error("write error");
+		} else {
+			sprintf(buf, "hits\tcommand\n");
+			if (write(output_fd, buf, strlen(buf)) < 0)
+				unix_error("write error");
+		}
+		for (i = 0; i <= cmd_hash_mask; i++) {
+			if (cmd_hash[i].name == NULL)
+				continue;
+			snprintf(buf, MAXLINE, "%4d\t%s\n", cmd_hash[i].hits,
+					cmd_hash[i].path);
+			if (write(output_fd, buf, strlen(buf)) < 0)
+				unix_error("write error");
+		}
+	}
+	else if (!strcmp(argv[1], "-r")) {
+		hash_forget();
+	}
+	else {
+		for (i = 1; argv[i] != NULL; i++) {
+			if (find_command(argv[i]) != NULL)
+				continue;
+			snprintf(buf, MAXLINE, "hash: %s: not found\n", argv[i]);
+			if (write(output_fd, buf, strlen(buf)) < 0)
+				unix_error("write error");
+		}
+	}
+
+	if(output_fd != STDOUT_FILENO)
+		close(output_fd);
+}
+
+/*
+ * search_path - Look for an executable name in each directory of the
+ *     colon-separated path, an empty entry meaning the current one.
+ *     Returns a malloc'd path or NULL.
+ */
+	static char *
+search_path(const char *name, const char *path) 
+{
+	char buf[MAXLINE];
+	const char *dir, *end;
+	size_t dirlen, namelen = strlen(name);
+
+	for (dir = path; ; dir = end + 1) {
+		if ((end = strchr(dir, ':')) == NULL)
+			end = dir + strlen(dir);
+		dirlen = end - dir;
+		if (dirlen + namelen + 2 <= sizeof(buf)) {
+			if (dirlen == 0) {
+				strcpy(buf, name);
+			} else {
+				memcpy(buf, dir, dirlen);
+				buf[dirlen] = '/';
+				strcpy(buf + dirlen + 1, name);
+			}
+			if (faccessat(AT_FDCWD, buf, X_OK, AT_EACCESS) == 0)
+				return strdup(buf);
+		}
+		if (*end == '\0')
+			return NULL;
+	}
+}
+
+/*
+ * hash_bucket - The bucket that holds name, or the empty one where it
+ *     belongs. Grows the table first if it is half full; returns NULL
+ *     only if that fails.
+ */
+	static struct cmd_hash_entry *
+hash_bucket(const char *name) 
+{
+	struct cmd_hash_entry *old = cmd_hash, *e;
+	unsigned h = 2166136261u;   /* FNV-1a */
+	const char *p;
+	int i, nbuckets, oldmask = cmd_hash_mask;
+
+	if (2 * (cmd_hash_count + 1) > cmd_hash_mask + 1) {
+		nbuckets = cmd_hash ? 2 * (cmd_hash_mask + 1) : 64;
+		if ((cmd_hash = calloc(nbuckets, sizeof(*cmd_hash))) == NULL) {
+			cmd_hash = old;
+			return NULL;
+		}
+		cmd_hash_mask = nbuckets - 1;
+		for (i = 0; i <= oldmask; i++) {
+			if (old[i].name == NULL)
+				continue;
+			e = hash_bucket(old[i].name);
+			*e = old[i];
+		}
+		free(old);
+	}
+
+	for (p = name; *p; p++)
+		h = (h ^ (unsigned char)*p) * 16777619u;
+	for (i = h & cmd_hash_mask; cmd_hash[i].name != NULL; i = (i + 1) & cmd_hash_mask)
+		if (!strcmp(cmd_hash[i].name, name))
+			break;
+	return &cmd_hash[i];
+}
+
+/* hash_forget - Empty the command hash */
+	static void 
+hash_forget(void) 
+{
+	int i;
+
+	for (i = 0; i <= cmd_hash_mask; i++) {
+		if (cmd_hash[i].name == NULL)
+			continue;
+		free(cmd_hash[i].name);
+		free(cmd_hash[i].path);
+		cmd_hash[i].name = NULL;
+	}
+	cmd_hash_count = 0;
+	free(hash_path);
+	hash_path = NULL;
+}
+
+/*
+ * limit_builtin - The limit command. "limit [cpu N|max] [mem N|max]"
+ *     sets the limits of jobs started from now on; with %jid or a pid
+ *     first, it changes those of a running job. CPU is in percent of
+ *     one CPU, memory in bytes with an optional K, M or G. With no
+ *     limits given, prints the current ones.
+ */
+	void 
+limit_builtin(char **argv, int output_fd) 
+{
+	char buf[MAXLINE], cpu[32], mem[32];
+	struct job_t *job = NULL;
+	long cpu_max, mem_max;
+	int i = 1, cpu_given = 0;
+
+	if (argv[1] != NULL && (argv[1][0] == '%' || isdigit(argv[1][0]))) {
+		if (argv[1][0] == '%')
+			job = getjobjid(job_list, atoi(argv[1] + 1));
+		else
+			job = getjobpid(job_list, atoi(argv[1]));
+		if (job == NULL) {
+			snprintf(buf, MAXLINE, "limit: %s: No such job\n", argv[1]);
+			goto out;
+		}
+		i = 2;
+	}
+
+	cpu_max = job ? job->cpu_max : job_cpu_max;
+	mem_max = job ? job->mem_max : job_mem_max;
+	if (argv[i] == NULL) {
+		if (cpu_max)
+			snprintf(cpu, sizeof(cpu), "%ld%%", cpu_max);
+		else
+			strcpy(cpu, "max");
+		if (mem_max)
+			snprintf(mem, sizeof(mem), "%ld", mem_max);
+		else
+			strcpy(mem, "max");
+		snprintf(buf, MAXLINE, "cpu %s mem %s (%s)\n", cpu, mem,
+				cgroup_init() ? "cgroup" : "rlimit");
+		goto out;
+	}
+
+	for (; argv[i] != NULL; i += 2) {
+		if (argv[i+1] == NULL || (strcmp(argv[i], "cpu") &&
+					strcmp(argv[i], "mem"))) {
+			snprintf(buf, MAXLINE, "limit: usage: limit [%%jid|pid] "
+					"[cpu <percent>|max] [mem <bytes>[KMG]|max]\n");
+			goto out;
+		}
+		if (!strcmp(argv[i], "cpu"))
+			cpu_given = (cpu_max = parse_limit(argv[i+1], 0)) > 0;
+		else
+			mem_max = parse_limit(argv[i+1], 1);
+		if (cpu_max < 0 || mem_max < 0) {
+			snprintf(buf, MAXLINE, "limit: %s: invalid limit\n", argv[i+1]);
+			goto out;
+		}
+	}
+
+	buf[0] = '\0';
+	if (job != NULL) {
+		limit_job(job, cpu_max, mem_max);
+	} else {
+		job_cpu_max = cpu_max;
+		job_mem_max = mem_max;
+	}
+	if (cpu_given && !cgroup_init())
+		snprintf(buf, MAXLINE, "limit: cgroup v2 not available, "
+				"CPU is not limited\n");
+out:
+	if (buf[0] != '\0' && write(output_fd, buf, strlen(buf)) < 0)
+		unix_error("write error");
+	if(output_fd != STDOUT_FILENO)
+		close(output_fd);
+}
+
+/*
+ * limit_proc - Apply the limits for new jobs to pid, a process of job
+ *     just spawned. The job takes them on with its first process; the
+ *     rest join its cgroup, if it has one.
+ */
+	static void 
+limit_proc(struct job_t *job, pid_t pid) 
+{
+	char name[16], val[32];
+	int fd;
+
+	if (job == NULL)
+		return;
+	if (pid == job->pid) {
+		if (job_cpu_max != 0 || job_mem_max != 0)
+			limit_job(job, job_cpu_max, job_mem_max);
+	} else if (job->cgroup) {
+		cgroup_name(name, job->jid);
+		if ((fd = openat(cg_dirfd, name, O_RDONLY | O_DIRECTORY)) >= 0) {
+			snprintf(val, sizeof(val), "%d", pid);
+			cgroup_write(fd, "cgroup.procs", val);
+			close(fd);
+		}
+	}
+}
+
+/*
+ * limit_job - Give job new limits: write them to its cgroup, making it
+ *     if need be, or else set RLIMIT_AS on each of its live processes
+ */
+	static void 
+limit_job(struct job_t *job, long cpu, long mem) 
+{
+	char name[16], val[32];
+	struct rlimit rl;
+	int fd, b, slot = job - job_list;
+
+	job->cpu_max = cpu;
+	job->mem_max = mem;
+
+	if (cgroup_init()) {
+		cgroup_name(name, job->jid);
+		if (!job->cgroup && mkdirat(cg_dirfd, name, 0755) < 0 &&
+				errno != EEXIST)
+			return;
+		if ((fd = openat(cg_dirfd, name, O_RDONLY | O_DIRECTORY)) < 0)
+			return;
+		job->cgroup = 1;
+		if (cpu)
+			snprintf(val, sizeof(val), "%ld %d", cpu * CPU_PERIOD / 100,
+					CPU_PERIOD);
+		else
+			snprintf(val, sizeof(val), "max %d", CPU_PERIOD);
+		cgroup_write(fd, "cpu.max", val);
+		if (mem)
+			snprintf(val, sizeof(val), "%ld", mem);
+		else
+			strcpy(val, "max");
+		cgroup_write(fd, "memory.max", val);
+
+		/* Processes already running (for limit %jid) */
+		for (b = 0; pid_index.keys && b <= pid_index.mask; b++) {
+			if (pid_index.slots[b] != slot + 1 ||
+					(pid_index.keys[b] == job->pid && job->leader_done))
+				continue;
+			snprintf(val, sizeof(val), "%d", pid_index.keys[b]);
+			cgroup_write(fd, "cgroup.procs", val);
+		}
+		close(fd);
+		return;
+	}
+
+	/* Only the soft limit, so that it can be raised again */
+	for (b = 0; pid_index.keys && b <= pid_index.mask; b++) {
+		if (pid_index.slots[b] != slot + 1 ||
+				(pid_index.keys[b] == job->pid && job->leader_done) ||
+				prlimit(pid_index.keys[b], RLIMIT_AS, NULL, &rl) < 0)
+			continue;
+		rl.rlim_cur = mem ? mem : rl.rlim_max;
+		if (rl.rlim_max != RLIM_INFINITY && rl.rlim_cur > rl.rlim_max)
+			rl.rlim_cur = rl.rlim_max;
+		prlimit(pid_index.keys[b], RLIMIT_AS, &rl, NULL);
+	}
+}
+
+/*
+ * parse_limit - A limit argument: "max" (0), a CPU percentage, or a
+ *     memory size in bytes with an optional K, M or G. Returns -1 if
+ *     it is not valid.
+ */
+	static long 
+parse_limit(const char *arg, int mem) 
+{
+	char *end;
+	long n;
+
+	if (!strcmp(arg, "max"))
+		return 0;
+	errno = 0;
+	n = strtol(arg, &end, 10);
+	if (errno || end == arg || n <= 0)
+		return -1;
+	if (mem) {
+		switch (toupper(*end)) {
+		case 'G': n *= 1024;  /* fall through */
+		case 'M': n *= 1024;  /* fall through */
+		case 'K': n *= 1024; end++; break;
+		}
+	}
+	return *end == '\0' ? n : -1;
+}
+
+/*
+ * cgroup_init - Make the shell's cgroup the first time a limit needs
+ *     it, with the cpu and memory controllers enabled for its children.
+ *     Returns 1 if job cgroups can be used.
+ */
+	static int 
+cgroup_init(void) 
+{
+	char line[MAXLINE], mnt[MAXLINE], path[MAXLINE], buf[2*MAXLINE];
+	char want[16];
+	FILE *fp;
+	int basefd, fd, n;
+
+	if (cg_state != 0)
+		return cg_state > 0;
+	cg_state = -1;
+
+	/* Where cgroup2 is mounted, and our cgroup under it */
+	mnt[0] = path[0] = '\0';
+	if ((fp = fopen("/proc/self/mounts", "r")) != NULL) {
+		while (fgets(line, MAXLINE, fp) != NULL)
+			if (sscanf(line, "%*s %1023s cgroup2", mnt) == 1 &&
+					strstr(line, " cgroup2 ") != NULL)
+				break;
+			else
+				mnt[0] = '\0';
+		fclose(fp);
+	}
+	if ((fp = fopen("/proc/self/cgroup", "r")) != NULL) {
+		while (fgets(line, MAXLINE, fp) != NULL)
+			if (!strncmp(line, "0::", 3)) {
+				line[strcspn(line, "\n")] = '\0';
+				strcpy(path, line + 3);
+			}
+		fclose(fp);
+	}
+	if (mnt[0] == '\0' || path[0] == '\0')
+		return 0;
+
+	/* The cgroup we run in holds processes, so ours is its sibling
+	 * (or a child of the root cgroup, which may hold both) */
+	snprintf(buf, sizeof(buf), "%s%s", mnt, path);
+	if ((cg_homefd = open(buf, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return 0;
+	*strrchr(path, '/') = '\0';
+	snprintf(buf, sizeof(buf), "%s%s", mnt, path);
+	if ((basefd = open(buf, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+		close(cg_homefd);
+		return 0;
+	}
+
+	/* Enable only the controllers that are not enabled already */
+	line[0] = want[0] = '\0';
+	if ((fd = openat(basefd, "cgroup.subtree_control", O_RDONLY)) >= 0) {
+		n = read(fd, line, MAXLINE-1);
+		close(fd);
+		line[n > 0 ? n : 0] = '\0';
+	}
+	if (!cgroup_has(line, "cpu"))
+		strcat(want, "+cpu ");
+	if (!cgroup_has(line, "memory"))
+		strcat(want, "+memory");
+	if (want[0] != '\0')
+		cgroup_write(basefd, "cgroup.subtree_control", want);
+
+	snprintf(buf, sizeof(buf), "tsh.%d", getpid());
+	if (mkdirat(basefd, buf, 0755) < 0 ||
+			(cg_dirfd = openat(basefd, buf, O_RDONLY | O_DIRECTORY |
+					   O_CLOEXEC)) < 0) {
+		close(basefd);
+		close(cg_homefd);
+		return 0;
+	}
+
+	/* Both controllers must reach the job cgroups */
+	if ((fd = openat(cg_dirfd, "cgroup.controllers", O_RDONLY)) >= 0) {
+		n = read(fd, line, MAXLINE-1);
+		close(fd);
+		line[n > 0 ? n : 0] = '\0';
+		if (cgroup_has(line, "cpu") && cgroup_has(line, "memory") &&
+				cgroup_write(cg_dirfd, "cgroup.subtree_control",
+					"+cpu +memory") == 0) {
+			cg_basefd = basefd;
+			cg_owner = getpid();
+			atexit(cgroup_cleanup);
+			return cg_state = 1;
+		}
+	}
+	close(cg_dirfd);
+	cg_dirfd = -1;
+	unlinkat(basefd, buf, AT_REMOVEDIR);
+	close(basefd);
+	close(cg_homefd);
+	return 0;
+}
+
+/*
+ * cgroup_cleanup - Remove the shell's cgroup as it exits. The cgroups
+ *     of jobs still running are emptied into the one the shell runs in
+ *     first, as a cgroup with processes cannot be removed.
+ */
+	static void 
+cgroup_cleanup(void) 
+{
+	char name[32], pid[16];
+	FILE *fp;
+	int i, fd;
+
+	if (cg_state <= 0 || getpid() != cg_owner)
+		return;
+	for (i = 0; i < job_slots; i++) {
+		if (!job_list[i].cgroup)
+			continue;
+		cgroup_name(name, job_list[i].jid);
+		strcat(name, "/cgroup.procs");
+		if ((fd = openat(cg_dirfd, name, O_RDONLY)) >= 0) {
+			if ((fp = fdopen(fd, "r")) == NULL) {
+				close(fd);
+				continue;
+			}
+			while (fgets(pid, sizeof(pid), fp) != NULL) {
+				pid[strcspn(pid, "\n")] = '\0';
+				cgroup_write(cg_homefd, "cgroup.procs", pid);
+			}
+			fclose(fp);
+		}
+		cgroup_name(name, job_list[i].jid);
+		unlinkat(cg_dirfd, name, AT_REMOVEDIR);
+		job_list[i].cgroup = 0;
+	}
+	snprintf(name, sizeof(name), "tsh.%d", (int)cg_owner);
+	close(cg_dirfd);
+	unlinkat(cg_basefd, name, AT_REMOVEDIR);
+	cg_state = -1;
+}
+
+/* cgroup_has - Whether name is one of the words of a controller list */
+	static int 
+cgroup_has(const char *list, const char *name) 
+{
+	size_t n = strlen(name);
+	const char *p;
+
+	for (p = list; (p = strstr(p, name)) != NULL; p += n)
+		if ((p == list || isspace((unsigned char)p[-1])) &&
+				(p[n] == '\0' || isspace((unsigned char)p[n])))
+			return 1;
+	return 0;
+}
+
+/* cgroup_write - Write val to a cgroup control file; 0 or -1 */
+	static int 
+cgroup_write(int dirfd, const char *file, const char *val) 
+{
+	int fd, rc;
+
+	if ((fd = openat(dirfd, file, O_WRONLY)) < 0)
+		return -1;
+	rc = write(fd, val, strlen(val)) == (ssize_t)strlen(val) ? 0 : -1;
+	close(fd);
+	return rc;
+}
+
+/* cgroup_name - "job<jid>", without stdio so handlers may call it */
+	static void 
+cgroup_name(char *buf, int jid) 
+{
+	char digits[12];
+	int n = 0;
+
+	do
+		digits[n++] = '0' + jid % 10;
+	while ((jid /= 10) > 0);
+	memcpy(buf, "job", 3);
+	buf += 3;
+	while (n > 0)
+		*buf++ = digits[--n];
+	*buf = '\0';
+}
+
+/*
+ * sched_builtin - The sched command. "sched [cpus L|all] [nice N]
+ *     [policy other|batch|idle]" sets how jobs started from now on are
+ *     scheduled; with %jid or a pid first, it changes a running job.
+ *     L is a list of CPUs and ranges, as in "0,2-3". With none given,
+ *     prints the current settings, "-" for those left to the shell's.
+ *     The same settings in front of a command apply to that job only.
+ */
+	void 
+sched_builtin(char **argv, int output_fd) 
+{
+	char buf[MAXLINE], cpus[MAXLINE/2], *bad;
+	struct job_t *job = NULL;
+	struct job_sched s, *cur;
+	int i = 1, n;
+
+	if (argv[1] != NULL && (argv[1][0] == '%' || isdigit(argv[1][0]))) {
+		if (argv[1][0] == '%')
+			job = getjobjid(job_list, atoi(argv[1] + 1));
+		else
+			job = getjobpid(job_list, atoi(argv[1]));
+		if (job == NULL) {
+			snprintf(buf, MAXLINE, "sched: %s: No such job\n", argv[1]);
+			goto out;
+		}
+		i = 2;
+	}
+
+	cur = job ? &job->sched : &job_sched_new;
+	if (argv[i] == NULL) {
+		if (cur->has_cpus && CPU_COUNT(&cur->cpus) == CPU_SETSIZE)
+			strcpy(cpus, "all");
+		else if (cur->has_cpus)
+			format_cpus(cpus, sizeof(cpus), &cur->cpus);
+		else
+			strcpy(cpus, "-");
+		snprintf(buf, MAXLINE, "cpus %s nice ", cpus);
+		if (cur->has_nice)
+			snprintf(buf + strlen(buf), MAXLINE - strlen(buf), "%d", cur->nice);
+		else
+			strcat(buf, "-");
+		snprintf(buf + strlen(buf), MAXLINE - strlen(buf), " policy %s\n",
+				cur->policy == SCHED_BATCH ? "batch" :
+				cur->policy == SCHED_IDLE ? "idle" :
+				cur->policy == SCHED_OTHER ? "other" : "-");
+		goto out;
+	}
+
+	if ((n = parse_sched(&argv[i], &s, &bad)) < 0) {
+		snprintf(buf, MAXLINE, "sched: %s: invalid value\n", bad);
+		goto out;
+	}
+	if (argv[i+n] != NULL) {
+		snprintf(buf, MAXLINE, "sched: usage: sched [%%jid|pid] "
+				"[cpus <list>|all] [nice <n>] [policy other|batch|idle] "
+				"[command...]\n");
+		goto out;
+	}
+
+	buf[0] = '\0';
+	if (job != NULL && sched_job(job, &s) < 0)
+		snprintf(buf, MAXLINE, "sched: %s: %s\n", argv[1], strerror(errno));
+	sched_merge(cur, &s);
+out:
+	if (buf[0] != '\0' && write(output_fd, buf, strlen(buf)) < 0)
+		unix_error("write error");
+	if(output_fd != STDOUT_FILENO)
+		close(output_fd);
+}
+
+/*
+ * parse_sched - Parse the settings at the start of argv into s, up to
+ *     the first word that is not one. Returns how many words they take,
+ *     or -1 with *bad (unless bad is NULL) set to a value not valid.
+ */
+	static int 
+parse_sched(char **argv, struct job_sched *s, char **bad) 
+{
+	char *end;
+	long n;
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	s->policy = -1;
+	for (i = 0; argv[i] != NULL && argv[i+1] != NULL; i += 2) {
+		if (!strcmp(argv[i], "cpus")) {
+			s->has_cpus = 1;
+			if (!strcmp(argv[i+1], "all")) {
+				for (n = 0; n < CPU_SETSIZE; n++)
+					CPU_SET(n, &s->cpus);
+			} else if (parse_cpus(argv[i+1], &s->cpus) < 0)
+				break;
+		} else if (!strcmp(argv[i], "nice")) {
+			errno = 0;
+			n = strtol(argv[i+1], &end, 10);
+			if (errno || end == argv[i+1] || *end != '\0' || n < -20 || n > 19)
+				break;
+			s->has_nice = 1;
+			s->nice = n;
+		} else if (!strcmp(argv[i], "policy")) {
+			if (!strcmp(argv[i+1], "other"))
+				s->policy = SCHED_OTHER;
+			else if (!strcmp(argv[i+1], "batch"))
+				s->policy = SCHED_BATCH;
+			else if (!strcmp(argv[i+1], "idle"))
+				s->policy = SCHED_IDLE;
+			else
+				break;
+		} else {
+			return i;
+		}
+	}
+	if (argv[i] == NULL || argv[i+1] == NULL)
+		return i;
+	if (bad != NULL)
+		*bad = argv[i+1];
+	return -1;
+}
+
+/*
+ * parse_cpus - Parse a list of CPUs and ranges, such as "0,2-3", into
+ *     set. Returns -1 if it is not valid or names no CPU.
+ */
+	static int 
+parse_cpus(const char *arg, cpu_set_t *set) 
+{
+	const char *p = arg;
+	char *end;
+	long lo, hi;
+
+	CPU_ZERO(set);
+	do {
+		if (!isdigit((unsigned char)*p))
+			return -1;
+		lo = hi = strtol(p, &end, 10);
+		if (*end == '-') {
+			if (!isdigit((unsigned char)end[1]))
+				return -1;
+			hi = strtol(end + 1, &end, 10);
+		}
+		if (lo > hi || hi >= CPU_SETSIZE)
+			return -1;
+		for (; lo <= hi; lo++)
+			CPU_SET(lo, set);
+		p = end + 1;
+	} while (*end == ',');
+	return *end == '\0' ? 0 : -1;
+}
+
+/* format_cpus - Write set as a list of CPUs and ranges, like "0,2-3" */
+	static void 
+format_cpus(char *buf, size_t size, cpu_set_t *set) 
+{
+	size_t len = 0;
+	int lo, hi;
+
+	buf[0] = '\0';
+	for (lo = 0; lo < CPU_SETSIZE && len < size; lo = hi + 1) {
+		if (!CPU_ISSET(lo, set)) {
+			hi = lo;
+			continue;
+		}
+		for (hi = lo; hi + 1 < CPU_SETSIZE && CPU_ISSET(hi + 1, set); hi++)
+			;
+		len += snprintf(buf + len, size - len, len ? ",%d" : "%d", lo);
+		if (hi > lo && len < size)
+			len += snprintf(buf + len, size - len, "-%d", hi);
+	}
+}
+
+/* sched_merge - Copy the settings given in from over those of to */
+	static void 
+sched_merge(struct job_sched *to, const struct job_sched *from) 
+{
+	if (from->has_cpus) {
+		to->has_cpus = 1;
+		to->cpus = from->cpus;
+	}
+	if (from->has_nice) {
+		to->has_nice = 1;
+		to->nice = from->nice;
+	}
+	if (from->policy >= 0)
+		to->policy = from->policy;
+}
+
+/*
+ * sched_job - Apply the settings given in s to every thread of every
+ *     process in the group of job, including any that the job's own
+ *     processes started, and record them in it. Returns -1 with errno
+ *     set if one of them could not be changed.
+ */
+	static int 
+sched_job(struct job_t *job, const struct job_sched *s) 
+{
+	char path[64];
+	struct dirent *d, *t;
+	DIR *proc, *task;
+	int err = 0;
+	pid_t pid;
+
+	if ((proc = opendir("/proc")) == NULL)
+		return -1;
+	while ((d = readdir(proc)) != NULL) {
+		if (!isdigit((unsigned char)d->d_name[0]) ||
+				getpgid(pid = atoi(d->d_name)) != job->pid)
+			continue;
+		snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+		if ((task = opendir(path)) == NULL)
+			continue;
+		while ((t = readdir(task)) != NULL)
+			if (isdigit((unsigned char)t->d_name[0]) &&
+					sched_task(atoi(t->d_name), s) < 0 && err == 0)
+				err = errno;
+		closedir(task);
+	}
+	closedir(proc);
+	sched_merge(&job->sched, s);
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * sched_task - Apply the settings given in s to thread tid. One that
+ *     has already exited is not an error. Returns -1 with errno set if
+ *     one could not be applied.
+ */
+	static int 
+sched_task(pid_t tid, const struct job_sched *s) 
+{
+	struct sched_param param = { 0 };
+
+	if ((s->has_cpus && sched_setaffinity(tid, sizeof(s->cpus), &s->cpus) < 0) ||
+			(s->policy >= 0 && sched_setscheduler(tid, s->policy, &param) < 0) ||
+			(s->has_nice && setpriority(PRIO_PROCESS, tid, s->nice) < 0))
+		return errno == ESRCH ? 0 : -1;
+	return 0;
+}
+
+/*
+ * parallel_builtin - The parallel command:
+ *         parallel [-j N] command [arg...] [::: input...]
+ *     runs command once for each input, taken from the ::: list or
+ *     else from the lines of the < file, at most N at a time (default:
+ *     one per CPU). Each "{}" in the arguments is replaced with the
+ *     input; if there is none, the input is added as a last argument.
+ *     The commands are not jobs, so they do not take job table slots;
+ *     the shell reaps them itself as they finish, through a pidfd for
+ *     each, and writes each one's output in input order. ctrl-c kills
+ *     the running commands and starts no more.
+ */
+	void 
+parallel_builtin(char **argv, const char *infile, int output_fd) 
+{
+	char buf[MAXLINE], **inputs = NULL, *text = NULL, *p, *nl, *path;
+	struct par_task *tasks = NULL;
+	struct pollfd *fds = NULL;
+	struct par_task **polled = NULL;
+	struct signalfd_siginfo si;
+	struct stat st;
+	sigset_t intr;
+	long njobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int ninputs = 0, cap = 0, next = 0, written = 0, running = 0;
+	int failed = 0, stopped = 0, fd, i, n, intr_fd = -1, can_splice = 1;
+	ssize_t nread;
+	char **cmd;
+
+	/* Options, command and inputs */
+	for (i = 1; argv[i] != NULL && !strcmp(argv[i], "-j"); i += 2)
+		if (argv[i+1] == NULL || (njobs = atol(argv[i+1])) < 1) {
+			sprintf(buf, "parallel: -j needs a positive count\n");
+			goto error;
+		}
+	cmd = &argv[i];
+	for (; argv[i] != NULL && strcmp(argv[i], ":::"); i++)
+		;
+	if (cmd[0] == NULL || cmd == &argv[i]) {
+		sprintf(buf, "parallel: usage: parallel [-j N] command [arg...] "
+				"[::: input...]\n");
+		goto error;
+	}
+	if (argv[i] != NULL) {
+		argv[i] = NULL;
+		inputs = &argv[i+1];
+		while (inputs[ninputs] != NULL)
+			ninputs++;
+	} else if (infile != NULL) {
+		if ((fd = open(infile, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+			snprintf(buf, MAXLINE, "parallel: %s: %s\n", infile,
+					strerror(errno));
+			goto error;
+		}
+		text = malloc(st.st_size + 1);
+		for (n = 0; text != NULL && n < st.st_size; n += nread)
+			if ((nread = read(fd, text + n, st.st_size - n)) <= 0)
+				break;
+		close(fd);
+		if (text == NULL)
+			unix_error("parallel error");
+		text[n] = '\0';
+
+		/* Every line is an input, blank ones too */
+		for (p = text; p < text + n; p = nl + 1) {
+			if ((nl = memchr(p, '\n', text + n - p)) == NULL)
+				nl = text + n;
+			*nl = '\0';
+			if (ninputs == cap &&
+					(inputs = realloc(inputs, (cap = cap ? 2*cap : 64) *
+							  sizeof(char *))) == NULL)
+				unix_error("parallel error");
+			inputs[ninputs++] = p;
+		}
+	} else {
+		sprintf(buf, "parallel: no inputs (use ::: or <)\n");
+		goto error;
+	}
+	if ((path = find_command(cmd[0])) == NULL) {
+		snprintf(buf, MAXLINE, "%s: %s\n", cmd[0], strerror(ENOENT));
+		goto error;
+	}
+	path = strdup(path);
+
+	tasks = calloc(ninputs ? ninputs : 1, sizeof(struct par_task));
+	fds = malloc((njobs + 1) * sizeof(struct pollfd));
+	polled = malloc(njobs * sizeof(struct par_task *));
+	if (tasks == NULL || fds == NULL || polled == NULL || path == NULL)
+		unix_error("parallel error");
+
+	/* SIGINT is blocked here in both modes; read it from a signalfd */
+	sigemptyset(&intr);
+	sigaddset(&intr, SIGINT);
+	intr_fd = signalfd(-1, &intr, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	while (written < ninputs) {
+		while (!stopped && running < njobs && next < ninputs) {
+			if (par_start(&tasks[next], cmd, path, inputs[next]) < 0)
+				tasks[next].done = 1;
+			else
+				running++;
+			next++;
+		}
+
+		/* Output while there is any, then the exit */
+		n = 0;
+		for (i = written; i < next; i++) {
+			if (tasks[i].done)
+				continue;
+			fds[n].fd = tasks[i].outfd >= 0 ? tasks[i].outfd : tasks[i].pidfd;
+			fds[n].events = POLLIN;
+			polled[n++] = &tasks[i];
+		}
+		fds[n].fd = intr_fd;
+		fds[n].events = POLLIN;
+		if (n > 0 && poll(fds, n + 1, -1) < 0 && errno != EINTR)
+			unix_error("poll error");
+
+		for (i = 0; i < n; i++) {
+			if (!fds[i].revents)
+				continue;
+			if (polled[i]->outfd >= 0) {
+				par_read(polled[i], polled[i] == &tasks[written], output_fd,
+						&can_splice);
+			} else if (waitpid(polled[i]->pid, &polled[i]->status, 0) > 0) {
+				close(polled[i]->pidfd);
+				polled[i]->done = 1;
+				running--;
+			}
+		}
+		if (n > 0 && fds[n].revents &&
+				read(intr_fd, &si, sizeof(si)) == sizeof(si)) {
+			stopped = 1;
+			for (i = written; i < next; i++)
+				if (!tasks[i].done)
+					kill(-tasks[i].pid, SIGINT);
+		}
+
+		/* Everything finished before the first unfinished command */
+		for (; written < ninputs && tasks[written].done; written++) {
+			if (tasks[written].len > 0 &&
+					write(output_fd, tasks[written].out, tasks[written].len) < 0)
+				unix_error("write error");
+			free(tasks[written].out);
+			if (tasks[written].pid != 0 && tasks[written].status != 0)
+				failed++;
+		}
+		if (stopped && running == 0)
+			break;
+	}
+
+	buf[0] = '\0';
+	if (stopped)
+		sprintf(buf, "parallel: interrupted, %d of %d commands not run\n",
+				ninputs - next, ninputs);
+	else if (failed)
+		sprintf(buf, "parallel: %d of %d commands failed\n", failed, ninputs);
+	if (intr_fd >= 0)
+		close(intr_fd);
+	free(path);
+	free(tasks);
+	free(fds);
+	free(polled);
+error:
+	if (text != NULL) {
+		free(text);
+		free(inputs);
+	}
+	if (write(output_fd, buf, strlen(buf)) < 0)
+		unix_error("write error");
+	if(output_fd != STDOUT_FILENO)
+		close(output_fd);
+}
+
+/*
+ * par_start - Start t: the command in argv with input filled in, its
+ *     stdout on a pipe, in a process group of its own. On failure the
+ *     error goes in t's output and -1 is returned.
+ */
+	static int 
+par_start(struct par_task *t, char **argv, const char *path, char *input)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	char **args, *arg, *q;
+	const char *p;
+	sigset_t empty;
+	int fds[2], i, n, subst = 0, err;
+	size_t len;
+
+	/* Fill in the template */
+	for (n = 0; argv[n] != NULL; n++)
+		;
+	if ((args = malloc((n + 2) * sizeof(char *))) == NULL)
+		unix_error("parallel error");
+	for (i = 0; argv[i] != NULL; i++) {
+		if (strstr(argv[i], "{}") == NULL) {
+			args[i] = argv[i];
+			continue;
+		}
+		for (n = 0, p = argv[i]; (p = strstr(p, "{}")) != NULL; p += 2)
+			n++;
+		len = strlen(argv[i]) + n * (strlen(input) - 2);
+		if ((arg = q = malloc(len + 1)) == NULL)
+			unix_error("parallel error");
+		for (p = argv[i]; *p != '\0'; )
+			if (p[0] == '{' && p[1] == '}') {
+				q = stpcpy(q, input);
+				p += 2;
+			} else {
+				*q++ = *p++;
+			}
+		*q = '\0';
+		args[i] = arg;
+		subst = 1;
+	}
+	n = i;
+	if (!subst)
+		args[n++] = input;
+	args[n] = NULL;
+
+	err = 0;
+	fds[0] = -1;
+	if (pipe2(fds, O_CLOEXEC) < 0)
+		err = errno;
+	if (err == 0) {
+		Sigemptyset(&empty);
+		posix_spawn_file_actions_init(&actions);
+		posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+		posix_spawnattr_init(&attr);
+		posix_spawnattr_setflags(&attr,
+				POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+		posix_spawnattr_setpgroup(&attr, 0);
+		posix_spawnattr_setsigmask(&attr, &empty);
+		err = posix_spawn(&t->pid, path, &actions, &attr, args, environ);
+		posix_spawnattr_destroy(&attr);
+		posix_spawn_file_actions_destroy(&actions);
+		close(fds[1]);
+	}
+	for (i = 0; argv[i] != NULL; i++)
+		if (args[i] != argv[i])
+			free(args[i]);
+	free(args);
+
+	if (err == 0 && (t->pidfd = syscall(SYS_pidfd_open, t->pid, 0)) < 0) {
+		err = errno;
+		kill(t->pid, SIGKILL);
+		waitpid(t->pid, NULL, 0);
+	}
+	if (err != 0) {
+		if (fds[0] >= 0)
+			close(fds[0]);
+		t->pid = 0;
+		t->cap = MAXLINE;
+		if ((t->out = malloc(t->cap)) == NULL)
+			unix_error("parallel error");
+		t->len = snprintf(t->out, t->cap, "%s: %s\n", argv[0], strerror(err));
+		return -1;
+	}
+	t->outfd = fds[0];
+	return 0;
+}
+
+/*
+ * par_read - Append what t's command has written to its output, or
+ *     close the pipe at EOF. The head of the queue, whose output can go
+ *     out at once, streams it instead: moved from its pipe by splice()
+ *     when output_fd allows, so that it is never copied through the
+ *     shell, else read and written in MAXLINE*64 byte chunks. Clears
+ *     *can_splice if output_fd turns out not to take splice().
+ */
+	static void 
+par_read(struct par_task *t, int head, int output_fd, int *can_splice)
+{
+	char buf[64*MAXLINE];
+	ssize_t n = -1;
+
+	if (head) {
+		if (t->len > 0) {
+			if (write(output_fd, t->out, t->len) < 0)
+				unix_error("write error");
+			t->len = 0;
+		}
+		if (*can_splice && (n = splice(t->outfd, NULL, output_fd, NULL,
+						sizeof(buf), SPLICE_F_MOVE)) < 0 && errno == EINVAL)
+			*can_splice = 0;
+		if (!*can_splice && (n = read(t->outfd, buf, sizeof(buf))) > 0 &&
+				write(output_fd, buf, n) < 0)
+			unix_error("write error");
+		if (n == 0 || (n < 0 && errno != EINTR)) {
+			close(t->outfd);
+			t->outfd = -1;
+		}
+		return;
+	}
+
+	if (t->cap - t->len < MAXLINE &&
+			(t->out = realloc(t->out, t->cap = t->cap ? 2*t->cap : 2*MAXLINE)) == NULL)
+		unix_error("parallel error");
+	if ((n = read(t->outfd, t->out + t->len, t->cap - t->len)) > 0) {
+		t->len += n;
+	} else if (n == 0 || errno != EINTR) {
+		close(t->outfd);
+		t->outfd = -1;
+	}
+}
+
+/*
+ * wait_builtin - The wait command: wait until the given jobs (%jid or
+ *     pid), or with none every background job, have finished. Stopped
+ *     jobs are not waited for. ctrl-c stops the wait.
+ */
+	void 
+wait_builtin(char **argv) 
+{
+	siginfo_t si;
+	sigset_t set;
+	int i;
+
+	for (i = 1; argv[i] != NULL; i++)
+		if ((argv[i][0] == '%' ? getjobjid(job_list, atoi(argv[i] + 1)) :
+					getjobpid(job_list, atoi(argv[i]))) == NULL)
+			printf("wait: %s: No such job\n", argv[i]);
+
+	/* SIGCHLD and SIGINT are blocked here in both modes, so take
+	 * them directly and reap as the handler or event loop would */
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	sigaddset(&set, SIGINT);
+	while (wait_pending(argv)) {
+		if (sigwaitinfo(&set, &si) < 0) {
+			if (errno == EINTR)
+				continue;
+			unix_error("sigwaitinfo error");
+		}
+		if (si.si_signo == SIGINT)
+			break;
+		if (event_mode)
+			event_reap();
+		else {
+			sigchld_handler(SIGCHLD);
+			chld_drain();
+		}
+	}
+}
+
+/* wait_pending - Returns 1 while a job that wait is waiting for runs */
+	static int 
+wait_pending(char **argv) 
+{
+	struct job_t *job;
+	int i;
+
+	if (argv[1] == NULL) {
+		for (i = 0; i < job_slots; i++)
+			if (job_list[i].pid != 0 && job_list[i].state == BG)
+				return 1;
+		return 0;
+	}
+	for (i = 1; argv[i] != NULL; i++) {
+		job = argv[i][0] == '%' ? getjobjid(job_list, atoi(argv[i] + 1)) :
+			getjobpid(job_list, atoi(argv[i]));
+		if (job != NULL && job->state == BG)
+			return 1;
+	}
+	return 0;
+}
+
+/*****************
+ * Command history
+ *****************/
+
+/*
+ * hist_init - Open and map the history file and its index. History
+ *     still works for this session, without the file, if it cannot be
+ *     opened; without the index file it is only indexed in memory.
+ */
+	void 
+hist_init(void) 
+{
+	char path[MAXLINE];
+	const char *file = getenv("TSH_HISTFILE"), *home;
+	struct stat st;
+
+	if (file == NULL) {
+		if (!isatty(STDIN_FILENO) || (home = getenv("HOME")) == NULL)
+			return;
+		snprintf(path, MAXLINE, "%s/.tsh_history", home);
+		file = path;
+	}
+	if (file[0] == '\0' || strlen(file) + 5 > MAXLINE)
+		return;
+	if ((hist_fd = open(file, O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC, 0600)) < 0)
+		return;
+	if (fstat(hist_fd, &st) < 0 || st.st_size == 0)
+		return;
+	hist_map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, hist_fd, 0);
+	if (hist_map == MAP_FAILED) {
+		hist_map = NULL;
+		return;
+	}
+	hist_size = st.st_size;
+
+	/* Finish a last line cut short, so ours start on a line of their own */
+	if (hist_map[hist_size-1] != '\n' && write(hist_fd, "\n", 1) < 0) {
+		close(hist_fd);
+		hist_fd = -1;
+	}
+
+	if (file != path)
+		strcpy(path, file);
+	strcat(path, ".idx");
+	if ((hist_idx_fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0600)) < 0 ||
+		fstat(hist_idx_fd, &st) < 0 || st.st_size < sizeof(struct hist_header))
+		return;
+	hist_idx_map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, hist_idx_fd, 0);
+	if (hist_idx_map == MAP_FAILED)
+		hist_idx_map = NULL;
+	else
+		hist_idx_size = st.st_size;
+}
+
+/*
+ * hist_add - Append a line read at the prompt to the history; blank
+ *     lines are left out
+ */
+	void 
+hist_add(const char *line) 
+{
+	struct iovec iov[2];
+
+	if (line[strspn(line, " \t")] == '\0')
+		return;
+	if (hist_nnew == hist_newcap) {
+		hist_newcap = hist_newcap ? 2 * hist_newcap : 64;
+		if ((hist_new = realloc(hist_new, hist_newcap * sizeof(char *))) == NULL)
+			unix_error("realloc error");
+	}
+	if ((hist_new[hist_nnew] = strdup(line)) == NULL)
+		unix_error("strdup error");
+	hist_nnew++;
+
+	/* One write, so that shells sharing the file do not interleave */
+	if (hist_fd >= 0) {
+		iov[0].iov_base = (char *)line;
+		iov[0].iov_len = strlen(line);
+		iov[1].iov_base = "\n";
+		iov[1].iov_len = 1;
+		if (writev(hist_fd, iov, 2) < 0) {
+			close(hist_fd);
+			hist_fd = -1;
+		}
+	}
+}
+
+/*
+ * hist_expand - If *cmdline starts with a history reference, replace
+ *     it with the line it names and print the result; *cmdline, of
+ *     *cap bytes, is grown with realloc() if that is needed. "!!"
+ *     is the last line, "!n" line n, "!-n" the nth last, "!?str[?]"
+ *     the last line containing str and "!str" the last one starting
+ *     with str. The rest of cmdline is kept after it. Returns 1 if
+ *     the line was expanded, 0 if it has no reference, and -1 after
+ *     printing an error if the line named does not exist.
+ */
+	int 
+hist_expand(char **cmdlinep, size_t *cap) 
+{
+	char *cmdline = *cmdlinep, *end;
+	const char *line;
+	size_t len, rest;
+	long n;
+	int total, found;
 
-	pid_t pid; 
-	pid = getpid();
-	if ( (pid == tsh_pid) || (pid == fg_pid) )
-		Kill(-fg_pid,SIGINT);
+	if (cmdline[0] != '!' || cmdline[1] == '\0' || isspace((unsigned char)cmdline[1]))
+		return 0;
+	hist_index();
+	total = hist_nlines + hist_nnew;
+
+	if (cmdline[1] == '!') {
+		found = total - 1;
+		end = cmdline + 2;
+	} else if (isdigit((unsigned char)cmdline[1]) ||
+			   (cmdline[1] == '-' && isdigit((unsigned char)cmdline[2]))) {
+		n = strtol(cmdline + 1, &end, 10);
+		found = n < 0 ? total + n : n - 1;
+	} else if (cmdline[1] == '?') {
+		if ((end = strchr(cmdline + 2, '?')) == NULL)
+			end = cmdline + strlen(cmdline);
+		found = hist_search(cmdline + 2, end - (cmdline + 2), 0);
+		if (*end == '?')
+			end++;
+	} else {
+		end = cmdline + 1 + strcspn(cmdline + 1, " \t");
+		found = hist_search(cmdline + 1, end - (cmdline + 1), 1);
+	}
 
-	return;
+	if (found < 0 || found >= total) {
+		printf("tsh: %.*s: event not found\n", (int)(end - cmdline), cmdline);
+		fflush(stdout);
+		return -1;
+	}
+	line = hist_line(found, &len);
+	rest = strlen(end) + 1;
+	if (len + rest > *cap) {
+		n = end - cmdline;
+		*cap = len + rest;
+		if ((cmdline = *cmdlinep = realloc(cmdline, *cap)) == NULL)
+			unix_error("realloc error");
+		end = cmdline + n;
+	}
+	memmove(cmdline + len, end, rest);
+	memcpy(cmdline, line, len);
+	printf("%s\n", cmdline);
+	fflush(stdout);
+	return 1;
 }
 
 /*
- * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
- *     the user types ctrl-z at the keyboard. Catch it and suspend the
- *     foreground job by sending it a SIGTSTP.  
+ * history_builtin - The history command: list the history, numbered,
+ *     or with "history n" its last n lines
  */
 	void 
-sigtstp_handler(int sig) 
-{        
+history_builtin(char **argv, int output_fd) 
+{
+	char buf[MAXLINE+16];
+	const char *p, *q, *end = hist_map + hist_size;
+	size_t len;
+	int i, total, first = 0;
+
+	hist_index();
+	total = hist_nlines + hist_nnew;
+	if (argv[1] != NULL && atoi(argv[1]) >= 0 && atoi(argv[1]) < total)
+		first = total - atoi(argv[1]);
+
+	/* Walk the file rather than look up each line */
+	if (first < hist_nlines) {
+		p = hist_line(first, &len);
+		for (i = first; i < hist_nlines; i++, p = q + 1) {
+			if ((q = memchr(p, '\n', end - p)) == NULL)
+				q = end;
+			snprintf(buf, sizeof(buf), "%5d  %.*s\n", i + 1,
+					 (int)(q - p < MAXLINE ? q - p : MAXLINE), p);
+			if (write(output_fd, buf, strlen(buf)) < 0)
+				unix_error("write error");
+		}
+	}
+	for (i = first > hist_nlines ? first : hist_nlines; i < total; i++) {
+		snprintf(buf, sizeof(buf), "%5d  %s\n", i + 1, hist_new[i - hist_nlines]);
+		if (write(output_fd, buf, strlen(buf)) < 0)
+			unix_error("write error");
+	}
 
-	//Delete fg job from list and send SIGTSTP to all processes in fg group 
-	//Only to be done when parent shell or fg job is sent this signal.
-	//Else just send SIGTSTP to process with id "pid"
+	if(output_fd != STDOUT_FILENO)
+		close(output_fd);
+}
 
-	pid_t pid; 
-	pid = getpid();
-	if ( (pid == tsh_pid) || (pid == fg_pid) )
-		Kill(-fg_pid,SIGTSTP);
+/*
+ * hist_index - Take the chunks of the index file that still match the
+ *     history file, index the lines after them, and append the new
+ *     complete chunks to the index file. Done the first time it is
+ *     needed; the history is searched without the index if there is
+ *     no memory for it.
+ */
+	static void 
+hist_index(void) 
+{
+	const struct hist_chunk *ck;
+	struct hist_header hdr;
+	struct stat st;
+	size_t off = 0, valid;
+	int i, n, cap = 0, save;
+
+	if (hist_indexed)
+		return;
+	hist_indexed = 1;
+	if (hist_map == NULL || fstat(hist_fd, &st) < 0)
+		return;
+
+	/* Saved chunks must follow one another and still match the file */
+	memcpy(hdr.magic, HIST_MAGIC, sizeof(hdr.magic));
+	hdr.ino = st.st_ino;
+	if (hist_idx_map != NULL && !memcmp(hist_idx_map, &hdr, sizeof(hdr))) {
+		hist_saved = (struct hist_chunk *)(hist_idx_map + sizeof(hdr));
+		n = (hist_idx_size - sizeof(hdr)) / sizeof(struct hist_chunk);
+		for (; hist_nsaved < n; hist_nsaved++) {
+			ck = &hist_saved[hist_nsaved];
+			if (ck->start[0] != off || ck->start[HIST_BLOCK] <= off ||
+				ck->start[HIST_BLOCK] > hist_size ||
+				ck->check != hist_check(ck->start[HIST_BLOCK]))
+				break;
+			off = ck->start[HIST_BLOCK];
+		}
+	}
+	valid = hist_nsaved;
+	hist_nlines = hist_nsaved * HIST_CHUNK;
+
+	while (off < hist_size) {
+		if (hist_nbuilt == cap) {
+			cap = cap ? 2 * cap : 4;
+			if ((hist_built = realloc(hist_built, cap * sizeof(struct hist_chunk))) == NULL) {
+				hist_nsaved = hist_nbuilt = hist_nlines = 0;
+				return;
+			}
+		}
+		hist_nlines += hist_build(&hist_built[hist_nbuilt], off);
+		off = hist_built[hist_nbuilt++].start[HIST_BLOCK];
+	}
 
-	else
-		Kill(pid,SIGTSTP);
+	/* Save the complete chunks, unless another shell has changed the
+	 * index file since we mapped it */
+	for (save = 0; save < hist_nbuilt; save++)
+		if ((save == hist_nbuilt - 1 && hist_nlines % HIST_CHUNK != 0) ||
+			hist_map[hist_built[save].start[HIST_BLOCK] - 1] != '\n')
+			break;
+	if (save == 0 || hist_idx_fd < 0 || flock(hist_idx_fd, LOCK_EX) < 0)
+		return;
+	if (fstat(hist_idx_fd, &st) == 0 && st.st_size == hist_idx_size &&
+		ftruncate(hist_idx_fd, valid ? sizeof(hdr) + valid * sizeof(struct hist_chunk) : 0) == 0 &&
+		(valid > 0 || pwrite(hist_idx_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr))) {
+		for (i = 0; i < save; i++)
+			if (pwrite(hist_idx_fd, &hist_built[i], sizeof(struct hist_chunk),
+					   sizeof(hdr) + (valid + i) * sizeof(struct hist_chunk)) !=
+				sizeof(struct hist_chunk))
+				break;
+	}
+	flock(hist_idx_fd, LOCK_UN);
+}
 
-	return;
+/*
+ * hist_build - Index up to HIST_CHUNK lines of hist_map from offset
+ *     off into ck. Returns the number of lines.
+ */
+	static int 
+hist_build(struct hist_chunk *ck, size_t off) 
+{
+	unsigned char buf[MAXLINE+2] = { 1, 1 };
+	const char *p = hist_map + off, *q, *end = hist_map + hist_size;
+	size_t len, j;
+	uint64_t bit;
+	int n;
+
+	memset(ck, 0, sizeof(*ck));
+	for (n = 0; n < HIST_CHUNK && p < end; n++, p = q + 1) {
+		if (n % HIST_BLOCK == 0)
+			ck->start[n / HIST_BLOCK] = p - hist_map;
+		if ((q = memchr(p, '\n', end - p)) == NULL)
+			q = end;
+
+		/* Lines longer than can be read at the prompt are only
+		 * indexed up to MAXLINE bytes */
+		len = q - p < MAXLINE ? q - p : MAXLINE;
+		memcpy(buf + 2, p, len);
+		bit = 1ULL << (n / HIST_BLOCK);
+		for (j = 0; j < len; j++) {
+			ck->rows[hist_row(buf[j], buf[j+1], buf[j+2], 0)] |= bit;
+			ck->rows[hist_row(buf[j], buf[j+1], buf[j+2], 1)] |= bit;
+			HIST_SETPAIR(ck, 2, buf[j+2]);
+			if (j + 1 < len)
+				HIST_SETPAIR(ck, buf[j+2], buf[j+3]);
+		}
+	}
+	off = p < end ? p - hist_map : hist_size;
+	for (j = (n + HIST_BLOCK - 1) / HIST_BLOCK; j <= HIST_BLOCK; j++)
+		ck->start[j] = off;
+	ck->check = hist_check(off);
+	return n;
 }
 
-/*********************
- * End signal handlers
- *********************/
+/* hist_chunk - Chunk c of the index, saved or built */
+	static const struct hist_chunk *
+hist_chunk(int c) 
+{
+	return c < hist_nsaved ? &hist_saved[c] : &hist_built[c - hist_nsaved];
+}
+
+/* hist_line - Line n of the history, counting from 0, and its length */
+	static const char *
+hist_line(int n, size_t *len) 
+{
+	const struct hist_chunk *ck;
+	const char *p, *q, *end;
+	int b;
+
+	if (n >= hist_nlines) {
+		*len = strlen(hist_new[n - hist_nlines]);
+		return hist_new[n - hist_nlines];
+	}
+	ck = hist_chunk(n / HIST_CHUNK);
+	b = n % HIST_CHUNK / HIST_BLOCK;
+	p = hist_map + ck->start[b];
+	end = hist_map + ck->start[b+1];
+	for (n %= HIST_BLOCK; ; n--, p = q + 1) {
+		if ((q = memchr(p, '\n', end - p)) == NULL)
+			q = end;
+		if (n == 0)
+			break;
+	}
+	*len = q - p;
+	return p;
+}
+
+/*
+ * hist_search - Returns the number of the last history line that
+ *     starts with (if prefix) or contains the len bytes at str, or -1
+ */
+	static int 
+hist_search(const char *str, size_t len, int prefix) 
+{
+	unsigned char buf[MAXLINE+2] = { 1, 1 };
+	unsigned rows[2*MAXLINE];
+	const char *line[HIST_BLOCK+1], *p, *q, *end;
+	const struct hist_chunk *ck;
+	uint64_t mask;
+	size_t n;
+	int c, b, i, nrows = 0;
+
+	for (i = hist_nlines + hist_nnew - 1; i >= hist_nlines; i--) {
+		p = hist_line(i, &n);
+		if (HIST_MATCH(p, n, str, len, prefix))
+			return i;
+	}
+	if (len == 0 || len > MAXLINE)
+		return -1;
+
+	/* A prefix is looked up with the two lead bytes in front */
+	memcpy(buf + 2, str, len);
+	for (i = prefix ? 0 : 2; i < len; i++) {
+		rows[nrows++] = hist_row(buf[i], buf[i+1], buf[i+2], 0);
+		rows[nrows++] = hist_row(buf[i], buf[i+1], buf[i+2], 1);
+	}
+
+	for (c = (hist_nlines + HIST_CHUNK - 1) / HIST_CHUNK - 1; c >= 0; c--) {
+		ck = hist_chunk(c);
+		if (!prefix && len <= 2 &&
+			!(len == 2 ? HIST_HASPAIR(ck, buf[2], buf[3]) : HIST_HASPAIR(ck, 2, buf[2])))
+			continue;
+		for (mask = ~0ULL, i = 0; i < nrows && mask; i++)
+			mask &= ck->rows[rows[i]];
+		for (; mask != 0; mask &= ~(1ULL << b)) {
+			b = 63 - __builtin_clzll(mask);
+			p = hist_map + ck->start[b];
+			end = hist_map + ck->start[b+1];
+			if (memmem(p, end - p, str, len) == NULL)
+				continue;
+			for (n = 0, p = q = hist_map + ck->start[b]; p < end; p = q + 1) {
+				line[n++] = p;
+				if ((q = memchr(p, '\n', end - p)) == NULL)
+					q = end;
+			}
+			line[n] = q + 1;
+			while (n-- > 0)
+				if (HIST_MATCH(line[n], line[n+1] - 1 - line[n], str, len, prefix))
+					return c * HIST_CHUNK + b * HIST_BLOCK + n;
+		}
+	}
+	return -1;
+}
+
+/* hist_row - The row of the trigram abc by hash h, 0 or 1 */
+	static unsigned 
+hist_row(unsigned a, unsigned b, unsigned c, int h) 
+{
+	uint32_t t = a | b << 8 | c << 16;
+
+	return (t * (h ? 0x85ebca6bu : 2654435761u)) >> 19 & (HIST_ROWS - 1);
+}
+
+/*
+ * hist_check - Hash of the 64 bytes of hist_map before end. A saved
+ *     chunk is only used if the file still has the same bytes there,
+ *     as it will unless the history was rewritten rather than added to.
+ */
+	static uint64_t 
+hist_check(size_t end) 
+{
+	uint64_t h = 14695981039346656037ULL;   /* FNV-1a */
+	size_t i;
+
+	for (i = end > 64 ? end - 64 : 0; i < end; i++)
+		h = (h ^ (unsigned char)hist_map[i]) * 1099511628211ULL;
+	return h;
+}
 
 /***********************************************
  * Helper routines that manipulate the job list
@@ -650,98 +4053,206 @@ clearjob(struct job_t *job) {
 	job->pid = 0;
 	job->jid = 0;
 	job->state = UNDEF;
+	job->nprocs = 0;
+	job->leader_done = 0;
+	job->timed = 0;
+	memset(&job->usage, 0, sizeof(job->usage));
+	job->cpu_max = 0;
+	job->mem_max = 0;
+	job->cgroup = 0;
+	memset(&job->sched, 0, sizeof(job->sched));
+	job->sched.policy = -1;
+	job->last = 0;
+	job->status = 0;
+	job->client = -1;
 	job->cmdline[0] = '\0';
 }
 
-/* initjobs - Initialize the job list */
+/* initjobs - Allocate and initialize the job list */
 void 
-initjobs(struct job_t *job_list) {
-	int i;
-
-	for (i = 0; i < MAXJOBS; i++)
-		clearjob(&job_list[i]);
+initjobs(void) {
+	job_list = NULL;
+	job_slots = 0;
+	nfree = 0;
+	max_jid = 0;
+	fg_slot = -1;
+	if (grow_jobs() == NULL)
+		unix_error("initjobs error");
 }
 
 /* maxjid - Returns largest allocated job ID */
 	int 
 maxjid(struct job_t *job_list) 
 {
-	int i, max=0;
-
-	for (i = 0; i < MAXJOBS; i++)
-		if (job_list[i].jid > max)
-			max = job_list[i].jid;
-	return max;
+	return max_jid;
 }
 
 /* addjob - Add a job to the job list */
 	int 
 addjob(struct job_t *job_list, pid_t pid, int state, char *cmdline) 
+{
+	int i, n;
+	sigset_t mask, prev;
+
+	if (pid < 1)
+		return 0;
+
+	/* The handlers must never see the table half updated */
+	sigfillset(&mask);
+	Sigprocmask(SIG_BLOCK, &mask, &prev);
+
+	/* Skip job IDs still in use after nextjid wraps around; all
+	 * MAXJID of them may be */
+	for (n = 0; n < MAXJID && index_find(&jid_index, nextjid) >= 0; n++)
+		if (++nextjid > MAXJID)
+			nextjid = 1;
+
+	if (n == MAXJID || (nfree == 0 && (job_list = grow_jobs()) == NULL) ||
+			index_reserve(&pid_index, 1) < 0 ||
+			index_reserve(&jid_index, 1) < 0) {
+		Sigprocmask(SIG_SETMASK, &prev, NULL);
+		printf("Tried to create too many jobs\n");
+		return 0;
+	}
+
+	i = free_slot_pop();
+	job_list[i].pid = pid;
+	job_list[i].jid = nextjid++;
+	if (nextjid > MAXJID)
+		nextjid = 1;
+	job_list[i].nprocs = 1;
+	job_list[i].last = pid;
+	job_list[i].status = W_EXITCODE(127, 0);
+	job_list[i].client = -1;
+	clock_gettime(CLOCK_MONOTONIC, &job_list[i].start);
+	snprintf(job_list[i].cmdline, MAXLINE, "%s", cmdline);
+	set_job_state(i, state);
+	index_insert(&pid_index, pid, i);
+	index_insert(&jid_index, job_list[i].jid, i);
+	if (job_list[i].jid > max_jid)
+		max_jid = job_list[i].jid;
+	Sigprocmask(SIG_SETMASK, &prev, NULL);
+
+	if(verbose){
+		printf("Added job [%d] %d %s\n", job_list[i].jid, job_list[i].pid, job_list[i].cmdline);
+	}
+	return 1;
+}
+
+/* addjobproc - Add process pid to the pipeline job led by leader */
+	int 
+addjobproc(struct job_t *job_list, pid_t leader, pid_t pid) 
 {
 	int i;
+	sigset_t mask, prev;
 
 	if (pid < 1)
 		return 0;
 
-	for (i = 0; i < MAXJOBS; i++) {
-		if (job_list[i].pid == 0) {
-			job_list[i].pid = pid;
-			job_list[i].state = state;
-			job_list[i].jid = nextjid++;
-			if (nextjid > MAXJOBS)
-				nextjid = 1;
-			strcpy(job_list[i].cmdline, cmdline);
-			if(verbose){
-				printf("Added job [%d] %d %s\n", job_list[i].jid, job_list[i].pid, job_list[i].cmdline);
-			}
-			return 1;
-		}
+	sigfillset(&mask);
+	Sigprocmask(SIG_BLOCK, &mask, &prev);
+	if ((i = index_find(&pid_index, leader)) < 0 ||
+			index_reserve(&pid_index, 1) < 0) {
+		Sigprocmask(SIG_SETMASK, &prev, NULL);
+		return 0;
 	}
-	printf("Tried to create too many jobs\n");
-	return 0;
+	index_insert(&pid_index, pid, i);
+	job_list[i].nprocs++;
+	Sigprocmask(SIG_SETMASK, &prev, NULL);
+	return 1;
 }
 
-/* deletejob - Delete a job whose PID=pid from the job list */
+/*
+ * deletejob - Delete process pid from its job, and the job from the
+ *     job list once the last process of its pipeline is gone. The
+ *     job's own PID keeps finding the job until then; Linux does not
+ *     reuse it while it still names the job's process group.
+ */
 	int 
 deletejob(struct job_t *job_list, pid_t pid) 
 {
 	int i;
+	sigset_t mask, prev;
 
 	if (pid < 1)
 		return 0;
 
-	for (i = 0; i < MAXJOBS; i++) {
-		if (job_list[i].pid == pid) {
-			clearjob(&job_list[i]);
-			nextjid = maxjid(job_list)+1;
-			return 1;
+	sigfillset(&mask);
+	Sigprocmask(SIG_BLOCK, &mask, &prev);
+	if ((i = index_find(&pid_index, pid)) < 0) {
+		Sigprocmask(SIG_SETMASK, &prev, NULL);
+		return 0;
+	}
+	if (pid != job_list[i].pid)
+		index_remove(&pid_index, pid);
+	else if (job_list[i].leader_done) {
+		Sigprocmask(SIG_SETMASK, &prev, NULL);
+		return 0;
+	} else
+		job_list[i].leader_done = 1;
+	if (--job_list[i].nprocs > 0) {
+		Sigprocmask(SIG_SETMASK, &prev, NULL);
+		return 1;
+	}
+	index_remove(&pid_index, job_list[i].pid);
+	index_remove(&jid_index, job_list[i].jid);
+	if (job_list[i].state == FG)
+		fg_status = job_list[i].status;
+
+	/* A job server client is waiting for how it ended */
+	if (job_list[i].client >= 0) {
+		int code = exit_code(job_list[i].status);
+		send(job_list[i].client, &code, sizeof(code), MSG_NOSIGNAL);
+		close(job_list[i].client);
+		job_list[i].client = -1;
+	}
+	set_job_state(i, UNDEF);
+
+	/* Its cgroup is empty now; rmdir is async-signal-safe */
+	if (job_list[i].cgroup) {
+		char name[16];
+		cgroup_name(name, job_list[i].jid);
+		unlinkat(cg_dirfd, name, AT_REMOVEDIR);
+	}
+
+	/* Keep what a timed job used for run_command() to report */
+	if (job_list[i].timed) {
+		clock_gettime(CLOCK_MONOTONIC, &last_timed_real);
+		last_timed_real.tv_sec -= job_list[i].start.tv_sec;
+		if ((last_timed_real.tv_nsec -= job_list[i].start.tv_nsec) < 0) {
+			last_timed_real.tv_sec--;
+			last_timed_real.tv_nsec += 1000000000L;
 		}
+		last_timed_usage = job_list[i].usage;
+		last_timed_done = 1;
 	}
-	return 0;
+
+	/* Find the new largest job ID; amortized O(1), since each ID
+	 * stepped over here was freed since the last such scan */
+	if (job_list[i].jid == max_jid)
+		while (max_jid > 0 && index_find(&jid_index, max_jid) < 0)
+			max_jid--;
+	clearjob(&job_list[i]);
+	free_slot_push(i);
+	nextjid = maxjid(job_list)+1;
+	Sigprocmask(SIG_SETMASK, &prev, NULL);
+	return 1;
 }
 
 /* fgpid - Return PID of current foreground job, 0 if no such job */
 pid_t 
 fgpid(struct job_t *job_list) {
-	int i;
-
-	for (i = 0; i < MAXJOBS; i++)
-		if (job_list[i].state == FG)
-			return job_list[i].pid;
-	return 0;
+	return fg_slot >= 0 ? job_list[fg_slot].pid : 0;
 }
 
-/* getjobpid  - Find a job (by PID) on the job list */
+/* getjobpid  - Find a job (by the PID of any of its processes) */
 struct job_t 
 *getjobpid(struct job_t *job_list, pid_t pid) {
 	int i;
 
-	if (pid < 1)
+	if (pid < 1 || (i = index_find(&pid_index, pid)) < 0)
 		return NULL;
-	for (i = 0; i < MAXJOBS; i++)
-		if (job_list[i].pid == pid)
-			return &job_list[i];
-	return NULL;
+	return &job_list[i];
 }
 
 /* getjobjid  - Find a job (by JID) on the job list */
@@ -749,27 +4260,18 @@ struct job_t *getjobjid(struct job_t *job_list, int jid)
 {
 	int i;
 
-	if (jid < 1)
+	if (jid < 1 || (i = index_find(&jid_index, jid)) < 0)
 		return NULL;
-	for (i = 0; i < MAXJOBS; i++)
-		if (job_list[i].jid == jid)
-			return &job_list[i];
-	return NULL;
+	return &job_list[i];
 }
 
 /* pid2jid - Map process ID to job ID */
 	int 
 pid2jid(pid_t pid) 
 {
-	int i;
+	struct job_t *job = getjobpid(job_list, pid);
 
-	if (pid < 1)
-		return 0;
-	for (i = 0; i < MAXJOBS; i++)
-		if (job_list[i].pid == pid) {
-			return job_list[i].jid;
-		}
-	return 0;
+	return job ? job->jid : 0;
 }
 
 /* listjobs - Print the job list */
@@ -781,7 +4283,7 @@ listjobs(struct job_t *job_list, int output_fd)
 
 
 
-	for (i = 0; i < MAXJOBS; i++) {
+	for (i = 0; i < job_slots; i++) {
 		memset(buf, '\0', MAXLINE);
 		if (job_list[i].pid != 0) {
 			sprintf(buf, "[%d] (%d) ", job_list[i].jid, job_list[i].pid);
@@ -809,7 +4311,7 @@ listjobs(struct job_t *job_list, int output_fd)
 				exit(1);
 			}
 			memset(buf, '\0', MAXLINE);
-			sprintf(buf, "%s\n", job_list[i].cmdline);
+			sprintf(buf, "%.*s\n", MAXLINE-2, job_list[i].cmdline);
 			if(write(output_fd, buf, strlen(buf)) < 0) {
 				fprintf(stderr, "Error writing to output file\n");
 				exit(1);
@@ -820,6 +4322,123 @@ listjobs(struct job_t *job_list, int output_fd)
 		close(output_fd);
 }
 
+/*
+ * listjobs_usage - Print the job list with the wall clock time each
+ *     job has been running and the CPU time it has used: from wait4()
+ *     for its processes already reaped, from /proc for the rest
+ */
+void listjobs_usage(struct job_t *job_list, int output_fd) 
+{
+	char buf[MAXLINE];
+	struct timespec now;
+	struct job_t *job;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0; i < job_slots; i++) {
+		job = &job_list[i];
+		if (job->pid == 0)
+			continue;
+		snprintf(buf, MAXLINE, "[%d] (%d) %s real %.2fs user %.2fs sys %.2fs "
+				"live %.2fs maxrss %ldk %.*s\n",
+				job->jid, job->pid,
+				job->state == ST ? "Stopped   " :
+				job->state == FG ? "Foreground" : "Running   ",
+				(now.tv_sec - job->start.tv_sec) +
+				(now.tv_nsec - job->start.tv_nsec) / 1e9,
+				job->usage.ru_utime.tv_sec + job->usage.ru_utime.tv_usec / 1e6,
+				job->usage.ru_stime.tv_sec + job->usage.ru_stime.tv_usec / 1e6,
+				live_cpu(i), job->usage.ru_maxrss,
+				MAXLINE/2, job->cmdline);
+		if (write(output_fd, buf, strlen(buf)) < 0) {
+			fprintf(stderr, "Error writing to output file\n");
+			exit(1);
+		}
+	}
+	if(output_fd != STDOUT_FILENO)
+		close(output_fd);
+}
+
+/*
+ * live_cpu - CPU seconds (user + system) used so far by the processes
+ *     of the job in slot that have not been reaped yet
+ */
+static double live_cpu(int slot)
+{
+	char path[64], stat[MAXLINE], *p;
+	unsigned long utime, stime, ticks = 0;
+	int b, fd, n;
+
+	for (b = 0; pid_index.keys && b <= pid_index.mask; b++) {
+		if (pid_index.slots[b] != slot + 1)
+			continue;
+		if (pid_index.keys[b] == job_list[slot].pid && job_list[slot].leader_done)
+			continue;
+		sprintf(path, "/proc/%d/stat", pid_index.keys[b]);
+		if ((fd = open(path, O_RDONLY)) < 0)
+			continue;
+		n = read(fd, stat, sizeof(stat) - 1);
+		close(fd);
+		if (n <= 0)
+			continue;
+		stat[n] = '\0';
+
+		/* utime and stime are fields 14 and 15, counted past the
+		 * ")" that ends the command name */
+		if ((p = strrchr(stat, ')')) != NULL &&
+				sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+					&utime, &stime) == 2)
+			ticks += utime + stime;
+	}
+	return (double)ticks / sysconf(_SC_CLK_TCK);
+}
+
+/*
+ * jobusage - Add the rusage of reaped process pid to its job, and keep
+ *     its wait status if it is the last command of the pipeline. Only
+ *     adds and compares numbers, so the SIGCHLD handler may call it.
+ */
+void jobusage(struct job_t *job_list, pid_t pid, int status, const struct rusage *ru) 
+{
+	struct job_t *job;
+
+	if ((job = getjobpid(job_list, pid)) == NULL)
+		return;
+	if (pid == job->last)
+		job->status = status;
+	timeradd(&job->usage.ru_utime, &ru->ru_utime, &job->usage.ru_utime);
+	timeradd(&job->usage.ru_stime, &ru->ru_stime, &job->usage.ru_stime);
+	if (ru->ru_maxrss > job->usage.ru_maxrss)
+		job->usage.ru_maxrss = ru->ru_maxrss;
+	job->usage.ru_minflt += ru->ru_minflt;
+	job->usage.ru_majflt += ru->ru_majflt;
+	job->usage.ru_nvcsw += ru->ru_nvcsw;
+	job->usage.ru_nivcsw += ru->ru_nivcsw;
+}
+
+/*
+ * print_usage - What the time prefix prints: wall clock time, CPU
+ *     time, the largest resident set of any process, page faults and
+ *     context switches
+ */
+void print_usage(const struct timespec *real, const struct rusage *ru, int output_fd) 
+{
+	char buf[MAXLINE];
+
+	snprintf(buf, MAXLINE, "real\t%.3fs\nuser\t%.3fs\nsys\t%.3fs\n"
+			"maxrss\t%ldk\nfaults\t%ld minor, %ld major\n"
+			"ctxsw\t%ld voluntary, %ld involuntary\n",
+			real->tv_sec + real->tv_nsec / 1e9,
+			ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6,
+			ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6,
+			ru->ru_maxrss, ru->ru_minflt, ru->ru_majflt,
+			ru->ru_nvcsw, ru->ru_nivcsw);
+	if (write(output_fd, buf, strlen(buf)) < 0) {
+		fprintf(stderr, "Error writing to output file\n");
+		exit(1);
+	}
+}
+
 
 /* Prints [jid] (pid) jobname 
  * Arg - pid_t pid 
@@ -827,7 +4446,7 @@ listjobs(struct job_t *job_list, int output_fd)
 
 void printjob(pid_t pid,int output_fd){   
 
-	int i;
+	struct job_t *job;
 	char buf[MAXLINE];
 	int job_id ;
 
@@ -848,13 +4467,8 @@ void printjob(pid_t pid,int output_fd){
 
 	memset(buf, '\0', MAXLINE);
 
-	for (i = 0; i < MAXJOBS; i++) {
-		if (job_list[i].jid == job_id) {
-			sprintf(buf,"%s\n",job_list[i].cmdline);
-			break;
-		}
-
-	}
+	if ((job = getjobjid(job_list, job_id)) != NULL)
+		sprintf(buf,"%.*s\n",MAXLINE-2,job->cmdline);
 
 	if(write(output_fd, buf, strlen(buf)) < 0) {
 		fprintf(stderr, "Error writing to output file\n");
@@ -870,7 +4484,6 @@ void printjob(pid_t pid,int output_fd){
 //Print message that fg job was terminated by SIGINT signal 
 void print_sigint_job(struct job_t *job_list,pid_t pid,int signal,int output_fd) {
 
-	int i;
 	char buf[MAXLINE];
 	int job_id ;
 
@@ -892,13 +4505,8 @@ void print_sigint_job(struct job_t *job_list,pid_t pid,int signal,int output_fd)
 
 	memset(buf, '\0', MAXLINE);
 
-	for (i = 0; i < MAXJOBS; i++) {
-		if (job_list[i].jid == job_id) {
-			sprintf(buf,"terminated by signal %d\n",signal);
-			break;
-		}
-
-	}
+	if (getjobjid(job_list, job_id) != NULL)
+		sprintf(buf,"terminated by signal %d\n",signal);
 
 	if(write(output_fd, buf, strlen(buf)) < 0) {
 		fprintf(stderr, "Error writing to output file\n");
@@ -915,7 +4523,6 @@ void print_sigint_job(struct job_t *job_list,pid_t pid,int signal,int output_fd)
 //Print message that job was stpped by SIGSTP signal 
 void print_sigtstp_job(struct job_t *job_list,pid_t pid,int signal,int output_fd) {
 
-	int i;
 	char buf[MAXLINE];
 	int job_id ;
 
@@ -935,13 +4542,8 @@ void print_sigtstp_job(struct job_t *job_list,pid_t pid,int signal,int output_fd
 
 	memset(buf, '\0', MAXLINE);
 
-	for (i = 0; i < MAXJOBS; i++) {
-		if (job_list[i].jid == job_id) {
-			sprintf(buf,"stopped by signal %d\n",signal);
-			break;
-		}
-
-	}
+	if (getjobjid(job_list, job_id) != NULL)
+		sprintf(buf,"stopped by signal %d\n",signal);
 
 	if(write(output_fd, buf, strlen(buf)) < 0) {
 		fprintf(stderr, "Error writing to output file\n");
@@ -966,13 +4568,8 @@ void change_job_state(struct job_t *job_list,pid_t pid,int new_state) {
 		exit(1);
 	}
 
-	for (i = 0; i < MAXJOBS; i++) {
-		if (job_list[i].jid == job_id) {
-			job_list[i].state = new_state;
-			break;
-		}
-
-	}
+	if ((i = index_find(&jid_index, job_id)) >= 0)
+		set_job_state(i, new_state);
 
 	return;
 
@@ -993,13 +4590,8 @@ void change_job_state_jid(struct job_t *job_list,int jid,int new_state) {
 		exit(1);
 	}
 
-	for (i = 0; i < MAXJOBS; i++) {
-		if (job_list[i].jid == job_id) {
-			job_list[i].state = new_state;
-			break;
-		}
-
-	}
+	if ((i = index_find(&jid_index, job_id)) >= 0)
+		set_job_state(i, new_state);
 
 	return;
 
@@ -1011,18 +4603,163 @@ void change_job_state_jid(struct job_t *job_list,int jid,int new_state) {
 
 pid_t jid2pid(int jid){   
 
-	int i;
+	struct job_t *job = getjobjid(job_list, jid);
 
-	for (i = 0; i < MAXJOBS; i++) {
-		if (job_list[i].jid == jid) {
-			return job_list[i].pid;
-		}
+	return job ? job->pid : 0;
+}
+
+/*
+ * grow_jobs - Double the job table (or create it) and add the new
+ *     slots to free_slots. Call with signals blocked. Returns the new
+ *     job_list, or NULL, leaving the table as it was, if memory ran out.
+ */
+static struct job_t *grow_jobs(void)
+{
+	int i, n = job_slots ? 2 * job_slots : MAXJOBS;
+	struct job_t *jobs;
+	int *heap;
+
+	if ((jobs = realloc(job_list, n * sizeof(struct job_t))) == NULL)
+		return NULL;
+	job_list = jobs;
+	if ((heap = realloc(free_slots, n * sizeof(int))) == NULL)
+		return NULL;
+	free_slots = heap;
 
+	for (i = job_slots; i < n; i++) {
+		clearjob(&job_list[i]);
+		free_slot_push(i);
 	}
+	job_slots = n;
+	return job_list;
+}
+
+/*
+ * index_reserve - Make room for n more entries in ix, doubling it
+ *     until it is at most half full. Call with signals blocked.
+ *     Returns -1 if memory ran out.
+ */
+static int index_reserve(struct job_index *ix, int n)
+{
+	struct job_index new;
+	int i, nbuckets = ix->keys ? ix->mask + 1 : 2 * MAXJOBS;
 
+	if (ix->keys && 2 * (ix->count + n) <= nbuckets)
+		return 0;
+	while (2 * (ix->count + n) > nbuckets)
+		nbuckets *= 2;
+	new.keys = malloc(nbuckets * sizeof(int));
+	new.slots = calloc(nbuckets, sizeof(int));
+	if (new.keys == NULL || new.slots == NULL) {
+		free(new.keys);
+		free(new.slots);
+		return -1;
+	}
+	new.mask = nbuckets - 1;
+	new.count = 0;
+	for (i = 0; ix->keys && i <= ix->mask; i++)
+		if (ix->slots[i])
+			index_insert(&new, ix->keys[i], ix->slots[i] - 1);
+	free(ix->keys);
+	free(ix->slots);
+	*ix = new;
 	return 0;
+}
+
+/* index_bucket - Home bucket of key (Fibonacci hashing) */
+static inline int index_bucket(struct job_index *ix, int key)
+{
+	return ((unsigned)key * 2654435769u >> 7) & ix->mask;
+}
+
+/* index_find - Returns the slot that key maps to, or -1 */
+static int index_find(struct job_index *ix, int key)
+{
+	int b;
+
+	if (ix->keys == NULL)
+		return -1;
+	for (b = index_bucket(ix, key); ix->slots[b]; b = (b + 1) & ix->mask)
+		if (ix->keys[b] == key)
+			return ix->slots[b] - 1;
+	return -1;
+}
+
+/* index_insert - Map key to slot; index_reserve() made room for it */
+static void index_insert(struct job_index *ix, int key, int slot)
+{
+	int b;
+
+	for (b = index_bucket(ix, key); ix->slots[b]; b = (b + 1) & ix->mask)
+		;
+	ix->keys[b] = key;
+	ix->slots[b] = slot + 1;
+	ix->count++;
+}
+
+/*
+ * index_remove - Take key out of ix, moving later entries of its
+ *     probe run back so that lookups need no tombstones
+ */
+static void index_remove(struct job_index *ix, int key)
+{
+	int hole, b, home;
+
+	for (hole = index_bucket(ix, key); ix->keys[hole] != key ||
+			!ix->slots[hole]; hole = (hole + 1) & ix->mask)
+		;
+	for (b = (hole + 1) & ix->mask; ix->slots[b]; b = (b + 1) & ix->mask) {
+		home = index_bucket(ix, ix->keys[b]);
+		/* Entries whose home lies in (hole, b] stay put */
+		if (hole <= b ? (hole < home && home <= b)
+				: (hole < home || home <= b))
+			continue;
+		ix->keys[hole] = ix->keys[b];
+		ix->slots[hole] = ix->slots[b];
+		hole = b;
+	}
+	ix->slots[hole] = 0;
+	ix->count--;
+}
+
+/* set_job_state - Change the state of the job in slot, tracking FG */
+static void set_job_state(int slot, int state)
+{
+	job_list[slot].state = state;
+	if (state == FG)
+		fg_slot = slot;
+	else if (fg_slot == slot)
+		fg_slot = -1;
+}
 
+/* free_slot_push - Return slot to the free heap */
+static void free_slot_push(int slot)
+{
+	int i = nfree++, parent;
+
+	while (i > 0 && free_slots[parent = (i - 1) / 2] > slot) {
+		free_slots[i] = free_slots[parent];
+		i = parent;
+	}
+	free_slots[i] = slot;
+}
 
+/* free_slot_pop - Take the lowest free slot; the heap must not be empty */
+static int free_slot_pop(void)
+{
+	int slot = free_slots[0], last = free_slots[--nfree];
+	int i = 0, child;
+
+	while ((child = 2 * i + 1) < nfree) {
+		if (child + 1 < nfree && free_slots[child + 1] < free_slots[child])
+			child++;
+		if (free_slots[child] >= last)
+			break;
+		free_slots[i] = free_slots[child];
+		i = child;
+	}
+	free_slots[i] = last;
+	return slot;
 }
 
 
@@ -1041,10 +4778,13 @@ pid_t jid2pid(int jid){
 	void 
 usage(void) 
 {
-	printf("Usage: shell [-hvp]\n");
+	printf("Usage: shell [-hvpe] [-c command | script | -S socket]\n");
 	printf("   -h   print this message\n");
 	printf("   -v   print additional diagnostic information\n");
 	printf("   -p   do not emit a command prompt\n");
+	printf("   -e   handle signals in an event loop (signalfd)\n");
+	printf("   -c   run the lines of command, then exit\n");
+	printf("   -S   run the jobs clients send to the UNIX socket (tshc)\n");
 	exit(1);
 }
 
@@ -0,0 +1,195 @@
+/*
+ * tshc - Run a command line in a tsh job server
+ *
+ * Sends the command line, with our stdin, stdout and stderr attached
+ * (SCM_RIGHTS), to a shell started with "tsh -S <socket>", waits for
+ * the job to finish and exits with its status. The shell runs it as
+ * one of its background jobs, so it is in the job list of everyone
+ * else using that shell.
+ *
+ * With -n, it is a benchmark instead: the command line is sent count
+ * times, with up to -j requests in flight at once, and the requests
+ * completed per second are printed.
+ *
+ * Usage: tshc [-S <socket>] [-n <count> [-j <jobs>]] <command line...>
+ *        The socket is $TSH_SOCKET unless -S is given.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static int submit(const char *path, const char *line);
+static int reply(int fd);
+static void bench(const char *path, const char *line, int count, int jobs);
+static double now(void);
+static void usage(const char *prog);
+static void unix_error(char *msg);
+
+int main(int argc, char **argv)
+{
+	char *path = getenv("TSH_SOCKET"), *line;
+	int c, i, count = 0, jobs = 1;
+	size_t len = 0;
+
+	while ((c = getopt(argc, argv, "+S:n:j:")) != -1) {
+		switch (c) {
+		case 'S':
+			path = optarg;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (path == NULL || optind == argc || count < 0 || jobs < 1)
+		usage(argv[0]);
+
+	/* The words make up the command line again */
+	for (i = optind; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+	if ((line = malloc(len)) == NULL)
+		unix_error("malloc error");
+	line[0] = '\0';
+	for (i = optind; i < argc; i++) {
+		if (i > optind)
+			strcat(line, " ");
+		strcat(line, argv[i]);
+	}
+
+	if (count > 0)
+		bench(path, line, count, jobs);
+	else
+		exit(reply(submit(path, line)));
+	exit(0);
+}
+
+/*
+ * submit - Connect to the server at path and send it line, with fds 0,
+ *     1 and 2. Returns the connection, on which the reply will come.
+ */
+static int submit(const char *path, const char *line)
+{
+	char cbuf[CMSG_SPACE(3 * sizeof(int))];
+	struct sockaddr_un addr;
+	struct msghdr msg = { 0 };
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	int fds[3] = { 0, 1, 2 }, fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		exit(1);
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0)
+		unix_error("socket error");
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		unix_error("connect error");
+
+	iov.iov_base = (char *)line;
+	iov.iov_len = strlen(line);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	if (sendmsg(fd, &msg, 0) < 0)
+		unix_error("sendmsg error");
+	return fd;
+}
+
+/*
+ * reply - Wait for the exit status on connection fd and close it.
+ *     Returns 255 if the server went away without sending one.
+ */
+static int reply(int fd)
+{
+	ssize_t n;
+	int code;
+
+	while ((n = recv(fd, &code, sizeof(code), 0)) < 0 && errno == EINTR)
+		;
+	close(fd);
+	return (n == sizeof(code)) ? code : 255;
+}
+
+/*
+ * bench - Send line count times, keeping up to jobs requests in flight,
+ *     and print how many completed per second
+ */
+static void bench(const char *path, const char *line, int count, int jobs)
+{
+	struct pollfd *fds;
+	int sent = 0, done = 0, failed = 0, n = 0, i;
+	double start;
+
+	if ((fds = malloc(jobs * sizeof(struct pollfd))) == NULL)
+		unix_error("malloc error");
+	start = now();
+	while (done < count) {
+		for (; n < jobs && sent < count; n++, sent++) {
+			fds[n].fd = submit(path, line);
+			fds[n].events = POLLIN;
+		}
+		if (poll(fds, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			unix_error("poll error");
+		}
+		for (i = n - 1; i >= 0; i--) {
+			if (fds[i].revents == 0)
+				continue;
+			if (reply(fds[i].fd) != 0)
+				failed++;
+			fds[i] = fds[--n];
+			done++;
+		}
+	}
+	printf("%d requests, %d in flight: %.3f s, %.0f requests/s",
+			count, jobs, now() - start, count / (now() - start));
+	if (failed > 0)
+		printf(", %d failed", failed);
+	printf("\n");
+	free(fds);
+}
+
+/* now - Monotonic time in seconds */
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-S <socket>] [-n <count> [-j <jobs>]] "
+			"<command line...>\n", prog);
+	exit(2);
+}
+
+static void unix_error(char *msg)
+{
+	fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+	exit(1);
+}
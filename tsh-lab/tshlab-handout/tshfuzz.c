@@ -0,0 +1,520 @@
+/*
+ * tshfuzz - Fuzz the tsh command line parser and builtins in-process
+ *
+ * Each input is one command line. It is parsed as parseline() does,
+ * every pipeline of the list is checked (see check_list), and each
+ * builtin in it that neither waits nor ends the shell is run with
+ * run_command() against a job list of two stopped jobs. Nothing is
+ * run as an external command, $(...) is not expanded, and
+ * redirections are dropped before a builtin runs, so no files are
+ * written.
+ *
+ * tsh.c is compiled into this program, with -fsanitize-coverage=
+ * trace-pc: every edge it takes is counted in cov_map, and an input
+ * that reaches a new edge, or an edge a new number of times (as AFL
+ * buckets them), joins the corpus. Inputs are mutated from the corpus
+ * with the tokens of the shell's grammar. Built with clang and
+ * -DLIBFUZZER, it is a libFuzzer target instead.
+ *
+ * An input that crashes or fails a check is written to crash-<pid>.txt
+ * and the run stops; "tshfuzz <file>..." runs such inputs again.
+ *
+ * Usage: tshfuzz [-n <execs>] [-s <seed>] [<file>...]
+ */
+#define main tsh_main
+#include "tsh.c"
+#undef main
+
+/* The fuzzer's own code is left out of the coverage it measures */
+#ifdef LIBFUZZER
+#define NOCOV
+#else
+#define NOCOV __attribute__((no_sanitize_coverage))
+#endif
+
+static struct arena check_arena;            /* for re-parsing */
+static pid_t fuzz_jobs[2];                  /* the stopped jobs */
+static int report_fd = -1;                  /* stderr, before /dev/null */
+static const char *cur_input;               /* being run, for crashes */
+static size_t cur_len;
+
+static void fuzz_init(void);
+static void run_input(const char *data, size_t size);
+static void check_list(struct cmdline_tokens *list);
+static void check_failed(const char *what);
+static void crash_handler(int sig);
+static void save_input(const char *what);
+
+#ifdef LIBFUZZER
+	int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	static int ready;
+
+	if (!ready) {
+		fuzz_init();
+		ready = 1;
+	}
+	run_input((const char *)data, size);
+	return 0;
+}
+
+#else
+
+#define MAPSIZE (1 << 16)   /* edge counters */
+#define MAXINPUT 1024       /* longest input made by mutation */
+#define MAXCORPUS 8192
+
+static unsigned char cov_map[MAPSIZE];
+static unsigned char cov_seen[MAPSIZE];     /* buckets each edge has hit */
+static unsigned cov_prev;
+static int cov_edges;
+
+static char *corpus[MAXCORPUS];
+static size_t corpus_len[MAXCORPUS];
+static int ncorpus;
+static uint64_t rng_state = 88172645463325252ULL;
+
+/* Lines to start from, and tokens to put in */
+static const char *seeds[] = {
+	"jobs", "fg %1", "bg 1", "fg", "bg %2 x", "jobs -l", "hash", "hash -r",
+	"hash ls cat", "history", "history 3", "limit", "limit %1 cpu 50 mem 4M",
+	"limit cpu max", "time jobs", "quit", "wait %1", "sched",
+	"sched %1 cpus 0,2-3 nice 5 policy batch", "sched nice 3 ./x &",
+	"/bin/echo a 'b c' \"d\" | wc -l > out &",
+	"a && b || c ; d & e", "cat < in 2>&1 >> out", "x $(echo 'y') z",
+	"time /bin/true | time x", "2>err 1>&2 ls",
+};
+static const char *tokens[] = {
+	" ", "|", "&", "&&", "||", ";", "<", ">", ">>", "2>", "2>&1", ">&",
+	"<&", "$(", ")", "'", "\"", "\\", "\n", "%", "%1", "%2", "-1", "0",
+	"2147483648", "time ", "fg ", "bg ", "jobs ", "hash ", "limit ",
+	"history ", "quit", "wait ", "parallel ", "cpu ", "mem ", "max", "-r",
+	"-l", "\t", "sched ", "cpus ", "nice ", "policy ", "idle", "all",
+};
+
+static int new_coverage(void);
+static void fuzz_loop(long execs);
+static size_t mutate(char *buf, size_t len);
+static void corpus_add(const char *data, size_t len);
+static uint64_t rng(void);
+static double seconds(void);
+
+/*
+ * __sanitizer_cov_trace_pc - Called on every edge of the instrumented
+ *     code; counts it in cov_map as AFL does, by the pair of blocks
+ */
+	NOCOV void
+__sanitizer_cov_trace_pc(void)
+{
+	uintptr_t pc = (uintptr_t)__builtin_return_address(0);
+	unsigned cur = (unsigned)((pc ^ (pc >> 16)) * 0x9e3779b1u) >> 16;
+
+	cov_map[(cur ^ cov_prev) & (MAPSIZE - 1)]++;
+	cov_prev = cur >> 1;
+}
+
+	NOCOV int
+main(int argc, char **argv)
+{
+	long execs = 1000000;
+	char *buf;
+	size_t len;
+	FILE *fp;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "n:s:")) != -1) {
+		switch (c) {
+		case 'n':
+			execs = atol(optarg);
+			break;
+		case 's':
+			rng_state = strtoull(optarg, NULL, 0) | 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n <execs>] [-s <seed>] [<file>...]\n",
+					argv[0]);
+			exit(2);
+		}
+	}
+	fuzz_init();
+
+	/* Run the inputs given, once each */
+	if (optind < argc) {
+		for (i = optind; i < argc; i++) {
+			if ((fp = fopen(argv[i], "r")) == NULL)
+				unix_error(argv[i]);
+			buf = NULL;
+			len = 0;
+			if (getdelim(&buf, &len, '\0', fp) < 0)
+				len = 0;
+			else
+				len = strlen(buf);
+			fclose(fp);
+			run_input(buf ? buf : "", len);
+			dprintf(report_fd, "%s: ok\n", argv[i]);
+			free(buf);
+		}
+	}
+	else
+		fuzz_loop(execs);
+
+	kill(fuzz_jobs[0], SIGKILL);
+	kill(fuzz_jobs[1], SIGKILL);
+	exit(0);
+}
+#endif
+
+/*
+ * fuzz_init - Set up a shell without its read loop: the job list, with
+ *     two real processes stopped in process groups of their own, an
+ *     empty history, and stdout and stderr going to /dev/null
+ */
+	NOCOV static void
+fuzz_init(void)
+{
+	struct sigaction sa;
+	int i, fd;
+
+	if ((report_fd = dup(STDERR_FILENO)) < 0)
+		unix_error("dup error");
+	setenv("TSH_HISTFILE", "", 1);
+	initjobs();
+	hist_init();
+	tsh_pid = getpid();
+
+	for (i = 0; i < 2; i++) {
+		if ((fuzz_jobs[i] = fork()) < 0)
+			unix_error("fork error");
+		if (fuzz_jobs[i] == 0) {
+			setpgid(0, 0);
+			while (1)
+				pause();
+		}
+		setpgid(fuzz_jobs[i], fuzz_jobs[i]);
+		addjob(job_list, fuzz_jobs[i], ST, i ? "./myspin2 &" : "./myspin1 &");
+	}
+
+	if ((fd = open("/dev/null", O_WRONLY)) < 0)
+		unix_error("open error");
+	fflush(stdout);
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+	close(fd);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = crash_handler;
+	sa.sa_flags = SA_RESETHAND;
+	sigaction(SIGSEGV, &sa, NULL);
+	sigaction(SIGBUS, &sa, NULL);
+	sigaction(SIGFPE, &sa, NULL);
+	sigaction(SIGILL, &sa, NULL);
+	sigaction(SIGABRT, &sa, NULL);
+}
+
+/*
+ * run_input - Parse one command line, check it and run its builtins
+ */
+	NOCOV static void
+run_input(const char *data, size_t size)
+{
+	struct cmdline_tokens *list, *tok;
+	char *line;
+	int i;
+
+	if ((line = malloc(size + 1)) == NULL)
+		unix_error("malloc error");
+	memcpy(line, data, size);
+	line[size] = '\0';
+	cur_input = data;
+	cur_len = size;
+
+	if (parseline(line, &list) == 0) {
+		check_list(list);
+		for (tok = list; tok != NULL; tok = tok->next) {
+			if (tok->builtins == BUILTIN_NONE ||
+					tok->builtins == BUILTIN_QUIT ||
+					tok->builtins == BUILTIN_WAIT ||
+					tok->builtins == BUILTIN_PARALLEL)
+				continue;
+			tok->redirs = NULL;
+			run_command(tok);
+		}
+	}
+
+	/* Put the jobs back as they were, and forget what was hashed */
+	for (i = 0; i < 2; i++) {
+		if (getjobpid(job_list, fuzz_jobs[i]) == NULL)
+			check_failed("a job left the job list");
+		change_job_state(job_list, fuzz_jobs[i], ST);
+	}
+	fg_pid = 0;
+	hash_forget();
+	free(line);
+	cur_input = NULL;
+}
+
+/*
+ * check_list - Check what the parser promises about each pipeline:
+ *     argv holds argc entries and a NULL, with one NULL between each
+ *     two commands where stage[] says; redirections belong to one of
+ *     the commands; a builtin is alone; and the text kept for the job
+ *     list parses to the same words.
+ */
+	NOCOV static void
+check_list(struct cmdline_tokens *list)
+{
+	struct cmdline_tokens *tok, *again;
+	struct redir *r;
+	int i, s, nulls;
+
+	for (tok = list; tok != NULL; tok = tok->next) {
+		if (tok->argc < 1 || tok->argv[tok->argc] != NULL ||
+				tok->argv[0] == NULL)
+			check_failed("argv is not argc words and a NULL");
+		if (tok->nstages < 1 || tok->stage[0] != 0)
+			check_failed("bad stages");
+		for (s = 1; s < tok->nstages; s++)
+			if (tok->stage[s] <= tok->stage[s-1] ||
+					tok->stage[s] >= tok->argc ||
+					tok->argv[tok->stage[s] - 1] != NULL ||
+					tok->argv[tok->stage[s]] == NULL)
+				check_failed("stage does not start a command");
+		for (i = nulls = 0; i < tok->argc; i++)
+			nulls += tok->argv[i] == NULL;
+		if (nulls != tok->nstages - 1)
+			check_failed("stray NULL in argv");
+		for (r = tok->redirs; r != NULL; r = r->next)
+			if (r->stage < 0 || r->stage >= tok->nstages || r->fd < 0 ||
+					r->type < REDIR_IN || r->type > REDIR_DUP ||
+					(r->type == REDIR_DUP ? r->dupfd < 0 : r->file == NULL))
+				check_failed("bad redirection");
+		if (tok->builtins != BUILTIN_NONE && tok->nstages != 1)
+			check_failed("builtin in a pipeline");
+		if (tok->op < LIST_SEQ || tok->op > LIST_OR || tok->text == NULL)
+			check_failed("bad op or text");
+
+		arena_reset(&check_arena);
+		if (parse_tokens(&check_arena, tok->text, 0, &again) < 0 ||
+				again == NULL || again->next != NULL ||
+				again->argc != tok->argc || again->bg != tok->bg ||
+				again->timed != tok->timed ||
+				(again->sched == NULL) != (tok->sched == NULL))
+			check_failed("job list text parses differently");
+		for (i = 0; i < tok->argc; i++)
+			if ((again->argv[i] == NULL) != (tok->argv[i] == NULL) ||
+					(tok->argv[i] && strcmp(again->argv[i], tok->argv[i])))
+				check_failed("job list text parses differently");
+	}
+}
+
+/* check_failed - Report a failed check on the input and stop */
+	NOCOV static void
+check_failed(const char *what)
+{
+	save_input(what);
+	kill(fuzz_jobs[0], SIGKILL);
+	kill(fuzz_jobs[1], SIGKILL);
+	_exit(1);
+}
+
+/* crash_handler - The input crashed tsh: keep it, then die of sig */
+	NOCOV static void
+crash_handler(int sig)
+{
+	save_input(strsignal(sig));
+	kill(fuzz_jobs[0], SIGKILL);
+	kill(fuzz_jobs[1], SIGKILL);
+	raise(sig);
+}
+
+/*
+ * save_input - Write the input being run to crash-<pid>.txt and say
+ *     why. Only uses calls that are safe in a signal handler.
+ */
+	NOCOV static void
+save_input(const char *what)
+{
+	char name[64];
+	int fd;
+
+	snprintf(name, sizeof(name), "crash-%d.txt", (int)getpid());
+	if (cur_input != NULL &&
+			(fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+		if (write(fd, cur_input, cur_len) < 0)
+			name[0] = '\0';
+		close(fd);
+	}
+	dprintf(report_fd, "tshfuzz: %s; input saved in %s\n", what, name);
+}
+
+#ifndef LIBFUZZER
+
+/*
+ * new_coverage - Fold cov_map into cov_seen and clear it; returns 1 if
+ *     an edge was taken for the first time, or a number of times in a
+ *     bucket (1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+) not seen before
+ */
+	NOCOV static int
+new_coverage(void)
+{
+	static const unsigned char bucket[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint64_t *words = (uint64_t *)cov_map;
+	unsigned char b, hits;
+	int i, j, found = 0;
+
+	for (i = 0; i < MAPSIZE / 8; i++) {
+		if (words[i] == 0)
+			continue;
+		for (j = i * 8; j < i * 8 + 8; j++) {
+			if ((hits = cov_map[j]) == 0)
+				continue;
+			b = bucket[hits <= 3 ? hits - 1 : hits < 8 ? 3 : hits < 16 ? 4 :
+				hits < 32 ? 5 : hits < 128 ? 6 : 7];
+			if (!(cov_seen[j] & b)) {
+				cov_edges += cov_seen[j] == 0;
+				cov_seen[j] |= b;
+				found = 1;
+			}
+		}
+		words[i] = 0;
+	}
+	return found;
+}
+
+/*
+ * fuzz_loop - Run execs inputs, each the seeds first and then mutants
+ *     of the corpus, printing progress every few seconds
+ */
+	NOCOV static void
+fuzz_loop(long execs)
+{
+	char buf[MAXINPUT + 1];
+	double start = seconds(), last = start;
+	size_t len;
+	long n;
+	int i;
+
+	for (i = 0; i < sizeof(seeds) / sizeof(seeds[0]); i++) {
+		memset(cov_map, 0, sizeof(cov_map));
+		run_input(seeds[i], strlen(seeds[i]));
+		new_coverage();
+		corpus_add(seeds[i], strlen(seeds[i]));
+	}
+
+	for (n = 0; n < execs; n++) {
+		i = rng() % ncorpus;
+		memcpy(buf, corpus[i], corpus_len[i]);
+		len = mutate(buf, corpus_len[i]);
+		memset(cov_map, 0, sizeof(cov_map));
+		run_input(buf, len);
+		if (new_coverage())
+			corpus_add(buf, len);
+		if ((n & 1023) == 0 && seconds() - last >= 5) {
+			last = seconds();
+			dprintf(report_fd, "%ld execs, %.0f/s, corpus %d, edges %d\n",
+					n, n / (last - start), ncorpus, cov_edges);
+		}
+	}
+	dprintf(report_fd, "%ld execs, %.0f/s, corpus %d, edges %d, no crashes\n",
+			execs, execs / (seconds() - start), ncorpus, cov_edges);
+}
+
+/*
+ * mutate - Change the len bytes at buf, which has room for MAXINPUT,
+ *     a few times over; returns the new length
+ */
+	NOCOV static size_t
+mutate(char *buf, size_t len)
+{
+	const char *t;
+	size_t pos, n, tlen;
+	int k, i;
+
+	for (k = 1 + rng() % 4; k > 0; k--) {
+		pos = len ? rng() % (len + 1) : 0;
+		switch (rng() % 6) {
+		case 0:             /* put in a token */
+			t = tokens[rng() % (sizeof(tokens) / sizeof(tokens[0]))];
+			tlen = strlen(t);
+			if (len + tlen > MAXINPUT)
+				break;
+			memmove(buf + pos + tlen, buf + pos, len - pos);
+			memcpy(buf + pos, t, tlen);
+			len += tlen;
+			break;
+		case 1:             /* take out a few bytes */
+			n = rng() % 8;
+			if (n > len - pos)
+				n = len - pos;
+			memmove(buf + pos, buf + pos + n, len - pos - n);
+			len -= n;
+			break;
+		case 2:             /* change a byte */
+			if (pos < len)
+				buf[pos] = (rng() & 1) ? 32 + rng() % 95 : rng() % 256;
+			break;
+		case 3:             /* copy a piece of the line to another place */
+			n = len ? 1 + rng() % len : 0;
+			i = len ? rng() % (len - n + 1) : 0;
+			if (len + n > MAXINPUT)
+				break;
+			memmove(buf + pos + n, buf + pos, len - pos);
+			memmove(buf + pos, buf + (i >= pos ? i + n : i), n);
+			len += n;
+			break;
+		case 4:             /* the rest of another line of the corpus */
+			i = rng() % ncorpus;
+			n = corpus_len[i] ? rng() % corpus_len[i] : 0;
+			tlen = corpus_len[i] - n;
+			if (pos + tlen > MAXINPUT)
+				break;
+			memcpy(buf + pos, corpus[i] + n, tlen);
+			len = pos + tlen;
+			break;
+		case 5:             /* a NUL, which ends the line early */
+			if (pos < len && rng() % 8 == 0)
+				buf[pos] = '\0';
+			break;
+		}
+	}
+	return len;
+}
+
+/*
+ * corpus_add - Keep a copy of an input that found something new; once
+ *     the corpus is full, in the place of one picked at random
+ */
+	NOCOV static void
+corpus_add(const char *data, size_t len)
+{
+	int i = (ncorpus < MAXCORPUS) ? ncorpus++ : rng() % MAXCORPUS;
+
+	free(corpus[i]);
+	if ((corpus[i] = malloc(len + 1)) == NULL)
+		unix_error("malloc error");
+	memcpy(corpus[i], data, len);
+	corpus_len[i] = len;
+}
+
+/* rng - xorshift64 */
+	NOCOV static uint64_t
+rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+/* seconds - Monotonic time in seconds */
+	NOCOV static double
+seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#endif